@@ -0,0 +1,151 @@
+#include "batch.h"
+#include "film.h"
+#include "path_guiding.h"
+#include "photon_map.h"
+#include "radiance_cache.h"
+#include "render.h"
+#include "scene_resources.h"
+#include "scenes.h"
+#include "stats.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace {
+struct Loaded_Scene {
+    // The scene is destroyed before the objects it references.
+    std::unique_ptr<Scene_Resources> resources;
+    std::unique_ptr<Scene> scene;
+    int remaining_job_count = 0;
+};
+
+void set_job_camera(const Render_Job& job, Scene& scene) {
+    float aspect = float(job.width) / float(job.height);
+    if (job.custom_camera)
+        scene.camera = Camera(job.look_from, job.look_at, Vector(0, 1, 0), job.vfov, aspect, 0.f, 10.f, 0.f, 1.f);
+    else
+        scene.camera.set_aspect(aspect);
+    scene.camera.set_image_height(job.height);
+}
+
+bool write_image(const std::string& file_name, const Film& film) {
+    if (file_name == "-") {
+        write_ppm(std::cout, film.develop(), film.get_width(), film.get_height());
+        return bool(std::cout);
+    }
+    std::ofstream file(file_name);
+    if (!file)
+        return false;
+    write_ppm(file, film.develop(), film.get_width(), film.get_height());
+    return bool(file);
+}
+
+bool render_job(const Render_Job& job, const Scene& shared_scene, int thread_count) {
+    Scene scene = shared_scene;
+
+    // Cell sizes and gather radius for the scale of the cornell box scenes.
+    Radiance_Cache radiance_cache(16.f, 16);
+    if (job.radiance_cache)
+        scene.radiance_cache = &radiance_cache;
+    Caustic_Photon_Map caustic_map(200000, 5.f, 8);
+    if (job.caustic_photon_map)
+        scene.caustic_map = &caustic_map;
+    // Coarser cells than the cache, each needs records for all its directional bins.
+    Guiding_Field guiding_field(32.f, 256);
+    if (job.path_guiding)
+        scene.guiding_field = &guiding_field;
+
+    Film film(job.width, job.height, create_filter(Filter_Type::mitchell));
+    std::vector<int64_t> pixel_costs(ENABLE_STATS ? job.width * job.height : 0);
+    Cost_Map cost_map(job.width, job.height);
+
+    // Animated scenes move between the frames of a sequence, and back to the start for the next job.
+    int frame_count = scene.animation ? job.frames : 1;
+    for (int frame = 0; frame < frame_count; frame++) {
+        Timestamp frame_start;
+        if (scene.animation) {
+            scene.animation->set_frame(scene, frame_count > 1 ? float(frame) / float(frame_count - 1) : 0.f);
+            scene.shape->refit();
+            if (scene.lights)
+                scene.lights->refit();
+            if (scene.radiance_cache)
+                scene.radiance_cache->clear();
+            if (scene.guiding_field)
+                scene.guiding_field->clear();
+        }
+        set_job_camera(job, scene);
+        int64_t update_time = elapsed_microseconds(frame_start);
+
+        if (job.time_budget > 0.f) {
+            // The budget covers the whole frame, the scene update is already done.
+            int64_t time_budget = int64_t(job.time_budget * 1e6f) - elapsed_microseconds(frame_start);
+            int sample_count = render_frame_with_deadline(scene, film, cost_map, job.width, job.height, job.samples, time_budget,
+                                                          thread_count, pixel_costs, job.integrator, job.tile_size, job.seed);
+            fprintf(stderr, "Frame %d: %d spp within the time budget\n", frame, sample_count);
+        } else {
+            render_frame(scene, film, cost_map, job.width, job.height, job.samples, thread_count, pixel_costs,
+                         job.integrator, job.tile_size, job.seed);
+        }
+
+        std::string file_name = job.output;
+        if (frame_count > 1) {
+            char frame_suffix[32];
+            snprintf(frame_suffix, sizeof(frame_suffix), "%04d.ppm", frame);
+            file_name += frame_suffix;
+        }
+        if (!write_image(file_name, film)) {
+            fprintf(stderr, "cannot write %s\n", file_name.c_str());
+            return false;
+        }
+
+        if (frame_count > 1)
+            fprintf(stderr, "Frame %d: update %.2fms, total %.2fs\n", frame, update_time / 1000.0f, elapsed_milliseconds(frame_start) / 1000.0f);
+    }
+
+#if ENABLE_STATS
+    write_cost_heatmap("cost_heatmap.ppm", pixel_costs, job.width, job.height);
+#endif
+    return true;
+}
+}
+
+bool render_jobs(const std::vector<Render_Job>& jobs, int thread_count) {
+    std::map<std::string, Loaded_Scene> scenes;
+    for (const Render_Job& job : jobs)
+        scenes[job.scene].remaining_job_count++;
+
+    bool success = true;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const Render_Job& job = jobs[i];
+        Timestamp t;
+
+        Loaded_Scene& loaded = scenes[job.scene];
+        if (!loaded.scene) {
+            loaded.resources.reset(new Scene_Resources);
+            Scene_Resources::Recording_Scope scope(loaded.resources.get());
+            loaded.scene.reset(create_scene(job.scene, float(job.width) / float(job.height)));
+            if (loaded.scene)
+                replicate_scene_to_nodes(*loaded.scene);
+        }
+        int64_t load_time = elapsed_microseconds(t);
+
+        if (!loaded.scene) {
+            fprintf(stderr, "unknown scene %s\n", job.scene.c_str());
+            success = false;
+        } else if (!render_job(job, *loaded.scene, thread_count)) {
+            success = false;
+        }
+
+        if (--loaded.remaining_job_count == 0) {
+            loaded.scene.reset();
+            loaded.resources.reset();
+        }
+        fprintf(stderr, "Job %d/%d (%s): scene %.2fs, total %.2fs\n", int(i + 1), int(jobs.size()), job.output.c_str(),
+                load_time / 1e6f, elapsed_milliseconds(t) / 1000.0f);
+    }
+    return success;
+}
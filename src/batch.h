@@ -0,0 +1,11 @@
+#pragma once
+
+#include "job.h"
+
+#include <vector>
+
+// Renders the jobs one after the other with the thread pool. A scene is created once for all the
+// jobs that use it and destroyed after the last of them, jobs only replace its camera.
+// Returns false if a job failed (unknown scene, output that can't be written), the jobs after
+// it are still rendered.
+bool render_jobs(const std::vector<Render_Job>& jobs, int thread_count);
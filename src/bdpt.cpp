@@ -0,0 +1,444 @@
+#include "bdpt.h"
+#include "material.h"
+#include "render.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+// Longest path in segments, and the vertex counts of the subpaths that allow it.
+const int Max_Depth = 16;
+const int Max_Camera_Vertex_Count = Max_Depth + 2;
+const int Max_Light_Vertex_Count = Max_Depth + 1;
+// Subpaths continue with russian roulette past this many vertices.
+const int Roulette_Vertex_Count = 4;
+
+enum class Vertex_Type {
+    camera,
+    light,
+    surface,
+    medium
+};
+
+struct Path_Vertex {
+    Vertex_Type type;
+    // Camera: lens point and view direction. Light: emitting surface with its normal facing the
+    // emitting side.
+    Intersection isect;
+    // The ray that reached the vertex.
+    Ray ray_in;
+    // Of the material, zero where the subpath can't scatter.
+    Vector attenuation;
+    // Throughput of the subpath up to the vertex.
+    Vector beta;
+    // Densities per unit area (or volume) of sampling the vertex from either direction.
+    float pdf_fwd;
+    float pdf_rev;
+    bool delta;
+};
+
+bool is_black(const Vector& v) {
+    return v.x <= 0.f && v.y <= 0.f && v.z <= 0.f;
+}
+
+// Solid angle density at from converted to density per unit area at to.
+float convert_density(float pdf, const Path_Vertex& from, const Path_Vertex& to) {
+    Vector w = to.isect.p - from.isect.p;
+    float distance_sq = w.squared_length();
+    if (distance_sq == 0.f)
+        return 0.f;
+    if (to.type != Vertex_Type::medium)
+        pdf *= std::abs(dot_product(to.isect.normal, w)) / std::sqrt(distance_sq);
+    return pdf / distance_sq;
+}
+
+// Scattered light (surfaces and media) or emitted light (lights) leaving the vertex in
+// direction w, times the cosine at the vertex.
+Vector evaluate_vertex(const Path_Vertex& v, const Vector& w) {
+    const Intersection& isect = v.isect;
+    if (v.type == Vertex_Type::light) {
+        float cosine = dot_product(isect.normal, w);
+        if (cosine <= 0.f)
+            return Vector(0);
+        Ray ray_in(isect.p + w, -w, v.ray_in.time);
+        return cosine * isect.material->emitted(ray_in, isect, isect.u, isect.v, isect.p);
+    }
+    // For the materials of the renderer the scattering pdf is the cosine-weighted BRDF or phase
+    // function over the albedo.
+    return v.attenuation * isect.material->scattering_pdf(v.ray_in, isect, Ray(isect.p, w, v.ray_in.time));
+}
+
+// Density per unit area of next when the subpath through prev continues from v.
+float get_pdf(const Scene& scene, const Path_Vertex& v, const Path_Vertex* prev, const Path_Vertex& next) {
+    Vector w = (next.isect.p - v.isect.p).normalized();
+    float pdf;
+    if (v.type == Vertex_Type::camera) {
+        pdf = scene.camera.get_direction_pdf(v.isect.p, w);
+    } else if (v.type == Vertex_Type::light) {
+        pdf = std::max(0.f, dot_product(v.isect.normal, w)) / PI;
+    } else {
+        Ray ray_in = prev ? Ray(prev->isect.p, v.isect.p - prev->isect.p, v.ray_in.time) : v.ray_in;
+        pdf = v.isect.material->scattering_pdf(ray_in, v.isect, Ray(v.isect.p, w, v.ray_in.time));
+    }
+    return convert_density(pdf, v, next);
+}
+
+// Density of emitting towards next from an emitter the camera subpath hit at v.
+float get_emission_pdf(const Path_Vertex& v, const Path_Vertex& next) {
+    Vector w = (next.isect.p - v.isect.p).normalized();
+    return convert_density(std::max(0.f, dot_product(v.isect.normal, w)) / PI, v, next);
+}
+
+// Visibility between two vertices times the transmittance of the media in between.
+float get_transmittance(RNG& rng, const Scene& scene, const Path_Vertex& a, const Path_Vertex& b) {
+    Vector d = b.isect.p - a.isect.p;
+    float distance = d.length();
+    Ray ray(a.isect.p, d / distance, a.ray_in.time);
+
+    Ray_Hit ray_hit;
+    if (scene.shape->hit(ray, 0.001f, distance * (1.f - 1e-3f), ray_hit))
+        return 0.f;
+
+    float transmittance = 1.f;
+    for (const Medium* medium : scene.media)
+        transmittance *= medium->transmittance(rng, ray, 0.001f, distance);
+    return transmittance;
+}
+
+// Extends the subpath from its last vertex along ray, sampled with solid angle density pdf.
+// Returns the new vertex count.
+int random_walk(RNG& rng, const Scene& scene, Ray ray, Vector beta, float pdf, Path_Vertex* path, int max_vertex_count) {
+    int count = 1;
+    while (count < max_vertex_count) {
+        Ray_Hit ray_hit;
+        bool surface_hit = scene.shape->hit(ray, 0.001f, std::numeric_limits<float>::max(), ray_hit);
+        float t_end = surface_hit ? ray_hit.t : std::numeric_limits<float>::max();
+
+        // Same free-flight sampling as the path tracer.
+        const Medium* scattering_medium = nullptr;
+        for (const Medium* medium : scene.media) {
+            float t;
+            if (!medium->is_absorbing_only() && medium->sample_scattering(rng, ray, 0.001f, t_end, t)) {
+                t_end = t;
+                scattering_medium = medium;
+            }
+        }
+        for (const Medium* medium : scene.media) {
+            if (medium->is_absorbing_only())
+                beta *= medium->transmittance(rng, ray, 0.001f, t_end);
+        }
+        if (is_black(beta) || (!scattering_medium && !surface_hit))
+            break;
+
+        Path_Vertex& prev = path[count - 1];
+        Path_Vertex& vertex = path[count];
+        Intersection& isect = vertex.isect;
+        if (scattering_medium) {
+            vertex.type = Vertex_Type::medium;
+            isect.t = t_end;
+            isect.p = ray.PointAtParameter(t_end);
+            isect.normal = -ray.direction.normalized();
+            isect.u = isect.v = 0.f;
+            isect.uv_density = 0.f;
+            isect.material = scattering_medium->get_phase_function();
+        } else {
+            vertex.type = Vertex_Type::surface;
+            evaluate_hit(ray, ray_hit, isect);
+        }
+        isect.footprint = 0.f;
+        vertex.ray_in = ray;
+        vertex.attenuation = Vector(0);
+        vertex.beta = beta;
+        vertex.pdf_fwd = convert_density(pdf, prev, vertex);
+        vertex.pdf_rev = 0.f;
+        vertex.delta = false;
+        count++;
+
+        // The last vertex still scatters, for the attenuation its connections need.
+        Scatter_Info scatter_info;
+        if (!isect.material->scatter(rng, ray, isect, scatter_info))
+            break;
+
+        Ray scattered;
+        float pdf_rev;
+        if (scatter_info.is_specular) {
+            vertex.delta = true;
+            scattered = scatter_info.specular_ray;
+            beta *= scatter_info.attenuation;
+            pdf = pdf_rev = 0.f;
+        } else {
+            vertex.attenuation = scatter_info.attenuation;
+            scattered = Ray(isect.p, scatter_info.pdf->generate(rng), ray.time);
+            float sample_pdf = scatter_info.pdf->value(scattered.direction);
+            delete scatter_info.pdf;
+
+            pdf = isect.material->scattering_pdf(ray, isect, scattered);
+            if (pdf == 0.f || sample_pdf == 0.f)
+                break;
+            pdf_rev = isect.material->scattering_pdf(Ray(isect.p - scattered.direction, scattered.direction, ray.time), isect, Ray(isect.p, -ray.direction, ray.time));
+            beta *= scatter_info.attenuation * (pdf / sample_pdf);
+        }
+        prev.pdf_rev = convert_density(pdf_rev, vertex, prev);
+
+        if (count >= Roulette_Vertex_Count) {
+            float survival = std::min(0.95f, std::max(scatter_info.attenuation.x, std::max(scatter_info.attenuation.y, scatter_info.attenuation.z)));
+            if (rng.random_float() >= survival)
+                break;
+            beta /= survival;
+        }
+        ray = scattered;
+    }
+    return count;
+}
+
+int generate_camera_subpath(RNG& rng, const Scene& scene, const Ray& ray, Path_Vertex* path) {
+    Path_Vertex& camera = path[0];
+    camera.type = Vertex_Type::camera;
+    camera.isect.p = ray.origin;
+    camera.isect.normal = scene.camera.get_forward_direction();
+    camera.ray_in = ray;
+    camera.attenuation = Vector(0);
+    // Camera samples are averaged per pixel, which makes the importance over its pdf one.
+    camera.beta = Vector(1);
+    camera.pdf_fwd = 1.f;
+    camera.pdf_rev = 0.f;
+    camera.delta = false;
+
+    float pdf = scene.camera.get_direction_pdf(ray.origin, ray.direction);
+    return random_walk(rng, scene, ray, Vector(1), pdf, path, Max_Camera_Vertex_Count);
+}
+
+int generate_light_subpath(RNG& rng, const Scene& scene, float time, Path_Vertex* path) {
+    Path_Vertex& light = path[0];
+    float pdf_pos;
+    if (!sample_light_point(rng, scene, time, light.isect, pdf_pos))
+        return 0;
+    light.type = Vertex_Type::light;
+    light.ray_in = Ray(light.isect.p, light.isect.normal, time);
+    light.attenuation = Vector(0);
+    light.beta = Vector(1.f / pdf_pos);
+    light.pdf_fwd = pdf_pos;
+    light.pdf_rev = 0.f;
+    light.delta = false;
+
+    Vector direction = Axes(light.isect.normal).from_local_to_world(random_cosine_direction(rng));
+    float pdf_dir = std::max(0.f, dot_product(light.isect.normal, direction)) / PI;
+    if (pdf_dir == 0.f)
+        return 1;
+    Vector beta = light.beta * evaluate_vertex(light, direction) / pdf_dir;
+    return random_walk(rng, scene, Ray(light.isect.p, direction, time), beta, pdf_dir, path, Max_Light_Vertex_Count);
+}
+
+// Squared density for the power heuristic. The densities next to a specular vertex are zero,
+// they cancel between the strategies that don't connect at the specular vertex and count as one.
+float remap_density(float pdf) {
+    return pdf != 0.f ? pdf * pdf : 1.f;
+}
+
+// Power heuristic weight of the strategy with s light and t camera vertices, sampled is the
+// light vertex of s = 1 or the camera vertex of t = 1.
+float get_mis_weight(const Scene& scene, const Path_Vertex* light_path, const Path_Vertex* camera_path,
+                     const Path_Vertex& sampled, int s, int t)
+{
+    if (s + t == 2)
+        return 1.f;
+
+    const Path_Vertex* qs = s > 0 ? &light_path[s - 1] : nullptr;
+    const Path_Vertex* pt = &camera_path[t - 1];
+    const Path_Vertex* qs_minus = s > 1 ? &light_path[s - 2] : nullptr;
+    const Path_Vertex* pt_minus = t > 1 ? &camera_path[t - 2] : nullptr;
+    if (s == 1)
+        qs = &sampled;
+    else if (t == 1)
+        pt = &sampled;
+
+    // Densities of the subpaths with the connection in place.
+    float camera_fwd[Max_Camera_Vertex_Count], camera_rev[Max_Camera_Vertex_Count];
+    bool camera_delta[Max_Camera_Vertex_Count];
+    for (int i = 0; i < t; i++) {
+        const Path_Vertex& v = (i == t - 1) ? *pt : camera_path[i];
+        camera_fwd[i] = v.pdf_fwd;
+        camera_rev[i] = v.pdf_rev;
+        camera_delta[i] = v.delta;
+    }
+    float light_fwd[Max_Light_Vertex_Count], light_rev[Max_Light_Vertex_Count];
+    bool light_delta[Max_Light_Vertex_Count];
+    for (int i = 0; i < s; i++) {
+        const Path_Vertex& v = (i == s - 1) ? *qs : light_path[i];
+        light_fwd[i] = v.pdf_fwd;
+        light_rev[i] = v.pdf_rev;
+        light_delta[i] = v.delta;
+    }
+
+    camera_delta[t - 1] = false;
+    if (s > 0) {
+        light_delta[s - 1] = false;
+        camera_rev[t - 1] = get_pdf(scene, *qs, qs_minus, *pt);
+        if (pt_minus)
+            camera_rev[t - 2] = get_pdf(scene, *pt, qs, *pt_minus);
+        light_rev[s - 1] = get_pdf(scene, *pt, pt_minus, *qs);
+        if (qs_minus)
+            light_rev[s - 2] = get_pdf(scene, *qs, pt, *qs_minus);
+    } else {
+        // Emitters that aren't in the lights of the scene are only found by this strategy.
+        camera_rev[t - 1] = get_light_point_pdf(scene, pt->isect, pt->ray_in.time);
+        if (camera_rev[t - 1] == 0.f)
+            return 1.f;
+        if (pt_minus)
+            camera_rev[t - 2] = get_emission_pdf(*pt, *pt_minus);
+    }
+
+    // Ratios of the densities of the other strategies to this one, walking the connection along
+    // the camera subpath and then along the light subpath.
+    float sum = 0.f;
+    float ratio = 1.f;
+    for (int i = t - 1; i > 0; i--) {
+        ratio *= remap_density(camera_rev[i]) / remap_density(camera_fwd[i]);
+        if (!camera_delta[i] && !camera_delta[i - 1])
+            sum += ratio;
+    }
+    ratio = 1.f;
+    for (int i = s - 1; i >= 0; i--) {
+        ratio *= remap_density(light_rev[i]) / remap_density(light_fwd[i]);
+        bool delta_before = i > 0 && light_delta[i - 1];
+        if (!light_delta[i] && !delta_before)
+            sum += ratio;
+    }
+    return 1.f / (1.f + sum);
+}
+
+// Contribution of the strategy with s light and t camera vertices. For t = 1 the light subpath
+// connects to a lens point and the image position is returned in (x, y).
+Vector connect(RNG& rng, const Scene& scene, const Path_Vertex* light_path, const Path_Vertex* camera_path,
+               int s, int t, int image_width, int image_height, float& x, float& y)
+{
+    Path_Vertex sampled;
+    Vector radiance(0);
+
+    if (s == 0) {
+        // The camera subpath found an emitter by itself.
+        const Path_Vertex& pt = camera_path[t - 1];
+        if (pt.type != Vertex_Type::surface)
+            return Vector(0);
+        radiance = pt.beta * pt.isect.material->emitted(pt.ray_in, pt.isect, pt.isect.u, pt.isect.v, pt.isect.p);
+    } else if (t == 1) {
+        const Path_Vertex& qs = light_path[s - 1];
+        if (qs.delta)
+            return Vector(0);
+
+        sampled.type = Vertex_Type::camera;
+        sampled.isect.p = scene.camera.sample_lens_point(rng);
+        sampled.isect.normal = scene.camera.get_forward_direction();
+        sampled.ray_in = Ray(sampled.isect.p, sampled.isect.normal, qs.ray_in.time);
+        sampled.pdf_fwd = 1.f;
+        sampled.pdf_rev = 0.f;
+        sampled.delta = false;
+
+        Vector d = qs.isect.p - sampled.isect.p;
+        float distance_sq = d.squared_length();
+        Vector w = d / std::sqrt(distance_sq);
+        float s_image, t_image;
+        if (!scene.camera.get_image_position(sampled.isect.p, w, s_image, t_image))
+            return Vector(0);
+        x = s_image * image_width;
+        y = t_image * image_height;
+
+        // The importance over the lens sampling pdf reduces to the direction pdf of the camera.
+        float importance = scene.camera.get_direction_pdf(sampled.isect.p, w) / distance_sq;
+        radiance = qs.beta * evaluate_vertex(qs, -w) * importance;
+        if (!is_black(radiance))
+            radiance *= get_transmittance(rng, scene, qs, sampled);
+    } else if (s == 1) {
+        const Path_Vertex& pt = camera_path[t - 1];
+        if (pt.delta)
+            return Vector(0);
+
+        float pdf_pos;
+        if (!sample_light_point(rng, scene, pt.ray_in.time, sampled.isect, pdf_pos))
+            return Vector(0);
+        sampled.type = Vertex_Type::light;
+        sampled.ray_in = Ray(sampled.isect.p, sampled.isect.normal, pt.ray_in.time);
+        sampled.attenuation = Vector(0);
+        sampled.beta = Vector(1.f / pdf_pos);
+        sampled.pdf_fwd = pdf_pos;
+        sampled.pdf_rev = 0.f;
+        sampled.delta = false;
+
+        Vector d = sampled.isect.p - pt.isect.p;
+        float distance_sq = d.squared_length();
+        Vector w = d / std::sqrt(distance_sq);
+        radiance = pt.beta * evaluate_vertex(pt, w) * evaluate_vertex(sampled, -w) * sampled.beta / distance_sq;
+        if (!is_black(radiance))
+            radiance *= get_transmittance(rng, scene, pt, sampled);
+    } else {
+        const Path_Vertex& qs = light_path[s - 1];
+        const Path_Vertex& pt = camera_path[t - 1];
+        if (qs.delta || pt.delta)
+            return Vector(0);
+
+        Vector d = qs.isect.p - pt.isect.p;
+        float distance_sq = d.squared_length();
+        Vector w = d / std::sqrt(distance_sq);
+        radiance = qs.beta * evaluate_vertex(qs, -w) * evaluate_vertex(pt, w) * pt.beta / distance_sq;
+        if (!is_black(radiance))
+            radiance *= get_transmittance(rng, scene, pt, qs);
+    }
+
+    if (is_black(radiance))
+        return Vector(0);
+    return radiance * get_mis_weight(scene, light_path, camera_path, sampled, s, t);
+}
+} // namespace
+
+void render_pixels_bidirectional(RNG& rng, const Scene& scene, int image_width, int image_height, int sample_count,
+                                 const Tile& tile, Film_Tile* film_tile, Film* film, std::vector<int64_t>* pixel_costs)
+{
+    Path_Vertex camera_path[Max_Camera_Vertex_Count];
+    Path_Vertex light_path[Max_Light_Vertex_Count];
+
+    for (int j = tile.y1; j < tile.y2; j++) {
+        for (int i = tile.x1; i < tile.x2; i++) {
+#if ENABLE_STATS
+            int64_t start_cost = thread_stats.cost();
+#endif
+
+            for (int sample = 0; sample < sample_count; sample++) {
+                float x = float(i) + rng.random_float();
+                float y = float(j) + rng.random_float();
+
+                Ray ray = scene.camera.get_ray(rng, x / float(image_width), y / float(image_height));
+                int camera_count = generate_camera_subpath(rng, scene, ray, camera_path);
+                int light_count = generate_light_subpath(rng, scene, ray.time, light_path);
+
+                // Connections to a light point (s = 1) sample their own, also when the light
+                // subpath failed to start.
+                int max_s = std::max(light_count, 1);
+                Vector color(0);
+                for (int t = 1; t <= camera_count; t++) {
+                    for (int s = 0; s <= max_s; s++) {
+                        int depth = s + t - 2;
+                        if ((s == 1 && t == 1) || depth < 0 || depth > Max_Depth)
+                            continue;
+
+                        float splat_x = 0.f, splat_y = 0.f;
+                        Vector radiance = connect(rng, scene, light_path, camera_path, s, t, image_width, image_height, splat_x, splat_y);
+                        if (t == 1) {
+                            if (film && !is_black(radiance))
+                                film->add_splat(splat_x, splat_y, radiance);
+                        } else {
+                            color += radiance;
+                        }
+                    }
+                }
+                if (film_tile)
+                    film_tile->add_sample(x, y, color);
+            }
+
+#if ENABLE_STATS
+            if (pixel_costs)
+                (*pixel_costs)[j * image_width + i] = thread_stats.cost() - start_cost;
+#endif
+        }
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "film.h"
+#include "scenes.h"
+#include "tile_scheduler.h"
+
+#include <cstdint>
+#include <vector>
+
+// Bidirectional path tracing. Every sample traces a subpath from the camera and one from the
+// lights and connects each pair of their vertices, the strategies are weighted with multiple
+// importance sampling (power heuristic, Veach 1997). Light subpath vertices connected to the
+// camera land anywhere in the image and are splatted into the film.
+//
+// Paths can't be connected through specular surfaces (metal and glass), those are only reached
+// by continuing a subpath. Media scatter like in the path tracer, their vertices are weighted
+// as if the free-flight distances were sampled uniformly.
+void render_pixels_bidirectional(RNG& rng, const Scene& scene, int image_width, int image_height, int sample_count,
+                                 const Tile& tile, Film_Tile* film_tile, Film* film, std::vector<int64_t>* pixel_costs);
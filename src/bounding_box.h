@@ -1,6 +1,8 @@
 #pragma once
 
 #include "ray.h"
+#include "simd_vector.h"
+#include "stats.h"
 
 #include <algorithm>
 #include <limits>
@@ -42,22 +44,29 @@ public:
     }
 
     bool intersect(const Ray& ray, float t_min, float t_max) const {
-        for (int i = 0; i < 3; i++) {
-            float inv_dir = 1.f / ray.direction[i];
-            float t0 = (min_point[i] - ray.origin[i]) * inv_dir;
-            float t1 = (max_point[i] - ray.origin[i]) * inv_dir;
-
-            if (inv_dir < 0.f)
-                std::swap(t0, t1);
-
-            t_min = t0 > t_min ? t0 : t_min;
-            t_max = t1 < t_max ? t1 : t_max;
-            if (t_min > t_max)
-                return false;
-        }
+        STATS_INCREMENT(box_tests);
+        SIMD_Vector inv_dir = SIMD_Vector(1.f) / SIMD_Vector(ray.direction);
+        return intersect_slabs(SIMD_Vector(min_point), SIMD_Vector(max_point), SIMD_Vector(ray.origin), inv_dir, t_min, t_max);
+    }
+
+    // Same as above, also returns the parametric interval of the ray inside the box.
+    bool intersect(const Ray& ray, float t_min, float t_max, float& t_enter, float& t_exit) const {
+        STATS_INCREMENT(box_tests);
+        SIMD_Vector inv_dir = SIMD_Vector(1.f) / SIMD_Vector(ray.direction);
+        if (!intersect_slabs(SIMD_Vector(min_point), SIMD_Vector(max_point), SIMD_Vector(ray.origin), inv_dir, t_min, t_max))
+            return false;
+        t_enter = t_min;
+        t_exit = t_max;
         return true;
     }
 
+    float surface_area() const {
+        Vector d = max_point - min_point;
+        if (d.x < 0.f || d.y < 0.f || d.z < 0.f)
+            return 0.f;
+        return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
     static Bounding_Box get_union(const Bounding_Box& bounds, const Bounding_Box& bounds2)
     {
         return Bounding_Box(
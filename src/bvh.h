@@ -9,7 +9,9 @@ class BVH_Node : public Shape {
 public:
     BVH_Node(){}
 
-    BVH_Node(RNG& rng, Shape** hitables, int n, float time0, float time1) {
+    BVH_Node(RNG& rng, Shape** hitables, int n, float time0, float time1)
+        : time0(time0), time1(time1)
+    {
         int axis = rng.random_uint32() % 3;
         std::sort(hitables, hitables + n, Compare_Along_Axis(axis));
 
@@ -29,14 +31,15 @@ public:
         );
     }
 
-    bool hit(const Ray& ray, float t_min, float t_max, Intersection& hit_record) const override {
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const override {
+        STATS_INCREMENT(bvh_nodes_visited);
         if (!box.intersect(ray, t_min, t_max))
             return false;
 
-        Intersection left_hit_record;
+        Ray_Hit left_hit_record;
         bool left_hit = left->hit(ray, t_min, t_max, left_hit_record);
 
-        Intersection right_hit_record;
+        Ray_Hit right_hit_record;
         bool right_hit = right->hit(ray, t_min, t_max, right_hit_record);
 
         if (!left_hit && !right_hit)
@@ -56,6 +59,41 @@ public:
         return box;
     }
 
+    void refit() override {
+        left->refit();
+        if (right != left)
+            right->refit();
+        box = Bounding_Box::get_union(
+            left->boudning_box(time0, time1),
+            right->boudning_box(time0, time1)
+        );
+    }
+
+    void get_features(Shape_Features& features) const override {
+        left->get_features(features);
+        if (right != left)
+            right->get_features(features);
+    }
+
+    void create_node_replica(int node) override {
+        left->create_node_replica(node);
+        if (right != left)
+            right->create_node_replica(node);
+    }
+
+    void set_parent_transform(const Shape_Transform* transform) override {
+        left->set_parent_transform(transform);
+        if (right != left)
+            right->set_parent_transform(transform);
+    }
+
+    float get_sah_cost() const override {
+        float cost = 2.f * box.surface_area() + left->get_sah_cost();
+        if (right != left)
+            cost += right->get_sah_cost();
+        return cost;
+    }
+
 private:
     struct Compare_Along_Axis {
         int axis;
@@ -69,4 +107,5 @@ private:
     Shape* left;
     Shape* right;
     Bounding_Box box;
+    float time0, time1;
 };
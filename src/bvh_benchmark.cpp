@@ -0,0 +1,107 @@
+#include "bvh_benchmark.h"
+#include "bvh.h"
+#include "compressed_bvh.h"
+#include "flat_bvh.h"
+#include "scene_resources.h"
+#include "sphere.h"
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+const int Ray_Count = 1000000;
+
+struct Benchmark_Result {
+    int64_t build_microseconds;
+    size_t memory_usage;
+    int64_t trace_microseconds;
+    int hit_count;
+    std::vector<float> hit_distances;
+};
+
+template <typename Build_Function>
+Benchmark_Result run_benchmark(const std::vector<Ray>& rays, Build_Function build) {
+    Benchmark_Result result;
+
+    // Only the hierarchy is recorded, the primitives are shared by all variants.
+    Scene_Resources resources;
+    Shape* bvh;
+    {
+        Scene_Resources::Recording_Scope scope(&resources);
+        Timestamp t;
+        bvh = build();
+        result.build_microseconds = elapsed_microseconds(t);
+    }
+    result.memory_usage = resources.get_memory_usage();
+
+    result.hit_count = 0;
+    result.hit_distances.resize(rays.size());
+    Timestamp t;
+    for (size_t i = 0; i < rays.size(); i++) {
+        Ray_Hit hit;
+        bool is_hit = bvh->hit(rays[i], 1e-3f, FLT_MAX, hit);
+        result.hit_count += is_hit;
+        result.hit_distances[i] = is_hit ? hit.t : -1.f;
+    }
+    result.trace_microseconds = elapsed_microseconds(t);
+    return result;
+}
+
+void print_result(const char* name, const Benchmark_Result& result, const Benchmark_Result& reference, int primitive_count) {
+    int mismatches = 0;
+    for (size_t i = 0; i < result.hit_distances.size(); i++)
+        mismatches += result.hit_distances[i] != reference.hit_distances[i];
+
+    printf("%-16s %10.1f %10.2f %10.1f %10.2f %10d %10d\n", name,
+           result.build_microseconds / 1000.0,
+           result.memory_usage / double(1 << 20),
+           result.memory_usage / double(primitive_count),
+           result.trace_microseconds > 0 ? double(Ray_Count) / result.trace_microseconds : 0.0,
+           result.hit_count, mismatches);
+}
+} // namespace
+
+void run_bvh_benchmark(int primitive_count) {
+    RNG rng;
+
+    // Small spheres in a cube, dense enough that most rays hit something.
+    Scene_Resources primitives;
+    std::vector<Shape*> shapes;
+    {
+        Scene_Resources::Recording_Scope scope(&primitives);
+        float radius = 0.5f * std::cbrt(1.f / float(primitive_count));
+        for (int i = 0; i < primitive_count; i++) {
+            Vector center(rng.random_float(), rng.random_float(), rng.random_float());
+            shapes.push_back(new Sphere(center, radius * (0.5f + rng.random_float()), nullptr));
+        }
+    }
+
+    std::vector<Ray> rays;
+    rays.reserve(Ray_Count);
+    for (int i = 0; i < Ray_Count; i++) {
+        Vector origin(rng.random_float(), rng.random_float(), rng.random_float());
+        rays.push_back(Ray(origin, random_unit_vector(rng)));
+    }
+
+    Benchmark_Result flat = run_benchmark(rays, [&]() {
+        return new Flat_BVH(shapes, 0.f, 1.f);
+    });
+    Benchmark_Result linear = run_benchmark(rays, [&]() {
+        return new Flat_BVH(shapes, 0.f, 1.f, std::string(), Flat_BVH_Builder::linear);
+    });
+    Benchmark_Result compressed = run_benchmark(rays, [&]() {
+        return new Compressed_BVH(shapes, 0.f, 1.f);
+    });
+    Benchmark_Result pointer = run_benchmark(rays, [&]() {
+        std::vector<Shape*> list = shapes;
+        return new BVH_Node(rng, list.data(), static_cast<int>(list.size()), 0.f, 1.f);
+    });
+
+    printf("%d spheres, %d rays\n", primitive_count, Ray_Count);
+    printf("%-16s %10s %10s %10s %10s %10s %10s\n", "", "build ms", "MB", "bytes/prim", "Mrays/s", "hits", "mismatches");
+    print_result("BVH_Node", pointer, flat, primitive_count);
+    print_result("Flat_BVH", flat, flat, primitive_count);
+    print_result("Flat_BVH linear", linear, flat, primitive_count);
+    print_result("Compressed_BVH", compressed, flat, primitive_count);
+}
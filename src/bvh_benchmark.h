@@ -0,0 +1,5 @@
+#pragma once
+
+// Builds the BVH variants over the same random spheres and compares build time, memory and
+// single-threaded traversal speed. Results are written to stdout.
+void run_bvh_benchmark(int primitive_count);
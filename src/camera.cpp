@@ -18,6 +18,7 @@ Camera::Camera(
     , origin(look_from)
     , time0(time0)
     , time1(time1)
+    , pixel_spread_angle(0.f)
 {
     forward_dir = (look_at - look_from).normalized();
     right_dir = cross_product(forward_dir, up_direction).normalized();
@@ -29,17 +30,47 @@ Camera::Camera(
     half_height_vector = tn * up_dir;
 }
 
-Ray Camera::get_ray(RNG& rng, float s, float t) const {
+void Camera::set_aspect(float aspect) {
+    half_width_vector = aspect * half_height_vector.length() * right_dir;
+}
+
+void Camera::set_image_height(int image_height) {
+    pixel_spread_angle = 2.f * half_height_vector.length() / float(image_height);
+}
+
+Vector Camera::sample_lens_point(RNG& rng) const {
+    if (lens_radius == 0.f)
+        return origin;
     Vector lens_point = lens_radius * random_point_in_unit_disk(rng);
-    Vector origin_offset = right_dir * lens_point.x + up_dir * lens_point.y;
+    return origin + right_dir * lens_point.x + up_dir * lens_point.y;
+}
+
+bool Camera::get_image_position(const Vector& lens_point, const Vector& direction, float& s, float& t) const {
+    float cosine = dot_product(direction, forward_dir);
+    if (cosine <= 0.f)
+        return false;
 
-    float u = 2.f * s - 1.f;
-    float v = 2.f * t - 1.f;
+    // Every lens point sees a point of the focus plane at the same image position.
+    Vector focus_point = lens_point + direction * (focus_distance / cosine);
+    Vector sample_vector = (focus_point - origin) / focus_distance;
+    float u = dot_product(sample_vector, half_width_vector) / half_width_vector.squared_length();
+    float v = dot_product(sample_vector, half_height_vector) / half_height_vector.squared_length();
+    if (u < -1.f || u >= 1.f || v < -1.f || v >= 1.f)
+        return false;
 
-    Vector sample_vector = forward_dir + u * half_width_vector + v * half_height_vector;
-    sample_vector *= focus_distance;
+    s = 0.5f * (u + 1.f);
+    t = 0.5f * (v + 1.f);
+    return true;
+}
 
-    float time = time0 + rng.random_float() * (time1 - time0);
+float Camera::get_direction_pdf(const Vector& lens_point, const Vector& direction) const {
+    float s, t;
+    Vector d = direction.normalized();
+    if (!get_image_position(lens_point, d, s, t))
+        return 0.f;
 
-    return Ray(origin + origin_offset, (sample_vector - origin_offset).normalized(), time);
+    // Uniform over the image rectangle at unit distance, converted to solid angle.
+    float cosine = dot_product(d, forward_dir);
+    float image_area = 4.f * half_width_vector.length() * half_height_vector.length();
+    return 1.f / (image_area * cosine * cosine * cosine);
 }
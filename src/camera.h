@@ -1,9 +1,9 @@
 #pragma once
 
+#include "common.h"
+#include "random.h"
 #include "ray.h"
 
-class RNG;
-
 class Camera {
 public:
     Camera(
@@ -18,8 +18,33 @@ public:
         float time1
     );
 
+    // Changes the horizontal field of view to match the aspect ratio of the image.
+    void set_aspect(float aspect);
+
+    // Sets the spread angle of the primary ray cones so that they cover one pixel.
+    void set_image_height(int image_height);
+
+    bool has_depth_of_field() const { return lens_radius > 0.f; }
+    bool has_shutter_interval() const { return time1 > time0; }
+    // Random time in the shutter interval, for rays that do not start at the camera.
+    float sample_time(RNG& rng) const { return time0 + rng.random_float() * (time1 - time0); }
+
+    Ray get_ray(RNG& rng, float s, float t) const {
+        return get_ray<true, true>(rng, s, t);
+    }
+
+    // Lens and time sampling are compiled out when the render does not need them.
+    template <bool Depth_Of_Field, bool Motion_Blur>
     Ray get_ray(RNG& rng, float s, float t) const;
 
+    // The camera as seen from the scene, for light paths that connect to it.
+    Vector sample_lens_point(RNG& rng) const;
+    // Image position of the ray from a lens point in the given direction, false outside the image.
+    bool get_image_position(const Vector& lens_point, const Vector& direction, float& s, float& t) const;
+    // Density over solid angle of the direction of the rays get_ray() generates from a lens point.
+    float get_direction_pdf(const Vector& lens_point, const Vector& direction) const;
+    Vector get_forward_direction() const { return forward_dir; }
+
 private:
     float lens_radius;
     float focus_distance;
@@ -34,4 +59,27 @@ private:
 
     Vector half_width_vector;
     Vector half_height_vector;
+
+    float pixel_spread_angle;
 };
+
+template <bool Depth_Of_Field, bool Motion_Blur>
+Ray Camera::get_ray(RNG& rng, float s, float t) const {
+    Vector origin_offset(0);
+    if (Depth_Of_Field) {
+        Vector lens_point = lens_radius * random_point_in_unit_disk(rng);
+        origin_offset = right_dir * lens_point.x + up_dir * lens_point.y;
+    }
+
+    float u = 2.f * s - 1.f;
+    float v = 2.f * t - 1.f;
+
+    Vector sample_vector = forward_dir + u * half_width_vector + v * half_height_vector;
+    sample_vector *= focus_distance;
+
+    float time = Motion_Blur ? time0 + rng.random_float() * (time1 - time0) : time0;
+
+    Ray ray(origin + origin_offset, (sample_vector - origin_offset).normalized(), time);
+    ray.set_cone(0.f, pixel_spread_angle);
+    return ray;
+}
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "fast_math.h"
 #include "random.h"
 #include "vector.h"
 
@@ -8,44 +9,52 @@ int64_t elapsed_milliseconds(Timestamp timestamp) {
     return static_cast<int64_t>(milliseconds);
 }
 
+int64_t elapsed_microseconds(Timestamp timestamp) {
+    auto duration = std::chrono::steady_clock::now() - timestamp.t;
+    auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    return static_cast<int64_t>(microseconds);
+}
+
+// Concentric mapping of the square to the disk (Shirley and Chiu), no rejection loop.
 Vector random_point_in_unit_disk(RNG& rng) {
-    Vector p;
-    do {
-        p = 2.0f * Vector(rng.random_float(), rng.random_float(), 0.0f) - Vector(1, 1, 0);
-    } while (dot_product(p, p) >= 1.0f);
-    return p;
+    float a = 2.f * rng.random_float() - 1.f;
+    float b = 2.f * rng.random_float() - 1.f;
+
+    bool a_is_larger = std::abs(a) > std::abs(b);
+    float r = a_is_larger ? a : b;
+    float safe_r = (r == 0.f) ? 1.f : r;
+    float phi = a_is_larger ? (PI / 4) * (b / safe_r) : (PI / 2) - (PI / 4) * (a / safe_r);
+
+    float sin_phi, cos_phi;
+    fast_sincos(phi, sin_phi, cos_phi);
+    return Vector(r * cos_phi, r * sin_phi, 0.f);
 }
 
 Vector random_point_in_unit_sphere(RNG& rng) {
-    Vector p;
-    do {
-        p = 2.0f * Vector(rng.random_float(), rng.random_float(), rng.random_float()) - Vector(1, 1, 1);
-    } while (dot_product(p, p) >= 1.0f);
-    return p;
+    return std::cbrt(rng.random_float()) * random_unit_vector(rng);
 }
 
-Vector random_cosine_direction(RNG& rng) {
-    float r1 = rng.random_float();
-    float r2 = rng.random_float();
-
-    float phi = 2 * PI * r1;
-    float cos_theta = std::sqrt(1 - r2);
-    float sin_theta = std::sqrt(r2);
+Vector random_unit_vector(RNG& rng) {
+    float z = 1.f - 2.f * rng.random_float();
+    float r = std::sqrt(std::max(0.f, 1.f - z * z));
 
-    float x = sin_theta * std::cos(phi);
-    float y = sin_theta * std::sin(phi);
-    float z = cos_theta;
+    float sin_phi, cos_phi;
+    fast_sincos(2 * PI * rng.random_float(), sin_phi, cos_phi);
+    return Vector(r * cos_phi, r * sin_phi, z);
+}
 
-    return Vector(x, y, z);
+// Malley's method: a uniform disk sample projected up to the hemisphere.
+Vector random_cosine_direction(RNG& rng) {
+    Vector p = random_point_in_unit_disk(rng);
+    float z = std::sqrt(std::max(0.f, 1.f - p.x * p.x - p.y * p.y));
+    return Vector(p.x, p.y, z);
 }
 
+// Branchless orthonormal basis (Duff et al., "Building an Orthonormal Basis, Revisited").
 void get_tangent_vectors_for_direction(const Vector& direction, Vector& tangent1, Vector& tangent2) {
-    Vector a;
-    if (std::abs(direction.x) > 0.9f)
-        a = Vector(0, 1, 0);
-    else
-        a = Vector(1, 0, 0);
-
-    tangent1 = cross_product(direction, a).normalized();
-    tangent2 = cross_product(direction, tangent1);
+    float sign = std::copysign(1.f, direction.z);
+    float a = -1.f / (sign + direction.z);
+    float b = direction.x * direction.y * a;
+    tangent1 = Vector(1.f + sign * direction.x * direction.x * a, sign * b, -sign * direction.x);
+    tangent2 = Vector(b, sign + direction.y * direction.y * a, -direction.y);
 }
@@ -22,9 +22,11 @@ struct Timestamp {
 };
 
 int64_t elapsed_milliseconds(Timestamp timestamp);
+int64_t elapsed_microseconds(Timestamp timestamp);
 
 Vector random_point_in_unit_disk(RNG& rng);
 Vector random_point_in_unit_sphere(RNG& rng);
+Vector random_unit_vector(RNG& rng);
 Vector random_cosine_direction(RNG& rng);
 
 void get_tangent_vectors_for_direction(const Vector& direction, Vector& tangent1, Vector& tangent2);
@@ -0,0 +1,317 @@
+#include "compressed_bvh.h"
+#include "stats.h"
+#include "thread.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include <limits>
+
+namespace {
+const int Max_Stack_Size = 128;
+const int Max_Exponent = 127; // largest exponent of a normal float
+
+// Copies the nodes into new storage aligned to cache lines.
+const Compressed_BVH_Node* store_nodes(const Compressed_BVH_Node* nodes, size_t node_count, std::unique_ptr<char[]>& storage) {
+    size_t storage_size = (node_count + 1) * sizeof(Compressed_BVH_Node);
+    storage.reset(new char[storage_size]);
+    void* aligned = storage.get();
+    std::align(64, node_count * sizeof(Compressed_BVH_Node), aligned, storage_size);
+    if (node_count > 0)
+        memcpy(aligned, nodes, node_count * sizeof(Compressed_BVH_Node));
+    return static_cast<const Compressed_BVH_Node*>(aligned);
+}
+
+struct Build_Primitive {
+    Bounding_Box bounds;
+    Vector centroid;
+    uint32_t index;
+};
+
+// Partitions the primitives along the axis with the largest centroid extent so that the first
+// `count` ones are on the lower side.
+void split(Build_Primitive* primitives, int n, int count) {
+    if (count <= 0 || count >= n)
+        return;
+
+    Bounding_Box centroid_bounds;
+    for (int i = 0; i < n; i++)
+        centroid_bounds.extend(primitives[i].centroid);
+
+    Vector extent = centroid_bounds.max_point - centroid_bounds.min_point;
+    int axis = (extent.x > extent.y) ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    std::nth_element(primitives, primitives + count, primitives + n,
+        [axis](const Build_Primitive& a, const Build_Primitive& b) {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+}
+
+float exponent_to_scale(int exponent) {
+    uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+// Same expression as in traversal. q * scale is exact, so the result does not depend on FMA contraction.
+float dequantize(float origin, int q, float scale) {
+    return origin + float(q) * scale;
+}
+
+// Quantizes the child boxes against the node box, returns false if the scale is too small.
+bool quantize_axis(Compressed_BVH_Node& node, int axis, const Bounding_Box* child_bounds, int child_count) {
+    float origin = node.origin[axis];
+    float scale = exponent_to_scale(node.exponent[axis]);
+
+    for (int i = 0; i < child_count; i++) {
+        float child_min = child_bounds[i].min_point[axis];
+        float child_max = child_bounds[i].max_point[axis];
+
+        int lo = std::max(0, static_cast<int>(std::floor((child_min - origin) / scale)));
+        while (lo > 0 && dequantize(origin, lo, scale) > child_min)
+            lo--;
+
+        int hi = std::max(lo, static_cast<int>(std::ceil((child_max - origin) / scale)));
+        while (hi <= 255 && dequantize(origin, hi, scale) < child_max)
+            hi++;
+
+        if (hi > 255 || dequantize(origin, lo, scale) > child_min)
+            return false;
+        node.lo[axis][i] = static_cast<uint8_t>(lo);
+        node.hi[axis][i] = static_cast<uint8_t>(hi);
+    }
+    return true;
+}
+
+void encode_node(Compressed_BVH_Node& node, const Bounding_Box& bounds, const Bounding_Box* child_bounds,
+                 const uint32_t* children, int child_count)
+{
+    node.child_count = static_cast<uint8_t>(child_count);
+    for (int i = 0; i < 4; i++) {
+        node.children[i] = i < child_count ? children[i] : Compressed_BVH_Node::Invalid_Child;
+        for (int axis = 0; axis < 3; axis++) {
+            node.lo[axis][i] = 0;
+            node.hi[axis][i] = 0;
+        }
+    }
+    node.padding[0] = node.padding[1] = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        node.origin[axis] = bounds.min_point[axis];
+
+        // Smallest power of two that covers the extent in 255 steps, raised if rounding gets in the way.
+        float extent = bounds.max_point[axis] - bounds.min_point[axis];
+        bool quantized = false;
+        if (std::isfinite(bounds.min_point[axis]) && std::isfinite(bounds.max_point[axis]) && std::isfinite(extent)) {
+            int exponent = -126;
+            if (extent > 0.f)
+                exponent = std::max(exponent, static_cast<int>(std::ceil(std::log2(extent / 255.f))));
+
+            for (; exponent <= Max_Exponent && !quantized; exponent++) {
+                node.exponent[axis] = static_cast<int8_t>(exponent);
+                quantized = quantize_axis(node, axis, child_bounds, child_count);
+            }
+        }
+
+        // Bounds that are not finite or too large to quantize get a NaN origin. The child bounds then
+        // decode to NaN, which the slab test ignores, so every child spans the whole axis.
+        if (!quantized) {
+            node.origin[axis] = std::numeric_limits<float>::quiet_NaN();
+            node.exponent[axis] = 0;
+            for (int i = 0; i < 4; i++)
+                node.lo[axis][i] = node.hi[axis][i] = 0;
+        }
+    }
+}
+
+uint32_t make_leaf(const Build_Primitive* primitives, int n, const Build_Primitive* first_primitive) {
+    uint32_t first = static_cast<uint32_t>(primitives - first_primitive);
+    return Compressed_BVH_Node::Leaf_Flag | (uint32_t(n - 1) << Compressed_BVH_Node::Leaf_Count_Shift) | first;
+}
+
+// Builds the node for primitives [0, n) and returns its index. first_primitive is the start of
+// the whole primitive array, leaves store offsets from it.
+uint32_t build_node(std::vector<Compressed_BVH_Node>& nodes, Build_Primitive* primitives, int n,
+                    const Build_Primitive* first_primitive)
+{
+    uint32_t node_index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(Compressed_BVH_Node());
+
+    // Up to four groups from two levels of spatial splits. Groups are filled up to the capacity
+    // of a complete subtree so that nodes and leaves stay full.
+    int capacity = Compressed_BVH_Node::Max_Leaf_Size;
+    while (capacity * 4 < n)
+        capacity *= 4;
+
+    int lower = std::min(n, 2 * capacity);
+    split(primitives, n, lower);
+    split(primitives, lower, capacity);
+    split(primitives + lower, n - lower, capacity);
+
+    int group_ends[4] = {std::min(lower, capacity), lower, std::min(n, lower + capacity), n};
+    int group_start[5] = {0};
+    int group_count = 0;
+    for (int end : group_ends) {
+        if (end > group_start[group_count])
+            group_start[++group_count] = end;
+    }
+
+    Bounding_Box bounds;
+    Bounding_Box child_bounds[4];
+    uint32_t children[4];
+    for (int i = 0; i < group_count; i++) {
+        Build_Primitive* group = primitives + group_start[i];
+        int group_size = group_start[i + 1] - group_start[i];
+
+        for (int j = 0; j < group_size; j++)
+            child_bounds[i] = Bounding_Box::get_union(child_bounds[i], group[j].bounds);
+        bounds = Bounding_Box::get_union(bounds, child_bounds[i]);
+
+        if (group_size <= Compressed_BVH_Node::Max_Leaf_Size)
+            children[i] = make_leaf(group, group_size, first_primitive);
+        else
+            children[i] = build_node(nodes, group, group_size, first_primitive);
+    }
+
+    // The vector may have been reallocated by the recursion.
+    encode_node(nodes[node_index], bounds, child_bounds, children, group_count);
+    return node_index;
+}
+
+__m128 load_quantized(const uint8_t* q) {
+    int32_t packed;
+    memcpy(&packed, q, sizeof(packed));
+    __m128i zero = _mm_setzero_si128();
+    __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+} // namespace
+
+Compressed_BVH::Compressed_BVH(std::vector<Shape*> shapes, float time0, float time1)
+    : shapes(std::move(shapes))
+    , nodes(nullptr)
+    , node_count(0)
+{
+    std::vector<Build_Primitive> primitives(this->shapes.size());
+    for (size_t i = 0; i < primitives.size(); i++) {
+        primitives[i].bounds = this->shapes[i]->boudning_box(time0, time1);
+        primitives[i].centroid = 0.5f * (primitives[i].bounds.min_point + primitives[i].bounds.max_point);
+        primitives[i].index = static_cast<uint32_t>(i);
+        box = Bounding_Box::get_union(box, primitives[i].bounds);
+    }
+
+    std::vector<Compressed_BVH_Node> build_nodes;
+    if (!primitives.empty()) {
+        assert(primitives.size() <= Compressed_BVH_Node::Leaf_Index_Mask + 1);
+        build_nodes.reserve(primitives.size() / 8 + 1);
+        build_node(build_nodes, primitives.data(), static_cast<int>(primitives.size()), primitives.data());
+    }
+
+    // Leaves reference consecutive primitives in build order.
+    std::vector<Shape*> ordered_shapes(primitives.size());
+    for (size_t i = 0; i < primitives.size(); i++)
+        ordered_shapes[i] = this->shapes[primitives[i].index];
+    this->shapes.swap(ordered_shapes);
+
+    node_count = build_nodes.size();
+    nodes = store_nodes(build_nodes.data(), node_count, node_storage);
+    add_memory_usage((node_count + 1) * sizeof(Compressed_BVH_Node));
+}
+
+void Compressed_BVH::create_node_replica(int node) {
+    for (Shape* shape : shapes)
+        shape->create_node_replica(node);
+
+    if (node_replicas.size() <= size_t(node))
+        node_replicas.resize(node + 1);
+    Node_Replica& replica = node_replicas[node];
+    replica.nodes = store_nodes(nodes, node_count, replica.node_storage);
+    replica.shapes = shapes;
+}
+
+bool Compressed_BVH::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const {
+    if (node_count == 0)
+        return false;
+
+    const Compressed_BVH_Node* hit_nodes = nodes;
+    Shape* const* hit_shapes = shapes.data();
+    size_t node_index = Thread::get_current_node();
+    if (node_index < node_replicas.size() && node_replicas[node_index].nodes) {
+        hit_nodes = node_replicas[node_index].nodes;
+        hit_shapes = node_replicas[node_index].shapes.data();
+    }
+
+    __m128 origin[3], inv_dir[3];
+    for (int axis = 0; axis < 3; axis++) {
+        origin[axis] = _mm_set1_ps(ray.origin[axis]);
+        inv_dir[axis] = _mm_set1_ps(1.f / ray.direction[axis]);
+    }
+
+    // Entries are visited nearest first and skipped once a closer hit is found.
+    struct Stack_Entry {
+        uint32_t child;
+        float t_enter;
+    };
+    Stack_Entry stack[Max_Stack_Size];
+    int stack_size = 0;
+    stack[stack_size++] = {0, t_min};
+    bool hit_anything = false;
+
+    while (stack_size > 0) {
+        Stack_Entry entry = stack[--stack_size];
+        if (entry.t_enter > t_max)
+            continue;
+
+        if (entry.child & Compressed_BVH_Node::Leaf_Flag) {
+            uint32_t first = entry.child & Compressed_BVH_Node::Leaf_Index_Mask;
+            uint32_t count = ((entry.child & ~Compressed_BVH_Node::Leaf_Flag) >> Compressed_BVH_Node::Leaf_Count_Shift) + 1;
+            for (uint32_t i = first; i < first + count; i++) {
+                Ray_Hit primitive_hit;
+                if (hit_shapes[i]->hit(ray, t_min, t_max, primitive_hit)) {
+                    hit_anything = true;
+                    t_max = primitive_hit.t;
+                    hit_record = primitive_hit;
+                }
+            }
+            continue;
+        }
+
+        STATS_INCREMENT(bvh_nodes_visited);
+        const Compressed_BVH_Node& node = hit_nodes[entry.child];
+
+        // Slab test of the four child boxes at once, NaNs from rays lying in a slab plane are ignored.
+        __m128 t_near = _mm_set1_ps(t_min);
+        __m128 t_far = _mm_set1_ps(t_max);
+        for (int axis = 0; axis < 3; axis++) {
+            __m128 node_origin = _mm_set1_ps(node.origin[axis]);
+            __m128 scale = _mm_set1_ps(exponent_to_scale(node.exponent[axis]));
+            __m128 lo = _mm_add_ps(node_origin, _mm_mul_ps(load_quantized(node.lo[axis]), scale));
+            __m128 hi = _mm_add_ps(node_origin, _mm_mul_ps(load_quantized(node.hi[axis]), scale));
+
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, origin[axis]), inv_dir[axis]);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, origin[axis]), inv_dir[axis]);
+            t_near = _mm_max_ps(_mm_min_ps(t0, t1), t_near);
+            t_far = _mm_min_ps(_mm_max_ps(t0, t1), t_far);
+        }
+        int hit_mask = _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+
+        alignas(16) float t_enter[4];
+        _mm_store_ps(t_enter, t_near);
+
+        // Push the hit children farthest first so that the nearest one is popped next.
+        int first = stack_size;
+        for (int i = 0; i < node.child_count; i++) {
+            if (!(hit_mask & (1 << i)))
+                continue;
+            int j = stack_size++;
+            while (j > first && stack[j - 1].t_enter < t_enter[i]) {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = {node.children[i], t_enter[i]};
+        }
+    }
+    return hit_anything;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "shape.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Scenes use Compressed_BVH instead of Flat_BVH for their large static hierarchies when
+// USE_COMPRESSED_BVH is defined to 1 (e.g. in the project's PreprocessorDefinitions).
+#ifndef USE_COMPRESSED_BVH
+#define USE_COMPRESSED_BVH 0
+#endif
+
+// Four-wide BVH node that fits in one cache line. Child boxes are stored as 8-bit offsets from
+// the node origin in units of a power of two per axis, rounded outward so that the decoded box
+// always contains the child. Children are node indices, or leaves when Leaf_Flag is set: a run of
+// up to Max_Leaf_Size consecutive primitives, the count in the bits above the first index.
+// Unused slots are Invalid_Child.
+struct Compressed_BVH_Node {
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t child_count;
+    uint8_t lo[3][4];
+    uint8_t hi[3][4];
+    uint32_t children[4];
+    uint32_t padding[2];
+
+    static const uint32_t Leaf_Flag = 0x80000000u;
+    static const uint32_t Invalid_Child = 0xffffffffu;
+    static const int Leaf_Count_Shift = 28;
+    static const uint32_t Leaf_Index_Mask = (1u << Leaf_Count_Shift) - 1;
+    static const int Max_Leaf_Size = 4;
+};
+
+static_assert(sizeof(Compressed_BVH_Node) == 64, "compressed BVH nodes should fill one cache line");
+
+// Static BVH with quantized four-wide nodes and small leaves, a fraction of the memory of Flat_BVH.
+// Intended for scenes with millions of primitives where hierarchy size and bandwidth dominate.
+// Supports up to 2^28 primitives.
+class Compressed_BVH : public Shape {
+public:
+    Compressed_BVH(std::vector<Shape*> shapes, float time0, float time1);
+
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const override;
+    Bounding_Box boudning_box(float t0, float t1) const override { return box; }
+
+    void get_features(Shape_Features& features) const override {
+        for (const Shape* shape : shapes)
+            shape->get_features(features);
+    }
+
+    void create_node_replica(int node) override;
+
+    void set_parent_transform(const Shape_Transform* transform) override {
+        for (Shape* shape : shapes)
+            shape->set_parent_transform(transform);
+    }
+
+    size_t get_node_count() const { return node_count; }
+
+private:
+    // In build order, leaves reference ranges of this array.
+    std::vector<Shape*> shapes;
+
+    // Nodes are aligned to cache lines inside node_storage.
+    const Compressed_BVH_Node* nodes;
+    size_t node_count;
+    std::unique_ptr<char[]> node_storage;
+
+    // Copies for the NUMA nodes by node index, with null nodes for nodes without a copy.
+    struct Node_Replica {
+        std::unique_ptr<char[]> node_storage;
+        const Compressed_BVH_Node* nodes = nullptr;
+        std::vector<Shape*> shapes;
+    };
+    std::vector<Node_Replica> node_replicas;
+
+    Bounding_Box box;
+};
@@ -0,0 +1,342 @@
+#include "convergence_benchmark.h"
+#include "film.h"
+#include "path_guiding.h"
+#include "render.h"
+#include "scenes.h"
+#include "tile_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+const char* const Scene_Names[] = {"cornell_box", "two_spheres", "simple_light"};
+
+const struct {
+    const char* name;
+    Integrator integrator;
+    bool path_guiding;
+} Integrators[] = {
+    {"path", Integrator::path, false},
+    {"path_guided", Integrator::path, true},
+    {"bidirectional", Integrator::bidirectional, false},
+};
+
+const int Tile_Size = 32;
+const int Reference_Pass_Sample_Count = 64;
+// Added to the squared reference value in the relative MSE, so that dark pixels don't dominate it.
+const double Rel_MSE_Epsilon = 1e-2;
+// The error at fixed times is reported at these fractions of the time budget.
+const float Checkpoint_Fractions[] = {0.125f, 0.25f, 0.5f, 1.f};
+
+struct Error_Sample {
+    int sample_count;
+    double seconds;
+    double rmse;
+    double rel_mse;
+};
+
+struct Convergence_Result {
+    const char* scene_name;
+    const char* integrator_name;
+    std::vector<Error_Sample> curve;
+};
+
+// Adds sample_count samples per pixel to the film, returns the time it took.
+int64_t render_pass(const Scene& scene, Film& film, const std::vector<Tile>& tiles, int sample_count,
+                    Integrator integrator)
+{
+    Timestamp t;
+    unsigned features = get_render_features(scene);
+    std::vector<Render_Rect_Task> tasks;
+    for (const Tile& tile : tiles) {
+        tasks.push_back(Render_Rect_Task(&scene, film.get_width(), film.get_height(), sample_count,
+                                         tile.x1, tile.y1, tile.x2, tile.y2, &film, nullptr, features));
+        tasks.back().set_integrator(integrator);
+    }
+    run_tasks(tasks);
+    return elapsed_microseconds(t);
+}
+
+std::string get_reference_file_name(const char* scene_name, const Convergence_Benchmark_Settings& settings) {
+    char file_name[256];
+    snprintf(file_name, sizeof(file_name), "reference_%s_%dx%d_%d.pfm", scene_name,
+             settings.image_width, settings.image_height, settings.reference_sample_count);
+    return file_name;
+}
+
+// Portable float map, RGB rows from the bottom to the top like the film.
+bool read_reference(const std::string& file_name, int width, int height, std::vector<Vector>& pixels) {
+    std::ifstream in(file_name, std::ios::binary);
+    std::string magic;
+    int file_width, file_height;
+    float scale;
+    if (!(in >> magic >> file_width >> file_height >> scale) || magic != "PF" ||
+        file_width != width || file_height != height || scale >= 0.f)
+    {
+        return false;
+    }
+    in.get();
+
+    std::vector<float> data(3 * size_t(width) * height);
+    if (!in.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float)))
+        return false;
+
+    pixels.resize(size_t(width) * height);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = Vector(data[3 * i + 0], data[3 * i + 1], data[3 * i + 2]);
+    return true;
+}
+
+bool write_reference(const std::string& file_name, int width, int height, const std::vector<Vector>& pixels) {
+    std::vector<float> data(3 * pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++) {
+        for (int c = 0; c < 3; c++)
+            data[3 * i + c] = pixels[i][c];
+    }
+
+    // Negative scale means little-endian.
+    std::ofstream out(file_name, std::ios::binary);
+    out << "PF\n" << width << " " << height << "\n-1.0\n";
+    out.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(float));
+    return bool(out);
+}
+
+std::vector<Vector> get_film_pixels(const Film& film) {
+    std::vector<Vector> pixels(size_t(film.get_width()) * film.get_height());
+    for (int j = 0; j < film.get_height(); j++) {
+        for (int i = 0; i < film.get_width(); i++)
+            pixels[size_t(j) * film.get_width() + i] = film.get_pixel(i, j);
+    }
+    return pixels;
+}
+
+std::vector<Vector> get_reference(const Scene& scene, const char* scene_name, const Convergence_Benchmark_Settings& settings,
+                                  int thread_count)
+{
+    int nx = settings.image_width;
+    int ny = settings.image_height;
+    std::string file_name = get_reference_file_name(scene_name, settings);
+
+    std::vector<Vector> pixels;
+    if (read_reference(file_name, nx, ny, pixels))
+        return pixels;
+
+    Timestamp t;
+    Film film(nx, ny, create_filter(Filter_Type::box));
+    std::vector<Tile> tiles = schedule_tiles(Cost_Map(nx, ny), nx, ny, Tile_Size, thread_count);
+    for (int done = 0; done < settings.reference_sample_count; ) {
+        int pass_sample_count = std::min(Reference_Pass_Sample_Count, settings.reference_sample_count - done);
+        render_pass(scene, film, tiles, pass_sample_count, Integrator::path);
+        done += pass_sample_count;
+        fprintf(stderr, "\rReference %s: %d/%d spp", scene_name, done, settings.reference_sample_count);
+    }
+    fprintf(stderr, ", %.2fs\n", elapsed_milliseconds(t) / 1000.0f);
+
+    pixels = get_film_pixels(film);
+    if (!write_reference(file_name, nx, ny, pixels))
+        fprintf(stderr, "failed to write %s\n", file_name.c_str());
+    return pixels;
+}
+
+// Non-finite values (in the reference or the image) are left out, they would hide every other difference.
+void measure_error(const std::vector<Vector>& pixels, const std::vector<Vector>& reference, double& rmse, double& rel_mse) {
+    double squared_error_sum = 0.0;
+    double relative_error_sum = 0.0;
+    size_t count = 0;
+    for (size_t i = 0; i < pixels.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            double value = pixels[i][c];
+            double reference_value = reference[i][c];
+            if (!std::isfinite(value) || !std::isfinite(reference_value))
+                continue;
+            double squared_error = (value - reference_value) * (value - reference_value);
+            squared_error_sum += squared_error;
+            relative_error_sum += squared_error / (reference_value * reference_value + Rel_MSE_Epsilon);
+            count++;
+        }
+    }
+    rmse = count ? std::sqrt(squared_error_sum / count) : 0.0;
+    rel_mse = count ? relative_error_sum / count : 0.0;
+}
+
+// Doubles the sample count with every pass, but shortens the last pass to end close to the budget.
+// Path guiding learns from all the passes before, the time to update the field counts.
+std::vector<Error_Sample> measure_convergence(const Scene& shared_scene, Integrator integrator, bool path_guiding,
+                                              const std::vector<Vector>& reference, const Convergence_Benchmark_Settings& settings,
+                                              int thread_count)
+{
+    Scene scene = shared_scene;
+    Guiding_Field guiding_field(32.f, 256);
+    if (path_guiding)
+        scene.guiding_field = &guiding_field;
+
+    int nx = settings.image_width;
+    int ny = settings.image_height;
+    int64_t budget = int64_t(settings.time_budget_seconds * 1e6f);
+
+    Film film(nx, ny, create_filter(Filter_Type::box));
+    std::vector<Tile> tiles = schedule_tiles(Cost_Map(nx, ny), nx, ny, Tile_Size, thread_count);
+
+    std::vector<Error_Sample> curve;
+    int64_t elapsed = 0;
+    int sample_count = 0;
+    // No more samples than the reference has, its own noise would dominate the error.
+    while (elapsed < budget && sample_count < settings.reference_sample_count) {
+        int pass_sample_count = std::max(sample_count, 1);
+        if (sample_count > 0) {
+            double sample_time = double(elapsed) / sample_count;
+            pass_sample_count = std::min(pass_sample_count, int((budget - elapsed) / sample_time));
+            if (pass_sample_count == 0)
+                break;
+        }
+        pass_sample_count = std::min(pass_sample_count, settings.reference_sample_count - sample_count);
+
+        elapsed += render_pass(scene, film, tiles, pass_sample_count, integrator);
+        if (path_guiding) {
+            Timestamp t;
+            guiding_field.update();
+            elapsed += elapsed_microseconds(t);
+        }
+        sample_count += pass_sample_count;
+        film.set_splat_scale(1.f / float(sample_count));
+
+        Error_Sample error;
+        error.sample_count = sample_count;
+        error.seconds = elapsed / 1e6;
+        measure_error(get_film_pixels(film), reference, error.rmse, error.rel_mse);
+        curve.push_back(error);
+    }
+    return curve;
+}
+
+// Interpolated on the log-log curve between the passes before and after the target, negative if
+// the target wasn't reached.
+double get_time_to_target(const std::vector<Error_Sample>& curve, double target) {
+    for (size_t i = 0; i < curve.size(); i++) {
+        if (curve[i].rel_mse > target)
+            continue;
+        if (i == 0 || curve[i].rel_mse <= 0.0)
+            return curve[i].seconds;
+
+        const Error_Sample& a = curve[i - 1];
+        const Error_Sample& b = curve[i];
+        double s = std::log(a.rel_mse / target) / std::log(a.rel_mse / b.rel_mse);
+        return std::exp(std::log(a.seconds) + s * (std::log(b.seconds) - std::log(a.seconds)));
+    }
+    return -1.0;
+}
+
+// Error of the image that was available at the given time, negative if no pass was done by then.
+double get_error_at_time(const std::vector<Error_Sample>& curve, double seconds) {
+    double rel_mse = -1.0;
+    for (const auto& error : curve) {
+        if (error.seconds <= seconds)
+            rel_mse = error.rel_mse;
+    }
+    return rel_mse;
+}
+
+void write_csv(const std::vector<Convergence_Result>& results, const Convergence_Benchmark_Settings& settings) {
+    printf("scene,integrator,spp,seconds,rmse,relmse\n");
+    for (const auto& result : results) {
+        for (const auto& error : result.curve) {
+            printf("%s,%s,%d,%.4f,%.6g,%.6g\n", result.scene_name, result.integrator_name,
+                   error.sample_count, error.seconds, error.rmse, error.rel_mse);
+        }
+    }
+
+    // Second table, empty fields for targets and checkpoints that weren't reached.
+    printf("\nscene,integrator,target_relmse,seconds_to_target");
+    for (float fraction : Checkpoint_Fractions)
+        printf(",relmse_at_%gs", fraction * settings.time_budget_seconds);
+    printf("\n");
+    for (const auto& result : results) {
+        printf("%s,%s,%g,", result.scene_name, result.integrator_name, settings.target_rel_mse);
+        double seconds = get_time_to_target(result.curve, settings.target_rel_mse);
+        if (seconds >= 0.0)
+            printf("%.4f", seconds);
+        for (float fraction : Checkpoint_Fractions) {
+            double rel_mse = get_error_at_time(result.curve, fraction * settings.time_budget_seconds);
+            printf(",");
+            if (rel_mse >= 0.0)
+                printf("%.6g", rel_mse);
+        }
+        printf("\n");
+    }
+}
+
+void write_json_number(double value, const char* format) {
+    if (value >= 0.0)
+        printf(format, value);
+    else
+        printf("null");
+}
+
+void write_json(const std::vector<Convergence_Result>& results, const Convergence_Benchmark_Settings& settings) {
+    printf("{\n");
+    printf("  \"width\": %d, \"height\": %d, \"reference_spp\": %d, \"time_budget\": %g, \"target_relmse\": %g,\n",
+           settings.image_width, settings.image_height, settings.reference_sample_count,
+           settings.time_budget_seconds, settings.target_rel_mse);
+    printf("  \"results\": [");
+    for (size_t r = 0; r < results.size(); r++) {
+        const Convergence_Result& result = results[r];
+        printf("%s\n    {\"scene\": \"%s\", \"integrator\": \"%s\",\n", r ? "," : "", result.scene_name, result.integrator_name);
+
+        printf("     \"seconds_to_target\": ");
+        write_json_number(get_time_to_target(result.curve, settings.target_rel_mse), "%.4f");
+
+        printf(",\n     \"relmse_at\": {");
+        for (size_t i = 0; i < sizeof(Checkpoint_Fractions) / sizeof(Checkpoint_Fractions[0]); i++) {
+            float seconds = Checkpoint_Fractions[i] * settings.time_budget_seconds;
+            printf("%s\"%g\": ", i ? ", " : "", seconds);
+            write_json_number(get_error_at_time(result.curve, seconds), "%.6g");
+        }
+
+        printf("},\n     \"curve\": [");
+        for (size_t i = 0; i < result.curve.size(); i++) {
+            const Error_Sample& error = result.curve[i];
+            printf("%s\n       {\"spp\": %d, \"seconds\": %.4f, \"rmse\": %.6g, \"relmse\": %.6g}", i ? "," : "",
+                   error.sample_count, error.seconds, error.rmse, error.rel_mse);
+        }
+        printf("]}");
+    }
+    printf("\n  ]\n}\n");
+}
+}
+
+void run_convergence_benchmark(const Convergence_Benchmark_Settings& settings, int thread_count) {
+    float aspect = float(settings.image_width) / float(settings.image_height);
+
+    std::vector<Convergence_Result> results;
+    for (const char* scene_name : Scene_Names) {
+        std::unique_ptr<Scene> scene(create_scene(scene_name, aspect));
+        scene->camera.set_image_height(settings.image_height);
+        replicate_scene_to_nodes(*scene);
+
+        std::vector<Vector> reference = get_reference(*scene, scene_name, settings, thread_count);
+
+        for (const auto& entry : Integrators) {
+            Convergence_Result result;
+            result.scene_name = scene_name;
+            result.integrator_name = entry.name;
+            result.curve = measure_convergence(*scene, entry.integrator, entry.path_guiding, reference, settings, thread_count);
+            results.push_back(result);
+
+            if (!result.curve.empty()) {
+                const Error_Sample& last = result.curve.back();
+                fprintf(stderr, "%s %s: %d spp in %.2fs, relMSE %.4g\n", scene_name, entry.name,
+                        last.sample_count, last.seconds, last.rel_mse);
+            }
+        }
+    }
+
+    if (settings.format == Benchmark_Output_Format::json)
+        write_json(results, settings);
+    else
+        write_csv(results, settings);
+}
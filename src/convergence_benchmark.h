@@ -0,0 +1,24 @@
+#pragma once
+
+enum class Benchmark_Output_Format {
+    csv,
+    json
+};
+
+struct Convergence_Benchmark_Settings {
+    int image_width = 160;
+    int image_height = 90;
+    // Path traced with the box filter, like the measured renders.
+    int reference_sample_count = 4096;
+    // Render time per integrator and scene.
+    float time_budget_seconds = 10.f;
+    float target_rel_mse = 0.01f;
+    Benchmark_Output_Format format = Benchmark_Output_Format::csv;
+};
+
+// Compares the integrators on equal time and on equal quality. A reference of each canonical scene
+// (cornell_box, two_spheres, simple_light) is rendered once and cached in the working directory,
+// then every integrator renders the scene progressively and the error against the reference is
+// measured after each pass. Writes the error curves, the time to reach the target relative MSE
+// and the error at fixed times to stdout.
+void run_convergence_benchmark(const Convergence_Benchmark_Settings& settings, int thread_count);
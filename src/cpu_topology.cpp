@@ -0,0 +1,128 @@
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace {
+std::vector<Logical_Processor> get_fallback_topology() {
+    SYSTEM_INFO si;
+    ::GetSystemInfo(&si);
+
+    std::vector<Logical_Processor> processors;
+    for (int i = 0; i < int(si.dwNumberOfProcessors) && i < 64; i++)
+        processors.push_back(Logical_Processor{0, i, i, 0, false, 0});
+    return processors;
+}
+}
+
+std::vector<Logical_Processor> get_cpu_topology() {
+    DWORD size = 0;
+    ::GetLogicalProcessorInformationEx(RelationAll, nullptr, &size);
+    if (size == 0)
+        return get_fallback_topology();
+
+    std::unique_ptr<char[]> buffer(new char[size]);
+    if (!::GetLogicalProcessorInformationEx(RelationAll, reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.get()), &size))
+        return get_fallback_topology();
+
+    // Processors by (group, number).
+    std::map<std::pair<int, int>, Logical_Processor> processors;
+    std::vector<std::pair<GROUP_AFFINITY, int>> node_masks;
+    int core_count = 0;
+
+    for (DWORD offset = 0; offset < size; ) {
+        auto info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.get() + offset);
+        offset += info->Size;
+
+        if (info->Relationship == RelationProcessorCore) {
+            int core = core_count++;
+            int thread_index = 0;
+            for (WORD g = 0; g < info->Processor.GroupCount; g++) {
+                const GROUP_AFFINITY& affinity = info->Processor.GroupMask[g];
+                for (int bit = 0; bit < 64; bit++) {
+                    if (!(affinity.Mask & (KAFFINITY(1) << bit)))
+                        continue;
+                    processors[std::make_pair(int(affinity.Group), bit)] =
+                        Logical_Processor{affinity.Group, bit, core, 0, thread_index++ > 0, 0};
+                }
+            }
+        } else if (info->Relationship == RelationNumaNode) {
+            node_masks.push_back(std::make_pair(info->NumaNode.GroupMask, int(info->NumaNode.NodeNumber)));
+        }
+    }
+
+    for (auto& entry : processors) {
+        Logical_Processor& processor = entry.second;
+        for (const auto& node_mask : node_masks) {
+            if (node_mask.first.Group == processor.group && (node_mask.first.Mask & (KAFFINITY(1) << processor.number)))
+                processor.numa_node = node_mask.second;
+        }
+    }
+
+    std::vector<Logical_Processor> topology;
+    for (const auto& entry : processors)
+        topology.push_back(entry.second);
+    return topology.empty() ? get_fallback_topology() : topology;
+}
+
+std::vector<Logical_Processor> select_processors(const std::vector<Logical_Processor>& topology, const Processor_Selection& selection) {
+    std::vector<Logical_Processor> selected;
+    for (const Logical_Processor& processor : topology) {
+        if (!selection.numa_nodes.empty() &&
+            std::find(selection.numa_nodes.begin(), selection.numa_nodes.end(), processor.numa_node) == selection.numa_nodes.end())
+        {
+            continue;
+        }
+        if (processor.smt_sibling && !selection.use_smt_siblings)
+            continue;
+        selected.push_back(processor);
+    }
+
+    // Nodes are indexed in order of their first processor, the rank counts the processors of the
+    // same node and kind before it.
+    std::vector<int> nodes;
+    std::map<std::pair<int, bool>, int> next_rank;
+    std::vector<int> ranks;
+    for (Logical_Processor& processor : selected) {
+        auto it = std::find(nodes.begin(), nodes.end(), processor.numa_node);
+        processor.node_index = static_cast<int>(it - nodes.begin());
+        if (it == nodes.end())
+            nodes.push_back(processor.numa_node);
+        ranks.push_back(next_rank[std::make_pair(processor.node_index, processor.smt_sibling)]++);
+    }
+
+    std::vector<int> order(selected.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = static_cast<int>(i);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        if (selected[a].smt_sibling != selected[b].smt_sibling)
+            return !selected[a].smt_sibling;
+        if (ranks[a] != ranks[b])
+            return ranks[a] < ranks[b];
+        return selected[a].node_index < selected[b].node_index;
+    });
+
+    std::vector<Logical_Processor> processors;
+    for (int i : order) {
+        if (selection.max_processor_count > 0 && int(processors.size()) == selection.max_processor_count)
+            break;
+        processors.push_back(selected[i]);
+    }
+    return processors;
+}
+
+int get_node_count(const std::vector<Logical_Processor>& processors) {
+    int node_count = 1;
+    for (const Logical_Processor& processor : processors)
+        node_count = std::max(node_count, processor.node_index + 1);
+    return node_count;
+}
+
+bool pin_thread(HANDLE thread, const Logical_Processor& processor) {
+    GROUP_AFFINITY affinity = {};
+    affinity.Mask = KAFFINITY(1) << processor.number;
+    affinity.Group = static_cast<WORD>(processor.group);
+    return ::SetThreadGroupAffinity(thread, &affinity, nullptr) != 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+
+struct Logical_Processor {
+    // Windows schedules threads in groups of at most 64 processors.
+    int group;
+    int number; // within the group
+    int core;
+    int numa_node;
+    // Another logical processor of the same core comes first (SMT).
+    bool smt_sibling;
+    // Index of the node among the nodes of the selected processors, set by select_processors.
+    int node_index;
+};
+
+struct Processor_Selection {
+    // All nodes when empty.
+    std::vector<int> numa_nodes;
+    bool use_smt_siblings = true;
+    // All selected processors when 0.
+    int max_processor_count = 0;
+};
+
+// Logical processors of all groups with their cores and NUMA nodes.
+std::vector<Logical_Processor> get_cpu_topology();
+
+// Processors for the render threads. Physical cores come before SMT siblings and the nodes take
+// turns, so a limited count is spread over the nodes. The first processor is on node index 0.
+std::vector<Logical_Processor> select_processors(const std::vector<Logical_Processor>& topology, const Processor_Selection& selection);
+
+int get_node_count(const std::vector<Logical_Processor>& processors);
+
+bool pin_thread(HANDLE thread, const Logical_Processor& processor);
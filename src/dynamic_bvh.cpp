@@ -0,0 +1,92 @@
+#include "dynamic_bvh.h"
+#include "linear_bvh.h"
+
+namespace {
+Bounding_Box get_node_bounds(const Flat_BVH_Node& node) {
+    return Bounding_Box(Vector(node.min_point[0], node.min_point[1], node.min_point[2]),
+                        Vector(node.max_point[0], node.max_point[1], node.max_point[2]));
+}
+}
+
+Dynamic_BVH::Dynamic_BVH(std::vector<Shape*> shapes, float time0, float time1, float rebuild_threshold)
+    : shapes(std::move(shapes))
+    , time0(time0)
+    , time1(time1)
+    , rebuild_threshold(rebuild_threshold)
+    , build_cost(0.f)
+    , rebuild_count(0)
+{
+    build();
+    add_memory_usage(nodes.capacity() * sizeof(Flat_BVH_Node) + this->shapes.capacity() * sizeof(Shape*));
+}
+
+void Dynamic_BVH::build() {
+    std::vector<Bounding_Box> bounds(shapes.size());
+    for (size_t i = 0; i < shapes.size(); i++)
+        bounds[i] = shapes[i]->boudning_box(time0, time1);
+    // Rebuilt in the middle of sequences, so the build time matters more than the tree quality.
+    // Replaces the previous tree, which is freed here.
+    nodes = build_linear_bvh(bounds);
+    build_cost = get_normalized_cost();
+}
+
+bool Dynamic_BVH::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const {
+    return traverse_flat_bvh(nodes.data(), static_cast<uint32_t>(nodes.size()), ray, t_min, t_max, [&](uint32_t index, float closest_t, float& t) {
+        Ray_Hit primitive_hit;
+        if (!shapes[index]->hit(ray, t_min, closest_t, primitive_hit))
+            return false;
+        hit_record = primitive_hit;
+        t = primitive_hit.t;
+        return true;
+    });
+}
+
+Bounding_Box Dynamic_BVH::boudning_box(float t0, float t1) const {
+    return nodes.empty() ? Bounding_Box() : get_node_bounds(nodes[0]);
+}
+
+float Dynamic_BVH::get_sah_cost() const {
+    float cost = 0.f;
+    for (const Flat_BVH_Node& node : nodes) {
+        cost += 2.f * get_node_bounds(node).surface_area();
+        uint32_t children[2] = {node.left, node.right};
+        for (int i = 0; i < (node.left == node.right ? 1 : 2); i++) {
+            if (children[i] & Flat_BVH_Node::Leaf_Flag)
+                cost += shapes[children[i] & ~Flat_BVH_Node::Leaf_Flag]->get_sah_cost();
+        }
+    }
+    return cost;
+}
+
+float Dynamic_BVH::get_normalized_cost() const {
+    float area = boudning_box(time0, time1).surface_area();
+    return area > 0.f ? get_sah_cost() / area : 0.f;
+}
+
+// Returns the bounds of a node or leaf after refitting the nodes below it.
+Bounding_Box Dynamic_BVH::refit_node(uint32_t child) {
+    if (child & Flat_BVH_Node::Leaf_Flag)
+        return shapes[child & ~Flat_BVH_Node::Leaf_Flag]->boudning_box(time0, time1);
+
+    Flat_BVH_Node& node = nodes[child];
+    Bounding_Box bounds = refit_node(node.left);
+    if (node.right != node.left)
+        bounds = Bounding_Box::get_union(bounds, refit_node(node.right));
+    for (int axis = 0; axis < 3; axis++) {
+        node.min_point[axis] = bounds.min_point[axis];
+        node.max_point[axis] = bounds.max_point[axis];
+    }
+    return bounds;
+}
+
+void Dynamic_BVH::refit() {
+    for (Shape* shape : shapes)
+        shape->refit();
+    if (nodes.empty())
+        return;
+    refit_node(0);
+    if (get_normalized_cost() > rebuild_threshold * build_cost) {
+        build();
+        rebuild_count++;
+    }
+}
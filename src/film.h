@@ -0,0 +1,134 @@
+#pragma once
+
+#include "tile_scheduler.h"
+#include "vector.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+class Filter {
+public:
+    explicit Filter(float radius) : radius(radius) {}
+    virtual ~Filter() {}
+
+    // x and y are offsets from the pixel center, |x|, |y| <= radius.
+    virtual float evaluate(float x, float y) const = 0;
+
+    const float radius;
+};
+
+class Box_Filter : public Filter {
+public:
+    explicit Box_Filter(float radius = 0.5f) : Filter(radius) {}
+    float evaluate(float x, float y) const override;
+};
+
+class Tent_Filter : public Filter {
+public:
+    explicit Tent_Filter(float radius = 1.f) : Filter(radius) {}
+    float evaluate(float x, float y) const override;
+};
+
+class Gaussian_Filter : public Filter {
+public:
+    explicit Gaussian_Filter(float radius = 1.5f, float alpha = 2.f);
+    float evaluate(float x, float y) const override;
+
+private:
+    float gaussian(float d) const;
+
+    float alpha;
+    float exp_radius;
+};
+
+class Mitchell_Filter : public Filter {
+public:
+    explicit Mitchell_Filter(float radius = 2.f, float b = 1.f/3.f, float c = 1.f/3.f)
+        : Filter(radius), b(b), c(c) {}
+    float evaluate(float x, float y) const override;
+
+private:
+    float mitchell_1d(float x) const;
+
+    float b, c;
+};
+
+enum class Filter_Type {
+    box,
+    tent,
+    gaussian,
+    mitchell
+};
+
+std::unique_ptr<Filter> create_filter(Filter_Type type);
+
+struct Film_Pixel {
+    Vector color; // linear, weighted sum of the samples
+    float weight;
+};
+
+class Film;
+
+// Accumulation buffer for one tile. It extends past the tile by the filter radius,
+// so samples near the tile border can be splatted into the neighboring pixels
+// without synchronization; the tile is merged into the film when it is done.
+class Film_Tile {
+public:
+    void add_sample(float x, float y, const Vector& color);
+
+private:
+    friend class Film;
+
+    const Film* film;
+    int x1, y1, x2, y2;
+    std::vector<Film_Pixel> pixels;
+};
+
+// Stores linear float RGB and filter weights per pixel. Tone mapping and quantization
+// are a separate final pass (develop).
+class Film {
+public:
+    Film(int width, int height, std::unique_ptr<Filter> filter);
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+
+    Film_Tile create_tile(const Tile& tile) const;
+    void merge_tile(const Film_Tile& tile);
+    void clear();
+
+    // Contributions of light paths that reach the camera, added to the pixel at raster position
+    // (x, y) from any thread. Splats are not normalized by filter weights but scaled by the splat
+    // scale, one over the samples per pixel.
+    void add_splat(float x, float y, const Vector& color);
+    void set_splat_scale(float scale) { splat_scale = scale; }
+
+    // Linear pixel value, j = 0 is the bottom row.
+    Vector get_pixel(int i, int j) const;
+
+    // Clamps, applies gamma 2 and quantizes to 8-bit RGB. Rows are stored top to bottom.
+    std::vector<unsigned char> develop() const;
+
+private:
+    friend class Film_Tile;
+
+    static const int Filter_Table_Size = 16;
+
+    float get_filter_weight(float dx, float dy) const;
+
+    int width, height;
+    std::unique_ptr<Filter> filter;
+    float filter_table[Filter_Table_Size][Filter_Table_Size];
+
+    std::vector<Film_Pixel> pixels;
+    std::mutex merge_mutex;
+
+    // RGB per pixel.
+    std::vector<std::atomic<float>> splats;
+    float splat_scale;
+};
+
+void write_ppm(std::ostream& out, const std::vector<unsigned char>& rgb, int width, int height);
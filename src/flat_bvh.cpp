@@ -0,0 +1,255 @@
+#include "flat_bvh.h"
+#include "linear_bvh.h"
+#include "thread.h"
+
+#define NOMINMAX
+#include <Windows.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace {
+const char Flat_BVH_Magic[4] = {'R', 'B', 'V', 'H'};
+const uint32_t Flat_BVH_Version = 1;
+
+struct Build_Primitive {
+    Bounding_Box bounds;
+    Vector centroid;
+    uint32_t index;
+};
+
+uint32_t build_node(std::vector<Flat_BVH_Node>& nodes, Build_Primitive* primitives, int n) {
+    uint32_t node_index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(Flat_BVH_Node());
+
+    Bounding_Box bounds, centroid_bounds;
+    for (int i = 0; i < n; i++) {
+        bounds = Bounding_Box::get_union(bounds, primitives[i].bounds);
+        centroid_bounds.extend(primitives[i].centroid);
+    }
+
+    uint32_t left, right;
+    if (n == 1) {
+        left = right = primitives[0].index | Flat_BVH_Node::Leaf_Flag;
+    } else if (n == 2) {
+        left = primitives[0].index | Flat_BVH_Node::Leaf_Flag;
+        right = primitives[1].index | Flat_BVH_Node::Leaf_Flag;
+    } else {
+        // Median split along the axis with the largest centroid extent.
+        Vector extent = centroid_bounds.max_point - centroid_bounds.min_point;
+        int axis = (extent.x > extent.y) ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        std::nth_element(primitives, primitives + n/2, primitives + n,
+            [axis](const Build_Primitive& a, const Build_Primitive& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+
+        left = build_node(nodes, primitives, n/2);
+        right = build_node(nodes, primitives + n/2, n - n/2);
+    }
+
+    // The vector may have been reallocated by the recursion.
+    Flat_BVH_Node& node = nodes[node_index];
+    for (int i = 0; i < 3; i++) {
+        node.min_point[i] = bounds.min_point[i];
+        node.max_point[i] = bounds.max_point[i];
+    }
+    node.left = left;
+    node.right = right;
+    return node_index;
+}
+
+// Checks that the children of every node reachable from the root are in range and that no node is
+// reached twice. The linear builder does not store parents before their children, so cycles are
+// ruled out by the visits instead of by the order.
+bool is_valid_hierarchy(const Flat_BVH_Node* nodes, uint32_t node_count, size_t primitive_count) {
+    if (node_count == 0)
+        return primitive_count == 0;
+
+    std::vector<bool> visited(node_count);
+    std::vector<uint32_t> stack(1, 0);
+    visited[0] = true;
+    while (!stack.empty()) {
+        const Flat_BVH_Node& node = nodes[stack.back()];
+        stack.pop_back();
+
+        const uint32_t children[2] = {node.left, node.right};
+        int child_count = (node.left == node.right) ? 1 : 2;
+        for (int i = 0; i < child_count; i++) {
+            uint32_t child = children[i];
+            if (child & Flat_BVH_Node::Leaf_Flag) {
+                if ((child & ~Flat_BVH_Node::Leaf_Flag) >= primitive_count)
+                    return false;
+                continue;
+            }
+            if (child >= node_count || visited[child])
+                return false;
+            visited[child] = true;
+            stack.push_back(child);
+        }
+    }
+    return true;
+}
+}
+
+std::vector<Flat_BVH_Node> build_flat_bvh(const std::vector<Bounding_Box>& primitive_bounds) {
+    std::vector<Build_Primitive> primitives(primitive_bounds.size());
+    for (size_t i = 0; i < primitive_bounds.size(); i++) {
+        primitives[i].bounds = primitive_bounds[i];
+        primitives[i].centroid = 0.5f * (primitive_bounds[i].min_point + primitive_bounds[i].max_point);
+        primitives[i].index = static_cast<uint32_t>(i);
+    }
+
+    std::vector<Flat_BVH_Node> nodes;
+    if (!primitives.empty()) {
+        nodes.reserve(2 * primitives.size());
+        build_node(nodes, primitives.data(), static_cast<int>(primitives.size()));
+    }
+    return nodes;
+}
+
+uint64_t hash_geometry(const std::vector<Shape*>& shapes, float time0, float time1, Flat_BVH_Builder builder) {
+    // 64-bit FNV-1a.
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+
+    uint32_t builder_type = static_cast<uint32_t>(builder);
+    add(&builder_type, sizeof(builder_type));
+    uint64_t count = shapes.size();
+    add(&count, sizeof(count));
+    for (const Shape* shape : shapes) {
+        Bounding_Box bounds = shape->boudning_box(time0, time1);
+        float values[6] = {
+            bounds.min_point.x, bounds.min_point.y, bounds.min_point.z,
+            bounds.max_point.x, bounds.max_point.y, bounds.max_point.z
+        };
+        add(values, sizeof(values));
+    }
+    return hash;
+}
+
+Flat_BVH::Flat_BVH(std::vector<Shape*> shapes, float time0, float time1, const std::string& cache_file, Flat_BVH_Builder builder)
+    : shapes(std::move(shapes))
+    , time0(time0)
+    , time1(time1)
+    , nodes(nullptr)
+    , node_count(0)
+{
+    uint64_t geometry_hash = 0;
+    if (!cache_file.empty()) {
+        geometry_hash = hash_geometry(this->shapes, time0, time1, builder);
+        if (load(cache_file, geometry_hash))
+            return;
+    }
+
+    build(builder);
+    if (!cache_file.empty())
+        save(cache_file, geometry_hash);
+}
+
+bool Flat_BVH::load(const std::string& cache_file, uint64_t geometry_hash) {
+    if (!mapped_file.open(cache_file))
+        return false;
+
+    const Flat_BVH_Header* header = reinterpret_cast<const Flat_BVH_Header*>(mapped_file.get_data());
+    if (mapped_file.get_size() < sizeof(Flat_BVH_Header) ||
+        memcmp(header->magic, Flat_BVH_Magic, sizeof(header->magic)) != 0 ||
+        header->version != Flat_BVH_Version ||
+        header->geometry_hash != geometry_hash ||
+        header->primitive_count != shapes.size() ||
+        mapped_file.get_size() < sizeof(Flat_BVH_Header) + header->node_count * sizeof(Flat_BVH_Node))
+    {
+        mapped_file.close();
+        return false;
+    }
+
+    // Traversal indexes straight into the mapping, so a corrupted file is rejected here.
+    const Flat_BVH_Node* file_nodes = reinterpret_cast<const Flat_BVH_Node*>(mapped_file.get_data() + sizeof(Flat_BVH_Header));
+    if (!is_valid_hierarchy(file_nodes, header->node_count, shapes.size())) {
+        mapped_file.close();
+        return false;
+    }
+
+    nodes = file_nodes;
+    node_count = header->node_count;
+    if (node_count > 0)
+        box = Bounding_Box(Vector(nodes[0].min_point[0], nodes[0].min_point[1], nodes[0].min_point[2]),
+                           Vector(nodes[0].max_point[0], nodes[0].max_point[1], nodes[0].max_point[2]));
+    return true;
+}
+
+void Flat_BVH::build(Flat_BVH_Builder builder) {
+    std::vector<Bounding_Box> bounds(shapes.size());
+    for (size_t i = 0; i < shapes.size(); i++)
+        bounds[i] = shapes[i]->boudning_box(time0, time1);
+
+    node_storage = (builder == Flat_BVH_Builder::linear) ? build_linear_bvh(bounds) : build_flat_bvh(bounds);
+
+    nodes = node_storage.data();
+    node_count = static_cast<uint32_t>(node_storage.size());
+    add_memory_usage(node_storage.capacity() * sizeof(Flat_BVH_Node));
+    if (node_count > 0)
+        box = Bounding_Box(Vector(nodes[0].min_point[0], nodes[0].min_point[1], nodes[0].min_point[2]),
+                           Vector(nodes[0].max_point[0], nodes[0].max_point[1], nodes[0].max_point[2]));
+}
+
+void Flat_BVH::save(const std::string& cache_file, uint64_t geometry_hash) const {
+    Flat_BVH_Header header;
+    memcpy(header.magic, Flat_BVH_Magic, sizeof(header.magic));
+    header.version = Flat_BVH_Version;
+    header.geometry_hash = geometry_hash;
+    header.node_count = node_count;
+    header.primitive_count = static_cast<uint32_t>(shapes.size());
+
+    // Written next to the cache file and moved over it once complete, a failed or interrupted
+    // write leaves the previous file in place.
+    std::string temp_file = cache_file + ".tmp";
+    {
+        std::ofstream out(temp_file, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(nodes), node_count * sizeof(Flat_BVH_Node));
+        out.close();
+        if (!out) {
+            ::DeleteFileA(temp_file.c_str());
+            return;
+        }
+    }
+    if (!::MoveFileExA(temp_file.c_str(), cache_file.c_str(), MOVEFILE_REPLACE_EXISTING))
+        ::DeleteFileA(temp_file.c_str());
+}
+
+void Flat_BVH::create_node_replica(int node) {
+    for (Shape* shape : shapes)
+        shape->create_node_replica(node);
+
+    if (node_replicas.size() <= size_t(node))
+        node_replicas.resize(node + 1);
+    Node_Replica& replica = node_replicas[node];
+    replica.nodes.assign(nodes, nodes + node_count);
+    replica.shapes = shapes;
+}
+
+bool Flat_BVH::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const {
+    const Flat_BVH_Node* hit_nodes = nodes;
+    Shape* const* hit_shapes = shapes.data();
+    size_t node_index = Thread::get_current_node();
+    if (node_index < node_replicas.size() && !node_replicas[node_index].shapes.empty()) {
+        hit_nodes = node_replicas[node_index].nodes.data();
+        hit_shapes = node_replicas[node_index].shapes.data();
+    }
+
+    return traverse_flat_bvh(hit_nodes, node_count, ray, t_min, t_max, [&](uint32_t index, float closest_t, float& t) {
+        Ray_Hit primitive_hit;
+        if (!hit_shapes[index]->hit(ray, t_min, closest_t, primitive_hit))
+            return false;
+        hit_record = primitive_hit;
+        t = primitive_hit.t;
+        return true;
+    });
+}
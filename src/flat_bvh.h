@@ -0,0 +1,174 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "shape.h"
+#include "simd_vector.h"
+#include "stats.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Pointer-free BVH node. Children are node indices, or primitive indices when Leaf_Flag is set;
+// a node with a single primitive references it from both children. Node 0 is the root.
+struct Flat_BVH_Node {
+    float min_point[3];
+    uint32_t left;
+    float max_point[3];
+    uint32_t right;
+
+    static const uint32_t Leaf_Flag = 0x80000000u;
+};
+
+// On-disk layout of a cached hierarchy:
+//   Flat_BVH_Header
+//   Flat_BVH_Node[node_count]
+struct Flat_BVH_Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t geometry_hash;
+    uint32_t node_count;
+    uint32_t primitive_count;
+};
+
+enum class Flat_BVH_Builder {
+    median_split, // top-down, better trees
+    linear        // build_linear_bvh, much faster builds for geometry rebuilt often
+};
+
+// BVH stored as a flat node array that can be written to disk and memory-mapped back.
+// With a cache file the hierarchy is used straight from the mapping when the file was built for
+// the same geometry (same primitive bounds in the same order); otherwise it is built and the file rewritten.
+class Flat_BVH : public Shape {
+public:
+    Flat_BVH(std::vector<Shape*> shapes, float time0, float time1, const std::string& cache_file = std::string(),
+             Flat_BVH_Builder builder = Flat_BVH_Builder::median_split);
+
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const override;
+    Bounding_Box boudning_box(float t0, float t1) const override { return box; }
+
+    void get_features(Shape_Features& features) const override {
+        for (const Shape* shape : shapes)
+            shape->get_features(features);
+    }
+
+    void create_node_replica(int node) override;
+
+    void set_parent_transform(const Shape_Transform* transform) override {
+        for (Shape* shape : shapes)
+            shape->set_parent_transform(transform);
+    }
+
+    bool is_loaded_from_cache() const { return mapped_file.is_open(); }
+
+private:
+    bool load(const std::string& cache_file, uint64_t geometry_hash);
+    void build(Flat_BVH_Builder builder);
+    void save(const std::string& cache_file, uint64_t geometry_hash) const;
+
+    std::vector<Shape*> shapes;
+    float time0, time1;
+
+    const Flat_BVH_Node* nodes;
+    uint32_t node_count;
+    std::vector<Flat_BVH_Node> node_storage;
+    Mapped_File mapped_file;
+
+    // Copies for the NUMA nodes by node index, empty for nodes without a copy.
+    struct Node_Replica {
+        std::vector<Flat_BVH_Node> nodes;
+        std::vector<Shape*> shapes;
+    };
+    std::vector<Node_Replica> node_replicas;
+
+    Bounding_Box box;
+};
+
+// Builds a hierarchy over primitives given by their bounds, leaves hold indices into primitive_bounds.
+std::vector<Flat_BVH_Node> build_flat_bvh(const std::vector<Bounding_Box>& primitive_bounds);
+
+// Closest hit traversal of a node array. hit_primitive(index, t_max, t) tests the primitive with the
+// given index and returns true with its distance in t for a hit in (t_min, t_max).
+template <typename Hit_Primitive>
+bool traverse_flat_bvh(const Flat_BVH_Node* nodes, uint32_t node_count, const Ray& ray, float t_min, float t_max,
+                       Hit_Primitive&& hit_primitive)
+{
+    // Nearest first traversal keeps at most one entry per level on the stack, entries of trees
+    // deeper than that (linear builds of huge scenes can be) spill to the heap.
+    const int Max_Stack_Size = 64;
+    if (node_count == 0)
+        return false;
+
+    SIMD_Vector origin(ray.origin);
+    SIMD_Vector inv_dir = SIMD_Vector(1.f) / SIMD_Vector(ray.direction);
+
+    STATS_INCREMENT(box_tests);
+    float root_t_min = t_min;
+    float root_t_max = t_max;
+    if (!intersect_slabs(SIMD_Vector::load3(nodes[0].min_point), SIMD_Vector::load3(nodes[0].max_point), origin, inv_dir, root_t_min, root_t_max))
+        return false;
+
+    // Entries are visited nearest first and skipped once a closer hit is found.
+    struct Stack_Entry {
+        uint32_t node;
+        float t_enter;
+    };
+    Stack_Entry stack[Max_Stack_Size];
+    int stack_size = 0;
+    std::vector<Stack_Entry> spilled_stack;
+    stack[stack_size++] = {0, root_t_min};
+    bool hit_anything = false;
+
+    while (stack_size > 0) {
+        Stack_Entry entry;
+        if (!spilled_stack.empty()) {
+            entry = spilled_stack.back();
+            spilled_stack.pop_back();
+        } else {
+            entry = stack[--stack_size];
+        }
+        if (entry.t_enter > t_max)
+            continue;
+
+        STATS_INCREMENT(bvh_nodes_visited);
+        const Flat_BVH_Node& node = nodes[entry.node];
+        uint32_t children[2] = {node.left, node.right};
+        int child_count = (node.left == node.right) ? 1 : 2;
+
+        Stack_Entry hit_children[2];
+        int hit_child_count = 0;
+        for (int i = 0; i < child_count; i++) {
+            if (children[i] & Flat_BVH_Node::Leaf_Flag) {
+                float t;
+                if (hit_primitive(children[i] & ~Flat_BVH_Node::Leaf_Flag, t_max, t)) {
+                    hit_anything = true;
+                    t_max = t;
+                }
+                continue;
+            }
+
+            STATS_INCREMENT(box_tests);
+            const Flat_BVH_Node& child = nodes[children[i]];
+            float child_t_min = t_min;
+            float child_t_max = t_max;
+            if (intersect_slabs(SIMD_Vector::load3(child.min_point), SIMD_Vector::load3(child.max_point), origin, inv_dir, child_t_min, child_t_max))
+                hit_children[hit_child_count++] = {children[i], child_t_min};
+        }
+
+        // Push the far child first so that the near one is popped next.
+        if (hit_child_count == 2 && hit_children[0].t_enter < hit_children[1].t_enter)
+            std::swap(hit_children[0], hit_children[1]);
+        for (int i = 0; i < hit_child_count; i++) {
+            if (stack_size < Max_Stack_Size)
+                stack[stack_size++] = hit_children[i];
+            else
+                spilled_stack.push_back(hit_children[i]);
+        }
+    }
+    return hit_anything;
+}
+
+// Hash of the primitive bounds over [time0, time1] and the builder, identifies the geometry a hierarchy was built for
+// and how it was built.
+uint64_t hash_geometry(const std::vector<Shape*>& shapes, float time0, float time1, Flat_BVH_Builder builder);
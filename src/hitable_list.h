@@ -1,6 +1,7 @@
 #pragma once
 
 #include "shape.h"
+#include <algorithm>
 #include <cassert>
 
 class HitableList : public Shape
@@ -9,13 +10,38 @@ public:
     HitableList() {}
     HitableList(Shape** list, int listSize) : list(list), listSize(listSize) {}
 
-    bool hit(const Ray& ray, float tMin, float tMax, Intersection& hitRecord) const override;
+    bool hit(const Ray& ray, float tMin, float tMax, Ray_Hit& hitRecord) const override;
+
+    void hit_batch(const Ray* rays, int count, float t_min, float* t_max, Ray_Hit* hits) const override {
+        for (int i = 0; i < listSize; i++)
+            list[i]->hit_batch(rays, count, t_min, t_max, hits);
+    }
 
     Bounding_Box boudning_box(float t0, float t1) const override {
         assert(!"should not be called");
         return Bounding_Box();
     }
 
+    void refit() override {
+        for (int i = 0; i < listSize; i++)
+            list[i]->refit();
+    }
+
+    void get_features(Shape_Features& features) const override {
+        for (int i = 0; i < listSize; i++)
+            list[i]->get_features(features);
+    }
+
+    void create_node_replica(int node) override {
+        for (int i = 0; i < listSize; i++)
+            list[i]->create_node_replica(node);
+    }
+
+    void set_parent_transform(const Shape_Transform* transform) override {
+        for (int i = 0; i < listSize; i++)
+            list[i]->set_parent_transform(transform);
+    }
+
     float pdf_value(const Vector& o, const Vector& v) const {
         float sum = 0.f;
         for (int i = 0; i < listSize; i++)
@@ -28,13 +54,28 @@ public:
         return list[index]->random_direction(rng, o);
     }
 
+    bool sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const override {
+        int index = std::min(static_cast<int>(rng.random_float() * listSize), listSize - 1);
+        if (!list[index]->sample_surface(rng, point, normal, pdf))
+            return false;
+        pdf /= listSize;
+        return true;
+    }
+
+    float surface_pdf(const Vector& point) const override {
+        float sum = 0.f;
+        for (int i = 0; i < listSize; i++)
+            sum += list[i]->surface_pdf(point);
+        return sum / listSize;
+    }
+
     Shape** list;
     int listSize;
 };
 
-inline bool HitableList::hit(const Ray& ray, float tMin, float tMax, Intersection& hitRecord) const
+inline bool HitableList::hit(const Ray& ray, float tMin, float tMax, Ray_Hit& hitRecord) const
 {
-    Intersection tempHit;
+    Ray_Hit tempHit;
     bool hitAnything = false;
     float closestSoFar = tMax;
 
@@ -0,0 +1,148 @@
+#include "job.h"
+
+#include <cstdlib>
+#include <sstream>
+
+static bool parse_int(const std::string& value, int min_value, int& result) {
+    char* end = nullptr;
+    long parsed = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || parsed < min_value || parsed > 1000000)
+        return false;
+    result = static_cast<int>(parsed);
+    return true;
+}
+
+static bool parse_float(const std::string& value, float& result) {
+    char* end = nullptr;
+    result = strtof(value.c_str(), &end);
+    return !value.empty() && *end == '\0';
+}
+
+static bool parse_bool(const std::string& value, bool& result) {
+    if (value != "0" && value != "1")
+        return false;
+    result = (value == "1");
+    return true;
+}
+
+static bool parse_uint64(const std::string& value, uint64_t& result) {
+    char* end = nullptr;
+    result = strtoull(value.c_str(), &end, 10);
+    return !value.empty() && value[0] != '-' && *end == '\0';
+}
+
+static bool parse_integrator(const std::string& value, Integrator& result) {
+    if (value == "path")
+        result = Integrator::path;
+    else if (value == "bidirectional")
+        result = Integrator::bidirectional;
+    else
+        return false;
+    return true;
+}
+
+static bool parse_vector(const std::string& value, Vector& result) {
+    std::istringstream stream(value);
+    std::string component;
+    for (int i = 0; i < 3; i++) {
+        if (!std::getline(stream, component, ',') || !parse_float(component, result[i]))
+            return false;
+    }
+    return stream.peek() == std::char_traits<char>::eof();
+}
+
+bool parse_render_job(const std::string& text, Render_Job& job, std::string& error) {
+    job = Render_Job();
+    bool has_look_from = false;
+    bool has_look_at = false;
+    bool has_vfov = false;
+
+    std::istringstream stream(text);
+    std::string token;
+    while (stream >> token) {
+        size_t separator = token.find('=');
+        if (separator == std::string::npos) {
+            error = "expected key=value: " + token;
+            return false;
+        }
+        std::string key = token.substr(0, separator);
+        std::string value = token.substr(separator + 1);
+
+        bool valid = true;
+        if (key == "scene")
+            job.scene = value;
+        else if (key == "width")
+            valid = parse_int(value, 1, job.width);
+        else if (key == "height")
+            valid = parse_int(value, 1, job.height);
+        else if (key == "spp")
+            valid = parse_int(value, 1, job.samples);
+        else if (key == "priority")
+            valid = parse_int(value, -1000000, job.priority);
+        else if (key == "output")
+            job.output = value;
+        else if (key == "look_from")
+            valid = has_look_from = parse_vector(value, job.look_from);
+        else if (key == "look_at")
+            valid = has_look_at = parse_vector(value, job.look_at);
+        else if (key == "vfov")
+            valid = has_vfov = parse_float(value, job.vfov) && job.vfov > 0.f && job.vfov < 180.f;
+        else if (key == "tile_size")
+            valid = parse_int(value, 1, job.tile_size);
+        else if (key == "integrator")
+            valid = parse_integrator(value, job.integrator);
+        else if (key == "seed")
+            valid = parse_uint64(value, job.seed);
+        else if (key == "frames")
+            valid = parse_int(value, 1, job.frames);
+        else if (key == "radiance_cache")
+            valid = parse_bool(value, job.radiance_cache);
+        else if (key == "caustic_photon_map")
+            valid = parse_bool(value, job.caustic_photon_map);
+        else if (key == "path_guiding")
+            valid = parse_bool(value, job.path_guiding);
+        else if (key == "time_budget")
+            valid = parse_float(value, job.time_budget) && job.time_budget >= 0.f;
+        else {
+            error = "unknown key: " + key;
+            return false;
+        }
+
+        if (!valid) {
+            error = "invalid value for " + key + ": " + value;
+            return false;
+        }
+    }
+
+    if (job.output.empty()) {
+        error = "missing output";
+        return false;
+    }
+    if (has_look_from != has_look_at) {
+        error = "look_from and look_at must be given together";
+        return false;
+    }
+    if (has_vfov && !has_look_from) {
+        error = "vfov needs look_from and look_at";
+        return false;
+    }
+    job.custom_camera = has_look_from;
+    return true;
+}
+
+bool read_render_jobs(std::istream& in, std::vector<Render_Job>& jobs, std::string& error) {
+    std::string line;
+    for (int line_number = 1; std::getline(in, line); line_number++) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+
+        Render_Job job;
+        if (!parse_render_job(line, job, error)) {
+            error = "line " + std::to_string(line_number) + ": " + error;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
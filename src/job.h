@@ -0,0 +1,50 @@
+#pragma once
+
+#include "render.h"
+#include "vector.h"
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+// Render request, written as "key=value" pairs separated by whitespace:
+//   scene=cornell_box width=320 height=180 spp=16 priority=2 output=thumb.ppm
+//   look_from=278,278,-800 look_at=278,278,0 vfov=40
+//   tile_size=32 integrator=bidirectional seed=7 frames=30
+//   radiance_cache=1 caustic_photon_map=1 path_guiding=1 time_budget=2.5
+// The camera keys are optional and replace the camera of the scene. Output "-" is stdout.
+struct Render_Job {
+    std::string scene = "cornell_box";
+    int width = 1280;
+    int height = 720;
+    int samples = 64;
+    // Jobs with a higher priority get the threads first.
+    int priority = 0;
+    std::string output;
+
+    bool custom_camera = false;
+    Vector look_from;
+    Vector look_at;
+    float vfov = 40.f;
+
+    int tile_size = 32;
+    // path or bidirectional.
+    Integrator integrator = Integrator::path;
+    // Zero for a different image every time, see render_frame.
+    uint64_t seed = 0;
+    // Animated scenes render this many frames into numbered files, output is their prefix then.
+    int frames = 1;
+    // Sized for the cornell box scenes, see Radiance_Cache, Caustic_Photon_Map and Guiding_Field.
+    bool radiance_cache = false;
+    bool caustic_photon_map = false;
+    bool path_guiding = false;
+    // Seconds per frame, spp is the maximum then. Zero renders all the samples.
+    float time_budget = 0.f;
+};
+
+// Returns false and a description of the problem if the text is not a valid job.
+bool parse_render_job(const std::string& text, Render_Job& job, std::string& error);
+
+// Reads one job per line, empty lines and lines starting with # are skipped.
+bool read_render_jobs(std::istream& in, std::vector<Render_Job>& jobs, std::string& error);
@@ -0,0 +1,371 @@
+#include "linear_bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <queue>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+const int Morton_Bits_Per_Axis = 10;
+const int Radix_Bits = 10;
+const int Radix_Size = 1 << Radix_Bits;
+// Smallest amount of primitives worth a thread of its own.
+const size_t Min_Primitives_Per_Thread = 16384;
+
+// Runs function(begin, end, block) on block_count contiguous blocks of [0, n), one thread per block.
+// The build runs on its own threads, the render threads may be busy with other scenes.
+template <typename Function>
+void parallel_blocks(int block_count, size_t n, Function function) {
+    std::vector<std::thread> threads;
+    for (int block = 1; block < block_count; block++)
+        threads.emplace_back(function, n * block / block_count, n * (block + 1) / block_count, block);
+    function(size_t(0), n / block_count, 0);
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+int count_leading_zeros(uint64_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - static_cast<int>(index);
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+// Inserts two zero bits before each of the 10 low bits.
+uint32_t expand_bits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+Vector get_centroid(const Bounding_Box& bounds) {
+    return 0.5f * (bounds.min_point + bounds.max_point);
+}
+
+Bounding_Box get_node_bounds(const Flat_BVH_Node& node) {
+    return Bounding_Box(Vector(node.min_point[0], node.min_point[1], node.min_point[2]),
+                        Vector(node.max_point[0], node.max_point[1], node.max_point[2]));
+}
+
+void set_node_bounds(Flat_BVH_Node& node, const Bounding_Box& bounds) {
+    for (int i = 0; i < 3; i++) {
+        node.min_point[i] = bounds.min_point[i];
+        node.max_point[i] = bounds.max_point[i];
+    }
+}
+
+class Linear_BVH_Builder {
+public:
+    Linear_BVH_Builder(const std::vector<Bounding_Box>& primitive_bounds, int thread_count)
+        : primitive_bounds(primitive_bounds)
+        , primitive_count(primitive_bounds.size())
+    {
+        if (thread_count <= 0)
+            thread_count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        size_t max_blocks = std::max(size_t(1), primitive_count / Min_Primitives_Per_Thread);
+        block_count = static_cast<int>(std::min(size_t(thread_count), max_blocks));
+    }
+
+    std::vector<Flat_BVH_Node> build(int sah_cut_size) {
+        compute_keys();
+        sort_keys();
+        emit_hierarchy();
+        compute_bounds();
+        if (sah_cut_size > 1)
+            refine_top(sah_cut_size);
+        return std::move(nodes);
+    }
+
+private:
+    Bounding_Box get_child_bounds(uint32_t child) const {
+        if (child & Flat_BVH_Node::Leaf_Flag)
+            return primitive_bounds[child & ~Flat_BVH_Node::Leaf_Flag];
+        return get_node_bounds(nodes[child]);
+    }
+
+    // Keys are the 30-bit Morton code of the centroid in the high half and the primitive index in
+    // the low half, which makes them unique as the hierarchy emission requires.
+    void compute_keys() {
+        std::vector<Bounding_Box> block_bounds(block_count);
+        parallel_blocks(block_count, primitive_count, [&](size_t begin, size_t end, int block) {
+            for (size_t i = begin; i < end; i++)
+                block_bounds[block].extend(get_centroid(primitive_bounds[i]));
+        });
+        Bounding_Box centroid_bounds;
+        for (const Bounding_Box& bounds : block_bounds)
+            centroid_bounds = Bounding_Box::get_union(centroid_bounds, bounds);
+
+        Vector extent = centroid_bounds.max_point - centroid_bounds.min_point;
+        const float grid_size = float(1 << Morton_Bits_Per_Axis);
+        Vector scale;
+        for (int axis = 0; axis < 3; axis++)
+            scale[axis] = extent[axis] > 0.f ? grid_size / extent[axis] : 0.f;
+
+        keys.resize(primitive_count);
+        parallel_blocks(block_count, primitive_count, [&](size_t begin, size_t end, int block) {
+            for (size_t i = begin; i < end; i++) {
+                Vector p = get_centroid(primitive_bounds[i]) - centroid_bounds.min_point;
+                uint32_t code = 0;
+                for (int axis = 0; axis < 3; axis++) {
+                    uint32_t cell = static_cast<uint32_t>(std::min(std::max(p[axis] * scale[axis], 0.f), grid_size - 1.f));
+                    code |= expand_bits(cell) << (2 - axis);
+                }
+                keys[i] = (uint64_t(code) << 32) | i;
+            }
+        });
+    }
+
+    // Least significant digit first radix sort of the Morton codes. The passes are stable and the
+    // keys start in index order, so the index half never needs sorting.
+    void sort_keys() {
+        std::vector<uint64_t> buffer(primitive_count);
+        std::vector<size_t> offsets(size_t(block_count) * Radix_Size);
+
+        for (int shift = 32; shift < 32 + 3 * Morton_Bits_Per_Axis; shift += Radix_Bits) {
+            parallel_blocks(block_count, primitive_count, [&](size_t begin, size_t end, int block) {
+                size_t* histogram = &offsets[size_t(block) * Radix_Size];
+                std::fill(histogram, histogram + Radix_Size, size_t(0));
+                for (size_t i = begin; i < end; i++)
+                    histogram[(keys[i] >> shift) & (Radix_Size - 1)]++;
+            });
+
+            // Blocks scatter each digit in order, after the same digit of the blocks before them.
+            size_t offset = 0;
+            for (int digit = 0; digit < Radix_Size; digit++) {
+                for (int block = 0; block < block_count; block++) {
+                    size_t count = offsets[size_t(block) * Radix_Size + digit];
+                    offsets[size_t(block) * Radix_Size + digit] = offset;
+                    offset += count;
+                }
+            }
+
+            parallel_blocks(block_count, primitive_count, [&](size_t begin, size_t end, int block) {
+                size_t* block_offsets = &offsets[size_t(block) * Radix_Size];
+                for (size_t i = begin; i < end; i++)
+                    buffer[block_offsets[(keys[i] >> shift) & (Radix_Size - 1)]++] = keys[i];
+            });
+            keys.swap(buffer);
+        }
+    }
+
+    // Length of the common prefix of the keys at sorted positions i and j, -1 outside of the range.
+    int delta(int64_t i, int64_t j) const {
+        if (j < 0 || j >= int64_t(primitive_count))
+            return -1;
+        return count_leading_zeros(keys[i] ^ keys[j]);
+    }
+
+    uint32_t get_leaf(int64_t position) const {
+        return static_cast<uint32_t>(keys[position]) | Flat_BVH_Node::Leaf_Flag;
+    }
+
+    // Internal node i of the n - 1 nodes covers the keys [min(i, j), max(i, j)] and splits them
+    // where the common prefix gets longer. Every node finds its range on its own (Karras 2012).
+    void emit_hierarchy() {
+        size_t internal_count = primitive_count - 1;
+        nodes.resize(internal_count);
+        node_parents.assign(internal_count, -1);
+        leaf_parents.resize(primitive_count);
+        primitive_counts.resize(internal_count);
+
+        parallel_blocks(block_count, internal_count, [&](size_t begin, size_t end, int block) {
+            for (size_t index = begin; index < end; index++) {
+                int64_t i = static_cast<int64_t>(index);
+                int d = (delta(i, i + 1) - delta(i, i - 1)) >= 0 ? 1 : -1;
+
+                // Other end of the range, found with an exponential then a binary search.
+                int delta_min = delta(i, i - d);
+                int64_t length_max = 2;
+                while (delta(i, i + length_max * d) > delta_min)
+                    length_max *= 2;
+                int64_t length = 0;
+                for (int64_t t = length_max / 2; t >= 1; t /= 2) {
+                    if (delta(i, i + (length + t) * d) > delta_min)
+                        length += t;
+                }
+                int64_t j = i + length * d;
+
+                // Split position, the last key sharing the longer prefix with i.
+                int delta_node = delta(i, j);
+                int64_t split = 0;
+                for (int64_t divisor = 2, t = length; t > 1; divisor *= 2) {
+                    t = (length + divisor - 1) / divisor;
+                    if (delta(i, i + (split + t) * d) > delta_node)
+                        split += t;
+                }
+                int64_t gamma = i + split * d + std::min(d, 0);
+
+                Flat_BVH_Node& node = nodes[index];
+                if (std::min(i, j) == gamma) {
+                    node.left = get_leaf(gamma);
+                    leaf_parents[gamma] = static_cast<int64_t>(index);
+                } else {
+                    node.left = static_cast<uint32_t>(gamma);
+                    node_parents[gamma] = static_cast<int64_t>(index);
+                }
+                if (std::max(i, j) == gamma + 1) {
+                    node.right = get_leaf(gamma + 1);
+                    leaf_parents[gamma + 1] = static_cast<int64_t>(index);
+                } else {
+                    node.right = static_cast<uint32_t>(gamma + 1);
+                    node_parents[gamma + 1] = static_cast<int64_t>(index);
+                }
+                primitive_counts[index] = static_cast<uint32_t>(std::abs(j - i) + 1);
+            }
+        });
+    }
+
+    // Walks up from every leaf, the second child to arrive at a node computes its bounds.
+    void compute_bounds() {
+        std::vector<std::atomic<int>> arrivals(nodes.size());
+        parallel_blocks(block_count, nodes.size(), [&](size_t begin, size_t end, int block) {
+            for (size_t i = begin; i < end; i++)
+                arrivals[i].store(0, std::memory_order_relaxed);
+        });
+
+        parallel_blocks(block_count, primitive_count, [&](size_t begin, size_t end, int block) {
+            for (size_t leaf = begin; leaf < end; leaf++) {
+                int64_t index = leaf_parents[leaf];
+                while (index >= 0 && arrivals[index].fetch_add(1, std::memory_order_acq_rel) == 1) {
+                    Flat_BVH_Node& node = nodes[index];
+                    set_node_bounds(node, Bounding_Box::get_union(get_child_bounds(node.left), get_child_bounds(node.right)));
+                    index = node_parents[index];
+                }
+            }
+        });
+    }
+
+    struct Cut_Node {
+        uint32_t child;
+        Bounding_Box bounds;
+        Vector centroid;
+        uint32_t primitive_count;
+    };
+
+    // Replaces the nodes above a cut of the largest subtrees with a top-down build that evaluates
+    // the surface area heuristic for every split, where the Morton order is least accurate.
+    void refine_top(int sah_cut_size) {
+        auto make_cut_node = [this](uint32_t child) {
+            Cut_Node cut_node;
+            cut_node.child = child;
+            cut_node.bounds = get_child_bounds(child);
+            cut_node.centroid = get_centroid(cut_node.bounds);
+            cut_node.primitive_count = (child & Flat_BVH_Node::Leaf_Flag) ? 1 : primitive_counts[child];
+            return cut_node;
+        };
+        auto smaller_area = [](const Cut_Node& a, const Cut_Node& b) {
+            return a.bounds.surface_area() < b.bounds.surface_area();
+        };
+
+        // Opens the largest subtree until the cut is full, the opened nodes are reused for the new top.
+        std::priority_queue<Cut_Node, std::vector<Cut_Node>, decltype(smaller_area)> open(smaller_area);
+        std::vector<Cut_Node> cut;
+        std::vector<uint32_t> free_nodes;
+        open.push(make_cut_node(0));
+        while (!open.empty()) {
+            Cut_Node cut_node = open.top();
+            open.pop();
+            if ((cut_node.child & Flat_BVH_Node::Leaf_Flag) || cut.size() + open.size() + 2 > size_t(sah_cut_size)) {
+                cut.push_back(cut_node);
+                continue;
+            }
+            free_nodes.push_back(cut_node.child);
+            open.push(make_cut_node(nodes[cut_node.child].left));
+            open.push(make_cut_node(nodes[cut_node.child].right));
+        }
+
+        // The root is the first node opened and stays at index 0.
+        size_t next_free = 0;
+        build_top(cut.data(), static_cast<int>(cut.size()), free_nodes, next_free);
+    }
+
+    uint32_t build_top(Cut_Node* cut, int n, const std::vector<uint32_t>& free_nodes, size_t& next_free) {
+        if (n == 1)
+            return cut[0].child;
+
+        uint32_t node_index = free_nodes[next_free++];
+
+        // Full sweep on every axis, costs are areas times primitive counts.
+        std::vector<float> right_costs(n);
+        float best_cost = std::numeric_limits<float>::infinity();
+        int best_axis = 0;
+        int best_split = n / 2;
+        for (int axis = 0; axis < 3; axis++) {
+            std::sort(cut, cut + n, [axis](const Cut_Node& a, const Cut_Node& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+
+            Bounding_Box right_bounds;
+            uint32_t right_count = 0;
+            for (int i = n - 1; i > 0; i--) {
+                right_bounds = Bounding_Box::get_union(right_bounds, cut[i].bounds);
+                right_count += cut[i].primitive_count;
+                right_costs[i] = right_bounds.surface_area() * right_count;
+            }
+
+            Bounding_Box left_bounds;
+            uint32_t left_count = 0;
+            for (int i = 1; i < n; i++) {
+                left_bounds = Bounding_Box::get_union(left_bounds, cut[i - 1].bounds);
+                left_count += cut[i - 1].primitive_count;
+                float cost = left_bounds.surface_area() * left_count + right_costs[i];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = i;
+                }
+            }
+        }
+        std::sort(cut, cut + n, [best_axis](const Cut_Node& a, const Cut_Node& b) {
+            return a.centroid[best_axis] < b.centroid[best_axis];
+        });
+
+        uint32_t left = build_top(cut, best_split, free_nodes, next_free);
+        uint32_t right = build_top(cut + best_split, n - best_split, free_nodes, next_free);
+
+        Bounding_Box bounds;
+        for (int i = 0; i < n; i++)
+            bounds = Bounding_Box::get_union(bounds, cut[i].bounds);
+
+        Flat_BVH_Node& node = nodes[node_index];
+        set_node_bounds(node, bounds);
+        node.left = left;
+        node.right = right;
+        return node_index;
+    }
+
+    const std::vector<Bounding_Box>& primitive_bounds;
+    size_t primitive_count;
+    int block_count;
+
+    std::vector<uint64_t> keys;
+    std::vector<Flat_BVH_Node> nodes;
+    std::vector<int64_t> node_parents;
+    std::vector<int64_t> leaf_parents;
+    std::vector<uint32_t> primitive_counts;
+};
+} // namespace
+
+std::vector<Flat_BVH_Node> build_linear_bvh(const std::vector<Bounding_Box>& primitive_bounds, int thread_count, int sah_cut_size) {
+    std::vector<Flat_BVH_Node> nodes;
+    if (primitive_bounds.size() == 1) {
+        Flat_BVH_Node node;
+        set_node_bounds(node, primitive_bounds[0]);
+        node.left = node.right = Flat_BVH_Node::Leaf_Flag;
+        nodes.push_back(node);
+    } else if (primitive_bounds.size() > 1) {
+        Linear_BVH_Builder builder(primitive_bounds, thread_count);
+        nodes = builder.build(sah_cut_size);
+    }
+    return nodes;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "flat_bvh.h"
+
+#include <vector>
+
+// Builds a flat hierarchy over primitives given by their bounds as a linear BVH: primitives are
+// sorted along a Morton curve of their centroids and the hierarchy is emitted from the sorted
+// codes (Karras 2012), all steps running on thread_count threads (0 for one per processor).
+// The tree is worse than a top-down build but takes a fraction of the time, for geometry that is
+// rebuilt often. The top of the tree is rebuilt with the surface area heuristic over a cut of up
+// to sah_cut_size subtrees, 0 disables it.
+std::vector<Flat_BVH_Node> build_linear_bvh(const std::vector<Bounding_Box>& primitive_bounds,
+                                            int thread_count = 0, int sah_cut_size = 128);
@@ -1,190 +1,145 @@
 #include <algorithm>
-#include <array>
-#include <chrono>
-#include <iostream>
-#include <limits>
+#include <fstream>
 #include <memory>
-
-#include "bvh.h"
-#include "camera.h"
-#include "material.h"
-#include "perlin.h"
-#include "random.h"
-#include "sphere.h"
-#include "hitable_list.h"
-#include "scenes.h"
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "bvh_benchmark.h"
+#include "convergence_benchmark.h"
+#include "cpu_topology.h"
+#include "job.h"
+#include "service.h"
+#include "stats.h"
 #include "thread.h"
+#include "tiled_texture.h"
 
-Shape* light = new XZ_Rect(213, 343, 227, 332, 554, 0);
-Shape* glass_sphere = new Sphere(Vector(190, 90, 190), 90, nullptr);
-
-Shape* shapes_to_sample = nullptr;
-
-Vector trace_ray(RNG& rng, const Ray& ray, const Shape* world, Shape* light_shape, int depth)
+int main(int argc, char* argv[])
 {
-    Intersection hit;
-    if (world->hit(ray, 0.001f, std::numeric_limits<float>::max(), hit))
-    {
-        Vector emitted = hit.material->emitted(ray, hit, hit.u, hit.v, hit.p);
-        Scatter_Info scatter_info;
-        if (depth < 50 && hit.material->scatter(rng, ray, hit, scatter_info))
-        {
-            if (scatter_info.is_specular) {
-                return scatter_info.attenuation * trace_ray(rng, scatter_info.specular_ray, world, light_shape, depth + 1);
-            } else {
-                Shape_Pdf plight(light_shape, hit.p);
-                Mixture_Pdf p(&plight, scatter_info.pdf);
-
-                Ray scattered = Ray(hit.p, p.generate(rng), ray.time);
-                float pdf = p.value(scattered.direction);
-
-                delete scatter_info.pdf;
-
-                return emitted + 
-                    scatter_info.attenuation *
-                    hit.material->scattering_pdf(ray, hit, scattered) *
-                    trace_ray(rng, scattered, world, light_shape, depth + 1) / pdf;
+    // Leading options choose the processors of the threads: --cpus <count>, --numa-nodes <n,n,...>
+    // and --no-smt to leave the second logical processor of each core idle.
+    Processor_Selection processor_selection;
+    int option_count = 0;
+    while (option_count + 1 < argc) {
+        std::string option = argv[option_count + 1];
+        if (option == "--no-smt") {
+            processor_selection.use_smt_siblings = false;
+            option_count++;
+        } else if (option == "--cpus" && option_count + 2 < argc) {
+            processor_selection.max_processor_count = std::max(1, atoi(argv[option_count + 2]));
+            option_count += 2;
+        } else if (option == "--numa-nodes" && option_count + 2 < argc) {
+            for (const char* p = argv[option_count + 2]; *p; p++) {
+                if (p == argv[option_count + 2] || p[-1] == ',')
+                    processor_selection.numa_nodes.push_back(atoi(p));
             }
+            option_count += 2;
+        } else {
+            break;
         }
-        else
-            return emitted;
     }
-    else
-        return Vector(0);
-}
-
-class Render_Rect_Task : public Task {
-public:
-	Render_Rect_Task(
-        const Shape* world,
-        const Camera* camera,
-        int image_width,
-        int image_height,
-        int sample_count,
-        int x1, int y1, int x2, int y2,
-        std::vector<std::array<int, 3>>* results
-
-    )
-        : world(world)
-        , camera(camera)
-        , image_width(image_width)
-        , image_height(image_height)
-        , sample_count(sample_count)
-        , x1(x1), y1(y1), x2(x2), y2(y2)
-        , results(results)
-    {}
-
-	void run(RNG& rng) override {
-        for (int j = y1; j < y2; j++) {
-            for (int i = x1; i < x2; i++) {
-
-                Vector color(0.0f, 0.0f, 0.0f);
-
-                for (int s = 0; s < sample_count; s++) {
-                    float u = (float(i) + rng.random_float()) / float(image_width);
-                    float v = (float(j) + rng.random_float()) / float(image_height);
-
-                    Ray ray = camera->get_ray(rng, u, v);
-                    color += trace_ray(rng, ray, world, shapes_to_sample, 0);
-                }
-
-                color /= float(sample_count);
-
-                color[0] = clamp(color[0], 0, 1);
-                color[1] = clamp(color[1], 0, 1);
-                color[2] = clamp(color[2], 0, 1);
-                color = Vector(std::sqrt(color[0]), std::sqrt(color[1]), std::sqrt(color[2]));
-                
-                int ir = static_cast<int>(255.99 * color[0]);
-                int ig = static_cast<int>(255.99 * color[1]);
-                int ib = static_cast<int>(255.99 * color[2]);
-                (*results)[j * image_width + i] = {ir, ig, ib};
-            }
+    argv[option_count] = argv[0];
+    argv += option_count;
+    argc -= option_count;
+
+    if (argc == 4 && std::string(argv[1]) == "--convert-texture") {
+        if (!convert_to_tiled_texture(argv[2], argv[3])) {
+            fprintf(stderr, "failed to convert %s\n", argv[2]);
+            return 1;
         }
+        return 0;
     }
 
-private:
-    const Shape* world;
-	const Camera* camera;
-    int image_width, image_height;
-    int sample_count;
-	int x1, y1;
-	int	x2, y2;
-
-    std::vector<std::array<int, 3>>* results;
-};
-
-int main()
-{
-    const int nx = 1280;
-    const int ny = 720;
-    const int ns = 64;
-
-    float aspect = float(nx) / float(ny);
-
-    std::cout << "P3\n" << nx << " " << ny << "\n255\n";
-
-    RNG rng;
-    perlin_initialize(rng);
-
-    float time0 = 0.f;
-    float time1 = 1.f;
-
-    //Shape* world = random_scene(time0, time1);
-    //Shape* world = two_spheres();
-    //Shape* world = cornell_box();
-    //Shape* world = cornell_smoke(rng);
-    //Shape* world = final_scene(rng);
-
-    Shape* shapes[2] { light, glass_sphere };
-    shapes_to_sample = new HitableList(shapes, 2);
-
-    Scene scene = cornell_box(aspect);
+    // --bvh-benchmark [primitive count] compares the BVH variants on random spheres.
+    if ((argc == 2 || argc == 3) && std::string(argv[1]) == "--bvh-benchmark") {
+        run_bvh_benchmark(argc == 3 ? std::max(1, atoi(argv[2])) : 1000000);
+        return 0;
+    }
 
-    Timestamp t;
+    std::vector<Logical_Processor> processors = select_processors(get_cpu_topology(), processor_selection);
+    if (processors.empty()) {
+        fprintf(stderr, "no processors match the selection\n");
+        return 1;
+    }
 
-    //Vector lookFrom(478, 278, -600);
-    //Vector lookAt(278, 278, 0);
-    //float distToFocus = 10.0f;
-    //float apperture = 0.0f; //0.1f;
-    //float vfov = 40.0f;
-   
+    // The main thread commits the tasks from the first processor, the workers take the others.
+    std::vector<std::unique_ptr<Thread>> threads;
+	pin_thread(::GetCurrentThread(), processors[0]);
+	for (size_t i = 1; i < processors.size(); i++) {
+		threads.push_back(std::make_unique<Thread>(&processors[i]));
+	}
 
-    std::vector<std::array<int, 3>> result(nx * ny);
-    int size = 32;
+    // --convergence-benchmark [csv|json] [seconds per run] measures the error of the integrators over
+    // time against cached references of the canonical scenes.
+    if (argc >= 2 && argc <= 4 && std::string(argv[1]) == "--convergence-benchmark") {
+        Convergence_Benchmark_Settings settings;
+        if (argc >= 3 && std::string(argv[2]) == "json")
+            settings.format = Benchmark_Output_Format::json;
+        if (argc == 4)
+            settings.time_budget_seconds = std::max(0.1f, float(atof(argv[3])));
+        run_convergence_benchmark(settings, static_cast<int>(threads.size()));
+        return 0;
+    }
 
-    std::vector<Render_Rect_Task> tasks;
-    for (int y = 0; y < ny; y += size) {
-        for (int x = 0; x < nx; x += size) {
-            tasks.push_back(Render_Rect_Task(scene.shape, &scene.camera, nx, ny, ns, x, y, std::min(x + size, nx), std::min(y + size, ny), &result));
+    // --service <socket path> [scene memory budget in MB] keeps running and renders jobs sent over the socket.
+    if ((argc == 3 || argc == 4) && std::string(argv[1]) == "--service") {
+        size_t memory_budget_mb = (argc == 4) ? strtoull(argv[3], nullptr, 10) : 1024;
+        if (!run_render_service(argv[2], memory_budget_mb << 20, static_cast<int>(threads.size()))) {
+            fprintf(stderr, "failed to listen on %s\n", argv[2]);
+            return 1;
         }
+        return 0;
     }
 
-    std::vector<std::unique_ptr<Thread>> threads;
-    SYSTEM_INFO si;
-	::GetSystemInfo(&si);
-	int num_processors = si.dwNumberOfProcessors;
-	for (int i = 0; i < num_processors - 1; i++) {
-		threads.push_back(std::make_unique<Thread>(i));
-	}
-
-    for (auto& task : tasks) {
-		Thread::commit_task(&task);
-	}
-	Thread::wait_for_tasks();
+    // Otherwise the arguments describe one job with options named like the keys of Render_Job,
+    // e.g. --scene final_scene --spp 16 --tile-size 16 --output final.ppm, the image goes to stdout
+    // by default. --sequence <frame count> <output prefix> is short for --frames and --output.
+    // --jobs <file> renders the jobs of a file instead, one per line.
+    std::vector<Render_Job> jobs;
+    std::string error;
+    if (argc == 3 && std::string(argv[1]) == "--jobs") {
+        std::ifstream file(argv[2]);
+        if (!file) {
+            fprintf(stderr, "cannot read %s\n", argv[2]);
+            return 1;
+        }
+        if (!read_render_jobs(file, jobs, error)) {
+            fprintf(stderr, "%s: %s\n", argv[2], error.c_str());
+            return 1;
+        }
+    } else {
+        std::string text = "output=-";
+        for (int i = 1; i < argc; i++) {
+            std::string option = argv[i];
+            if (option == "--sequence" && i + 2 < argc) {
+                text += std::string(" frames=") + argv[i + 1] + " output=" + argv[i + 2];
+                i += 2;
+            } else if (option.compare(0, 2, "--") == 0 && i + 1 < argc) {
+                std::string key = option.substr(2);
+                std::replace(key.begin(), key.end(), '-', '_');
+                text += " " + key + "=" + argv[++i];
+            } else {
+                fprintf(stderr, "unexpected argument %s\n", argv[i]);
+                return 1;
+            }
+        }
 
-    for (int j = ny - 1; j >= 0; j--)
-    {
-        for (int i = 0; i < nx; i++)
-        {
-            int index = j * nx + i;
-            int ir = result[index][0];
-            int ig = result[index][1];
-            int ib = result[index][2];
-            std::cout << ir << " " << ig << " " << ib << "\n";
+        Render_Job job;
+        if (!parse_render_job(text, job, error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
         }
+        jobs.push_back(job);
     }
 
+    Timestamp t;
+    bool success = render_jobs(jobs, static_cast<int>(threads.size()));
+
     int64_t time = elapsed_milliseconds(t);
     fprintf(stderr, "Time = %.2fs\n", time / 1000.0f);
+
+#if ENABLE_STATS
+    print_stats_summary(merge_thread_stats());
+#endif
+    return success ? 0 : 1;
 }
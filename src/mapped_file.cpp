@@ -0,0 +1,57 @@
+#include "mapped_file.h"
+
+#define NOMINMAX
+#include <Windows.h>
+
+Mapped_File::Mapped_File()
+    : file(INVALID_HANDLE_VALUE)
+    , mapping(NULL)
+    , view(nullptr)
+    , size(0)
+{}
+
+Mapped_File::~Mapped_File() {
+    close();
+}
+
+bool Mapped_File::open(const std::string& file_name) {
+    close();
+
+    file = ::CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if (!::GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        close();
+        return false;
+    }
+    size = static_cast<size_t>(file_size.QuadPart);
+
+    mapping = ::CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        close();
+        return false;
+    }
+
+    view = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void Mapped_File::close() {
+    if (view)
+        ::UnmapViewOfFile(view);
+    if (mapping != NULL)
+        ::CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        ::CloseHandle(file);
+
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+    view = nullptr;
+    size = 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+class Mapped_File {
+public:
+    Mapped_File();
+    ~Mapped_File();
+
+    Mapped_File(const Mapped_File&) = delete;
+    Mapped_File& operator=(const Mapped_File&) = delete;
+
+    bool open(const std::string& file_name);
+    void close();
+
+    bool is_open() const { return view != nullptr; }
+    const unsigned char* get_data() const { return static_cast<const unsigned char*>(view); }
+    size_t get_size() const { return size; }
+
+private:
+    void* file;
+    void* mapping;
+    const void* view;
+    size_t size;
+};
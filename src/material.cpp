@@ -28,7 +28,7 @@ static float schlick(float cosine, float refractionIndex) {
 
 bool Lambertian::scatter(RNG& rng, const Ray& ray, const Intersection& hit, Scatter_Info& scatter_info) const {
     scatter_info.is_specular = false;
-    scatter_info.attenuation = albedo->value(hit.u, hit.v, hit.p);
+    scatter_info.attenuation = albedo->value(hit.u, hit.v, hit.p, hit.footprint);
     scatter_info.pdf = new Cosine_Pdf(hit.normal);
     return true;
 }
@@ -38,60 +38,74 @@ float Lambertian::scattering_pdf(const Ray& ray_in, const Intersection& isect, c
     return cosine / PI;
 }
 
+bool Lambertian::uses_footprint() const {
+    return albedo->uses_footprint();
+}
+
 bool Metal::scatter(RNG& rng, const Ray& ray, const Intersection& hit, Scatter_Info& scatter_info) const {
     Vector reflected = reflect(ray.direction, hit.normal);
-    scatter_info.specular_ray = Ray(hit.p, reflected + fuzz * random_point_in_unit_sphere(rng));
+    scatter_info.specular_ray = Ray(hit.p, (reflected + fuzz * random_point_in_unit_sphere(rng)).normalized(), ray.time);
     scatter_info.attenuation = albedo;
     scatter_info.is_specular = true;
     scatter_info.pdf = nullptr;
     return true;
 }
 
-//bool Dielectric::scatter(RNG& rng, const Ray& ray, const Intersection& hitRecord, Vector& attenuation, Ray& scatteredRay) const {
-//    Vector outwardNormal;
-//    Vector reflected = reflect(ray.direction, hitRecord.normal);
-//
-//    float n;
-//    attenuation = Vector(1.0, 1.0, 1.0);
-//    Vector refracted;
-//    float reflectProb;
-//    float cosine;
-//
-//    if (dot_product(ray.direction, hitRecord.normal) > 0.0f) {
-//        outwardNormal = -hitRecord.normal;
-//        n = refraction_index;
-//        cosine = dot_product(ray.direction, hitRecord.normal);
-//        cosine = sqrt(1 - refraction_index * refraction_index * (1 - cosine * cosine));
-//    } else {
-//        outwardNormal = hitRecord.normal;
-//        n = 1.0f / refraction_index;
-//        cosine = -dot_product(ray.direction, hitRecord.normal);
-//    }
-//
-//    if (refract(ray.direction, outwardNormal, n, refracted)) {
-//        reflectProb = schlick(cosine, refraction_index);
-//    } else {
-//        reflectProb = 1.0f;
-//    }
-//
-//    if (rng.random_float() < reflectProb) {
-//        scatteredRay = Ray(hitRecord.p, reflected, ray.time);
-//    } else {
-//        scatteredRay = Ray(hitRecord.p, refracted, ray.time);
-//    }
-//
-//    return true;
-//}
+bool Dielectric::scatter(RNG& rng, const Ray& ray, const Intersection& hit, Scatter_Info& scatter_info) const {
+    Vector outward_normal;
+    Vector reflected = reflect(ray.direction, hit.normal);
+
+    float n;
+    Vector refracted(0);
+    float reflect_prob;
+    float cosine;
+
+    if (dot_product(ray.direction, hit.normal) > 0.0f) {
+        outward_normal = -hit.normal;
+        n = refraction_index;
+        cosine = dot_product(ray.direction.normalized(), hit.normal);
+        cosine = std::sqrt(std::max(0.f, 1 - refraction_index * refraction_index * (1 - cosine * cosine)));
+    } else {
+        outward_normal = hit.normal;
+        n = 1.0f / refraction_index;
+        cosine = -dot_product(ray.direction.normalized(), hit.normal);
+    }
+
+    if (refract(ray.direction, outward_normal, n, refracted)) {
+        reflect_prob = schlick(cosine, refraction_index);
+    } else {
+        reflect_prob = 1.0f;
+    }
+
+    if (rng.random_float() < reflect_prob) {
+        scatter_info.specular_ray = Ray(hit.p, reflected, ray.time);
+    } else {
+        scatter_info.specular_ray = Ray(hit.p, refracted, ray.time);
+    }
+    scatter_info.attenuation = Vector(1.0f);
+    scatter_info.is_specular = true;
+    scatter_info.pdf = nullptr;
+    return true;
+}
 
 Vector Diffuse_Light::emitted(const Ray& ray_in, const Intersection& isect, float u, float v, const Vector& p) const {
     if (dot_product(ray_in.direction, isect.normal) < 0.f)
-        return emit->value(u, v, p);
+        return emit->value(u, v, p, isect.footprint);
     else
         return Vector(0);
 }
 
-//bool Isotropic::scatter(RNG& rng, const Ray& ray, const Intersection& hit, Vector& attenuation, Ray& scattered_ray) const {
-//    scattered_ray = Ray(hit.p, random_point_in_unit_sphere(rng));
-//    attenuation = albedo->value(hit.u, hit.v, hit.p);
-//    return true;
-//}
+bool Diffuse_Light::uses_footprint() const {
+    return emit->uses_footprint();
+}
+
+bool Isotropic::scatter(RNG& rng, const Ray& ray, const Intersection& hit, Scatter_Info& scatter_info) const {
+    scatter_info.is_specular = false;
+    scatter_info.attenuation = albedo->value(hit.u, hit.v, hit.p, hit.footprint);
+    scatter_info.pdf = new Uniform_Sphere_Pdf;
+    return true;
+}
+
+float Isotropic::scattering_pdf(const Ray& ray_in, const Intersection& isect, const Ray& scattered_ray) const {
+    return 1.f / (4.f * PI);
+}
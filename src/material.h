@@ -51,6 +51,16 @@ public:
     Vector origin;
 };
 
+class Uniform_Sphere_Pdf : public Pdf {
+public:
+    float value(const Vector& direction) const override {
+        return 1.f / (4.f * PI);
+    }
+    Vector generate(RNG& rng) const override {
+        return random_unit_vector(rng);
+    }
+};
+
 class Mixture_Pdf : public Pdf {
 public:
     Mixture_Pdf(Pdf* p0, Pdf* p1)
@@ -77,7 +87,7 @@ struct Scatter_Info {
     Pdf* pdf;
 };
 
-class Material {
+class Material : public Scene_Object {
 public:
     virtual bool scatter(RNG& rng, const Ray& ray, const Intersection& hit, Scatter_Info& scatter_info) const {
         return false;
@@ -88,6 +98,10 @@ public:
     virtual Vector emitted(const Ray& ray_in, const Intersection& isect, float u, float v, const Vector& p) const {
         return Vector(0);
     }
+
+    // Used to specialize the render kernel on the features a scene needs.
+    virtual bool is_emissive() const { return false; }
+    virtual bool uses_footprint() const { return false; }
 };
 
 class Lambertian : public Material {
@@ -95,6 +109,7 @@ public:
     Lambertian(Texture* albedo) : albedo(albedo) {}
     bool scatter(RNG& rng, const Ray& ray, const Intersection& hit,  Scatter_Info& scatter_info) const override;
     float scattering_pdf(const Ray& ray_in, const Intersection& isect, const Ray& scattered_ray) const override;
+    bool uses_footprint() const override;
 
 private:
     Texture* albedo;
@@ -110,15 +125,15 @@ private:
     float fuzz;
 };
 
-//class Dielectric : public Material {
-//public:
-//    Dielectric(float ri) : refraction_index(ri) {}
-//    bool scatter(RNG& rng, const Ray& ray, const Intersection& hit, Vector& attenuation, Ray& scattered_ray) const override;
-//
-//private:
-//    float refraction_index;
-//};
-//
+class Dielectric : public Material {
+public:
+    Dielectric(float ri) : refraction_index(ri) {}
+    bool scatter(RNG& rng, const Ray& ray, const Intersection& hit, Scatter_Info& scatter_info) const override;
+
+private:
+    float refraction_index;
+};
+
 class Diffuse_Light : public Material {
 public:
     Diffuse_Light(Texture* emit) : emit(emit) {}
@@ -128,16 +143,20 @@ public:
     }
 
     Vector emitted(const Ray& ray_in, const Intersection& isect, float u, float v, const Vector& p) const override;
+    bool is_emissive() const override { return true; }
+    bool uses_footprint() const override;
 
 private:
     Texture* emit;
 };
-//
-//class Isotropic : public Material {
-//public:
-//    Isotropic(Texture *a) : albedo(a) {}
-//    bool scatter(RNG& rng, const Ray& ray, const Intersection& hit, Vector& attenuation, Ray& scattered_ray) const override;
-//
-//private:
-//    Texture *albedo;
-//};
+
+// Phase function of participating media.
+class Isotropic : public Material {
+public:
+    Isotropic(Texture *a) : albedo(a) {}
+    bool scatter(RNG& rng, const Ray& ray, const Intersection& hit, Scatter_Info& scatter_info) const override;
+    float scattering_pdf(const Ray& ray_in, const Intersection& isect, const Ray& scattered_ray) const override;
+
+private:
+    Texture *albedo;
+};
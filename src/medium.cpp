@@ -0,0 +1,252 @@
+#include "medium.h"
+#include "material.h"
+#include "perlin.h"
+#include "random.h"
+#include "shape.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+static float sample_exponential(RNG& rng, float sigma) {
+    return -std::log(1.f - rng.random_float()) / sigma;
+}
+
+Medium::Medium(Texture* albedo, bool absorbing_only)
+    : phase_function(new Isotropic(albedo))
+    , absorbing_only(absorbing_only)
+{}
+
+Homogeneous_Medium::Homogeneous_Medium(Shape* boundary, float density, Texture* albedo, bool absorbing_only)
+    : Medium(albedo, absorbing_only)
+    , boundary(boundary)
+    , boundary_box(boundary->boudning_box(0, 1))
+    , density(density)
+{}
+
+bool Homogeneous_Medium::get_interval(const Ray& ray, float t_min, float t_max, float& t0, float& t1) const {
+    // Cheap box test first, most rays never come close to the medium.
+    if (!boundary_box.intersect(ray, t_min, t_max))
+        return false;
+
+    Ray_Hit hit1, hit2;
+    if (!boundary->hit(ray, -FLT_MAX, FLT_MAX, hit1))
+        return false;
+    if (!boundary->hit(ray, hit1.t + 1e-4f, FLT_MAX, hit2))
+        return false;
+
+    t0 = std::max(hit1.t, t_min);
+    t1 = std::min(hit2.t, t_max);
+    return t0 < t1;
+}
+
+bool Homogeneous_Medium::sample_scattering(RNG& rng, const Ray& ray, float t_min, float t_max, float& t) const {
+    float t0, t1;
+    if (!get_interval(ray, t_min, t_max, t0, t1))
+        return false;
+
+    float distance = sample_exponential(rng, density) / ray.direction.length();
+    if (t0 + distance >= t1)
+        return false;
+
+    t = t0 + distance;
+    return true;
+}
+
+float Homogeneous_Medium::transmittance(RNG& rng, const Ray& ray, float t_min, float t_max) const {
+    float t0, t1;
+    if (!get_interval(ray, t_min, t_max, t0, t1))
+        return 1.f;
+    return std::exp(-density * (t1 - t0) * ray.direction.length());
+}
+
+Grid_Medium::Grid_Medium(const Bounding_Box& bounds, int nx, int ny, int nz, std::vector<float> densities,
+                         float density_scale, Texture* albedo, bool absorbing_only)
+    : Medium(albedo, absorbing_only)
+    , bounds(bounds)
+    , densities(std::move(densities))
+    , density_scale(density_scale)
+{
+    size[0] = nx;
+    size[1] = ny;
+    size[2] = nz;
+
+    for (int i = 0; i < 3; i++)
+        majorant_size[i] = (size[i] - 1 + Majorant_Block_Size - 1) / Majorant_Block_Size;
+
+    // A block covers the voxel cells [b*N, (b+1)*N); the trilinear density inside it
+    // is bounded by the grid values at the corners of these cells.
+    majorants.resize(majorant_size[0] * majorant_size[1] * majorant_size[2]);
+    add_memory_usage((this->densities.size() + majorants.size()) * sizeof(float));
+    for (int bz = 0; bz < majorant_size[2]; bz++) {
+        for (int by = 0; by < majorant_size[1]; by++) {
+            for (int bx = 0; bx < majorant_size[0]; bx++) {
+                float max_density = 0.f;
+                for (int z = bz * Majorant_Block_Size; z <= std::min((bz + 1) * Majorant_Block_Size, size[2] - 1); z++)
+                    for (int y = by * Majorant_Block_Size; y <= std::min((by + 1) * Majorant_Block_Size, size[1] - 1); y++)
+                        for (int x = bx * Majorant_Block_Size; x <= std::min((bx + 1) * Majorant_Block_Size, size[0] - 1); x++)
+                            max_density = std::max(max_density, this->densities[(z * size[1] + y) * size[0] + x]);
+
+                majorants[(bz * majorant_size[1] + by) * majorant_size[0] + bx] = max_density * density_scale;
+            }
+        }
+    }
+}
+
+float Grid_Medium::get_density(const Vector& p) const {
+    Vector extent = bounds.max_point - bounds.min_point;
+    int i[3];
+    float f[3];
+    for (int c = 0; c < 3; c++) {
+        float g = clamp((p[c] - bounds.min_point[c]) / extent[c], 0.f, 1.f) * (size[c] - 1);
+        i[c] = std::min(static_cast<int>(g), size[c] - 2);
+        f[c] = g - i[c];
+    }
+
+    auto at = [this](int x, int y, int z) {
+        return densities[(z * size[1] + y) * size[0] + x];
+    };
+
+    float c00 = at(i[0], i[1], i[2])         * (1 - f[0]) + at(i[0] + 1, i[1], i[2])         * f[0];
+    float c10 = at(i[0], i[1] + 1, i[2])     * (1 - f[0]) + at(i[0] + 1, i[1] + 1, i[2])     * f[0];
+    float c01 = at(i[0], i[1], i[2] + 1)     * (1 - f[0]) + at(i[0] + 1, i[1], i[2] + 1)     * f[0];
+    float c11 = at(i[0], i[1] + 1, i[2] + 1) * (1 - f[0]) + at(i[0] + 1, i[1] + 1, i[2] + 1) * f[0];
+
+    float c0 = c00 * (1 - f[1]) + c10 * f[1];
+    float c1 = c01 * (1 - f[1]) + c11 * f[1];
+    return density_scale * (c0 * (1 - f[2]) + c1 * f[2]);
+}
+
+// Calls segment_function(segment_t0, segment_t1, majorant) for the majorant blocks along
+// the ray in order, until the function returns false or the ray leaves [t0, t1].
+template <typename Segment_Function>
+void Grid_Medium::traverse_majorants(const Ray& ray, float t0, float t1, Segment_Function segment_function) const {
+    Vector extent = bounds.max_point - bounds.min_point;
+
+    int block[3], step[3];
+    float next_t[3], delta_t[3];
+    for (int c = 0; c < 3; c++) {
+        float block_extent = extent[c] / (size[c] - 1) * Majorant_Block_Size;
+        float p = ray.origin[c] + t0 * ray.direction[c] - bounds.min_point[c];
+        block[c] = std::min(std::max(static_cast<int>(p / block_extent), 0), majorant_size[c] - 1);
+
+        if (ray.direction[c] == 0.f) {
+            step[c] = 0;
+            next_t[c] = FLT_MAX;
+            delta_t[c] = FLT_MAX;
+        } else if (ray.direction[c] > 0.f) {
+            step[c] = 1;
+            delta_t[c] = block_extent / ray.direction[c];
+            next_t[c] = t0 + ((block[c] + 1) * block_extent - p) / ray.direction[c];
+        } else {
+            step[c] = -1;
+            delta_t[c] = -block_extent / ray.direction[c];
+            next_t[c] = t0 + (block[c] * block_extent - p) / ray.direction[c];
+        }
+    }
+
+    float t = t0;
+    while (t < t1) {
+        int axis = (next_t[0] < next_t[1]) ? (next_t[0] < next_t[2] ? 0 : 2) : (next_t[1] < next_t[2] ? 1 : 2);
+        float segment_end = std::min(next_t[axis], t1);
+
+        float majorant = majorants[(block[2] * majorant_size[1] + block[1]) * majorant_size[0] + block[0]];
+        if (!segment_function(t, segment_end, majorant))
+            return;
+
+        t = segment_end;
+        block[axis] += step[axis];
+        if (block[axis] < 0 || block[axis] >= majorant_size[axis])
+            return;
+        next_t[axis] += delta_t[axis];
+    }
+}
+
+bool Grid_Medium::sample_scattering(RNG& rng, const Ray& ray, float t_min, float t_max, float& t) const {
+    float t0, t1;
+    if (!bounds.intersect(ray, t_min, t_max, t0, t1))
+        return false;
+
+    float direction_length = ray.direction.length();
+    bool scattered = false;
+
+    traverse_majorants(ray, t0, t1, [&](float segment_t0, float segment_t1, float majorant) {
+        if (majorant <= 0.f)
+            return true;
+
+        float sample_t = segment_t0;
+        while (true) {
+            sample_t += sample_exponential(rng, majorant) / direction_length;
+            if (sample_t >= segment_t1)
+                return true;
+
+            // Real collision with probability density / majorant, null collision otherwise.
+            if (rng.random_float() * majorant < get_density(ray.PointAtParameter(sample_t))) {
+                t = sample_t;
+                scattered = true;
+                return false;
+            }
+        }
+    });
+    return scattered;
+}
+
+float Grid_Medium::transmittance(RNG& rng, const Ray& ray, float t_min, float t_max) const {
+    float t0, t1;
+    if (!bounds.intersect(ray, t_min, t_max, t0, t1))
+        return 1.f;
+
+    float direction_length = ray.direction.length();
+    float result = 1.f;
+
+    traverse_majorants(ray, t0, t1, [&](float segment_t0, float segment_t1, float majorant) {
+        if (majorant <= 0.f)
+            return true;
+
+        float sample_t = segment_t0;
+        while (true) {
+            sample_t += sample_exponential(rng, majorant) / direction_length;
+            if (sample_t >= segment_t1)
+                return true;
+
+            result *= 1.f - get_density(ray.PointAtParameter(sample_t)) / majorant;
+
+            // Russian roulette on low transmittance keeps the estimator unbiased.
+            if (result < 0.1f) {
+                if (rng.random_float() < 0.5f)
+                    return (result = 0.f), false;
+                result *= 2.f;
+            }
+        }
+    });
+    return result;
+}
+
+Grid_Medium* create_noise_medium(const Perlin& perlin, const Bounding_Box& bounds, int resolution,
+                                 float noise_scale, float density_scale, Texture* albedo)
+{
+    Vector extent = bounds.max_point - bounds.min_point;
+    float max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+
+    int size[3];
+    for (int c = 0; c < 3; c++)
+        size[c] = std::max(2, static_cast<int>(resolution * extent[c] / max_extent));
+
+    std::vector<float> densities(size[0] * size[1] * size[2]);
+    for (int z = 0; z < size[2]; z++) {
+        for (int y = 0; y < size[1]; y++) {
+            for (int x = 0; x < size[0]; x++) {
+                Vector local(x / float(size[0] - 1), y / float(size[1] - 1), z / float(size[2] - 1));
+                Vector p = bounds.min_point + local * extent;
+
+                // 1 in the center, 0 at the boundary.
+                Vector d = 2.f * local - Vector(1);
+                float falloff = std::max(0.f, 1.f - d.squared_length());
+
+                float noise = perlin.turbulence(noise_scale * p);
+                densities[(z * size[1] + y) * size[0] + x] = std::max(0.f, falloff * (2.f * noise - 0.3f));
+            }
+        }
+    }
+    return new Grid_Medium(bounds, size[0], size[1], size[2], std::move(densities), density_scale, albedo);
+}
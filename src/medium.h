@@ -0,0 +1,84 @@
+#pragma once
+
+#include "bounding_box.h"
+#include "scene_resources.h"
+
+#include <vector>
+
+class Material;
+class Perlin;
+class RNG;
+class Shape;
+class Texture;
+
+// Participating medium. Media are not shapes: the integrator samples a free-flight distance
+// in every medium the ray passes through and scatters at the closest event before the surface hit.
+class Medium : public Scene_Object {
+public:
+    Medium(Texture* albedo, bool absorbing_only);
+    virtual ~Medium() {}
+
+    // Samples a collision along the ray in [t_min, t_max] (delta tracking).
+    // Returns true and the collision distance if the ray scatters before t_max.
+    virtual bool sample_scattering(RNG& rng, const Ray& ray, float t_min, float t_max, float& t) const = 0;
+
+    // Transmittance along the ray in [t_min, t_max] (ratio tracking for heterogeneous media).
+    virtual float transmittance(RNG& rng, const Ray& ray, float t_min, float t_max) const = 0;
+
+    // Media with zero albedo never scatter light, the integrator only attenuates by their
+    // transmittance instead of sampling collisions that would terminate the path.
+    bool is_absorbing_only() const { return absorbing_only; }
+    Material* get_phase_function() const { return phase_function; }
+
+private:
+    Material* phase_function;
+    bool absorbing_only;
+};
+
+// Constant density inside a convex boundary shape.
+class Homogeneous_Medium : public Medium {
+public:
+    Homogeneous_Medium(Shape* boundary, float density, Texture* albedo, bool absorbing_only = false);
+
+    bool sample_scattering(RNG& rng, const Ray& ray, float t_min, float t_max, float& t) const override;
+    float transmittance(RNG& rng, const Ray& ray, float t_min, float t_max) const override;
+
+private:
+    bool get_interval(const Ray& ray, float t_min, float t_max, float& t0, float& t1) const;
+
+    Shape* boundary;
+    Bounding_Box boundary_box;
+    float density;
+};
+
+// Density defined on a regular grid over a box, trilinearly interpolated. A coarse majorant grid
+// stores the maximum density per block of voxels; tracking walks it with a 3D DDA, skips empty
+// blocks entirely and takes steps sized by the local majorant instead of the global maximum.
+class Grid_Medium : public Medium {
+public:
+    Grid_Medium(const Bounding_Box& bounds, int nx, int ny, int nz, std::vector<float> densities,
+                float density_scale, Texture* albedo, bool absorbing_only = false);
+
+    bool sample_scattering(RNG& rng, const Ray& ray, float t_min, float t_max, float& t) const override;
+    float transmittance(RNG& rng, const Ray& ray, float t_min, float t_max) const override;
+
+    float get_density(const Vector& p) const;
+
+    static const int Majorant_Block_Size = 8;
+
+private:
+    template <typename Segment_Function>
+    void traverse_majorants(const Ray& ray, float t0, float t1, Segment_Function segment_function) const;
+
+    Bounding_Box bounds;
+    int size[3];
+    std::vector<float> densities;
+    float density_scale;
+
+    int majorant_size[3];
+    std::vector<float> majorants;
+};
+
+// Smoke-like density grid from Perlin turbulence that fades out towards the box boundary.
+Grid_Medium* create_noise_medium(const Perlin& perlin, const Bounding_Box& bounds, int resolution,
+                                 float noise_scale, float density_scale, Texture* albedo);
@@ -0,0 +1,280 @@
+#include "motion_bvh.h"
+#include "bvh.h"
+#include "random.h"
+#include "simd_vector.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace {
+// A node is split in time when the interpolated bounds in the middle of its interval
+// have this much more surface area than the actual bounds of its primitives at that time.
+const float Time_Split_Threshold = 1.5f;
+
+Bounding_Box lerp(const Bounding_Box& box0, const Bounding_Box& box1, float t) {
+    return Bounding_Box(
+        (1.f - t) * box0.min_point + t * box1.min_point,
+        (1.f - t) * box0.max_point + t * box1.max_point);
+}
+
+struct Build_Primitive {
+    Shape* shape;
+    Bounding_Box bounds;
+};
+
+void sort_along_axis(std::vector<Build_Primitive>& primitives, int axis) {
+    std::sort(primitives.begin(), primitives.end(), [axis](const Build_Primitive& a, const Build_Primitive& b) {
+        return a.bounds.min_point[axis] + a.bounds.max_point[axis] < b.bounds.min_point[axis] + b.bounds.max_point[axis];
+    });
+}
+
+bool is_moving(const Shape* shape, float time0, float time1) {
+    Bounding_Box b0 = shape->boudning_box(time0, time0);
+    Bounding_Box b1 = shape->boudning_box(time1, time1);
+    for (int i = 0; i < 3; i++) {
+        if (b0.min_point[i] != b1.min_point[i] || b0.max_point[i] != b1.max_point[i])
+            return true;
+    }
+    return false;
+}
+
+// Linear bounds of a child over [time0, time1]. Children are either primitives with linear
+// motion or nodes built over the same interval, which may themselves be split in time.
+void get_child_linear_bounds(const Shape* child, const Motion_BVH_Node* child_node, float time0, float time1,
+                             Bounding_Box& bounds0, Bounding_Box& bounds1)
+{
+    if (child_node) {
+        child_node->get_linear_bounds(bounds0, bounds1);
+    } else {
+        bounds0 = child->boudning_box(time0, time0);
+        bounds1 = child->boudning_box(time1, time1);
+    }
+}
+}
+
+Motion_BVH_Node::Motion_BVH_Node(Shape** shapes, int n, float time0, float time1, int time_split_budget)
+    : time0(time0)
+    , time1(time1)
+    , inv_duration(time1 > time0 ? 1.f / (time1 - time0) : 0.f)
+    , time_split(false)
+    , time_split_point(0.5f * (time0 + time1))
+    , node_children(n > 2)
+{
+    float time_mid = time_split_point;
+
+    Bounding_Box start_bounds, end_bounds, mid_bounds;
+    for (int i = 0; i < n; i++) {
+        start_bounds = Bounding_Box::get_union(start_bounds, shapes[i]->boudning_box(time0, time0));
+        end_bounds = Bounding_Box::get_union(end_bounds, shapes[i]->boudning_box(time1, time1));
+        mid_bounds = Bounding_Box::get_union(mid_bounds, shapes[i]->boudning_box(time_mid, time_mid));
+    }
+
+    float interpolated_area = lerp(start_bounds, end_bounds, 0.5f).surface_area();
+    if (n > 1 && time_split_budget > 0 && interpolated_area > Time_Split_Threshold * mid_bounds.surface_area()) {
+        time_split = true;
+        node_children = true;
+        // The second half gets its own copy of the primitive references since the builder reorders them.
+        // The nodes keep the primitives, not the array, so the copy is only needed while building.
+        std::vector<Shape*> second(shapes, shapes + n);
+
+        left = new Motion_BVH_Node(shapes, n, time0, time_mid, time_split_budget - 1);
+        right = new Motion_BVH_Node(second.data(), n, time_mid, time1, time_split_budget - 1);
+        update_bounds();
+        return;
+    }
+
+    // Median split along the axis whose halves have the least surface area in the middle of the
+    // interval. A random axis as in BVH_Node, or the one with the largest extent, can be an axis
+    // along which the primitives mostly differ by how far they have moved (or that one large
+    // primitive stretches), and splitting along it scatters neighbors over the whole tree.
+    if (n > 2) {
+        std::vector<Build_Primitive> primitives(n);
+        for (int i = 0; i < n; i++)
+            primitives[i] = Build_Primitive{shapes[i], shapes[i]->boudning_box(time_mid, time_mid)};
+
+        int best_axis = 0;
+        float best_area = std::numeric_limits<float>::infinity();
+        for (int axis = 0; axis < 3; axis++) {
+            sort_along_axis(primitives, axis);
+            Bounding_Box first_half, second_half;
+            for (int i = 0; i < n; i++) {
+                Bounding_Box& half = (i < n/2) ? first_half : second_half;
+                half = Bounding_Box::get_union(half, primitives[i].bounds);
+            }
+            float area = first_half.surface_area() + second_half.surface_area();
+            if (area < best_area) {
+                best_area = area;
+                best_axis = axis;
+            }
+        }
+        if (best_axis != 2)
+            sort_along_axis(primitives, best_axis);
+        for (int i = 0; i < n; i++)
+            shapes[i] = primitives[i].shape;
+    }
+
+    if (n == 1) {
+        left = right = shapes[0];
+    } else if (n == 2) {
+        left = shapes[0];
+        right = shapes[1];
+    } else {
+        left = new Motion_BVH_Node(shapes, n/2, time0, time1, time_split_budget);
+        right = new Motion_BVH_Node(shapes + n/2, n - n/2, time0, time1, time_split_budget);
+    }
+    update_bounds();
+}
+
+void Motion_BVH_Node::update_bounds() {
+    if (time_split) {
+        get_linear_bounds(box0, box1);
+        return;
+    }
+
+    const Motion_BVH_Node* left_node = node_children ? static_cast<const Motion_BVH_Node*>(left) : nullptr;
+    const Motion_BVH_Node* right_node = node_children ? static_cast<const Motion_BVH_Node*>(right) : nullptr;
+
+    Bounding_Box left0, left1, right0, right1;
+    get_child_linear_bounds(left, left_node, time0, time1, left0, left1);
+    get_child_linear_bounds(right, right_node, time0, time1, right0, right1);
+    box0 = Bounding_Box::get_union(left0, right0);
+    box1 = Bounding_Box::get_union(left1, right1);
+
+    for (int i = 0; i < 3; i++) {
+        interpolation_rows[0][i] = box0.min_point[i];
+        interpolation_rows[1][i] = box0.max_point[i];
+        interpolation_rows[2][i] = box1.min_point[i] - box0.min_point[i];
+        interpolation_rows[3][i] = box1.max_point[i] - box0.max_point[i];
+    }
+    for (int i = 0; i < 4; i++)
+        interpolation_rows[i][3] = 0.f;
+}
+
+void Motion_BVH_Node::refit() {
+    left->refit();
+    if (right != left)
+        right->refit();
+    update_bounds();
+}
+
+float Motion_BVH_Node::get_sah_cost() const {
+    float cost = left->get_sah_cost();
+    if (right != left)
+        cost += right->get_sah_cost();
+    // Split nodes cost nothing to traverse, rays go straight to one half.
+    if (!time_split)
+        cost += box0.surface_area() + box1.surface_area();
+    return cost;
+}
+
+void Motion_BVH_Node::get_features(Shape_Features& features) const {
+    left->get_features(features);
+    if (right != left)
+        right->get_features(features);
+}
+
+void Motion_BVH_Node::create_node_replica(int node) {
+    left->create_node_replica(node);
+    if (right != left)
+        right->create_node_replica(node);
+}
+
+void Motion_BVH_Node::set_parent_transform(const Shape_Transform* transform) {
+    left->set_parent_transform(transform);
+    if (right != left)
+        right->set_parent_transform(transform);
+}
+
+void Motion_BVH_Node::get_linear_bounds(Bounding_Box& bounds0, Bounding_Box& bounds1) const {
+    if (!time_split) {
+        bounds0 = box0;
+        bounds1 = box1;
+        return;
+    }
+
+    // The children bound the motion piecewise linearly with a kink at the split point.
+    // Start from the bounds at both ends and move both ends out by how much the kink
+    // sticks out of the straight line between them.
+    const Motion_BVH_Node* first = static_cast<const Motion_BVH_Node*>(left);
+    const Motion_BVH_Node* second = static_cast<const Motion_BVH_Node*>(right);
+
+    Bounding_Box first0, first1, second0, second1;
+    first->get_linear_bounds(first0, first1);
+    second->get_linear_bounds(second0, second1);
+
+    Bounding_Box mid = Bounding_Box::get_union(first1, second0);
+    float t = (time_split_point - time0) / (time1 - time0);
+    Bounding_Box line = lerp(first0, second1, t);
+
+    bounds0 = first0;
+    bounds1 = second1;
+    for (int i = 0; i < 3; i++) {
+        float min_excess = std::max(0.f, line.min_point[i] - mid.min_point[i]);
+        float max_excess = std::max(0.f, mid.max_point[i] - line.max_point[i]);
+        bounds0.min_point[i] -= min_excess;
+        bounds1.min_point[i] -= min_excess;
+        bounds0.max_point[i] += max_excess;
+        bounds1.max_point[i] += max_excess;
+    }
+}
+
+Bounding_Box Motion_BVH_Node::get_bounds(float time) const {
+    float t = (time1 > time0) ? (time - time0) / (time1 - time0) : 0.f;
+    t = std::min(std::max(t, 0.f), 1.f);
+    return lerp(box0, box1, t);
+}
+
+bool Motion_BVH_Node::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const {
+    STATS_INCREMENT(bvh_nodes_visited);
+
+    if (time_split) {
+        const Shape* child = ray.time < time_split_point ? left : right;
+        return child->hit(ray, t_min, t_max, hit_record);
+    }
+
+    // Interpolated in registers, this runs for every node a ray visits.
+    STATS_INCREMENT(box_tests);
+    SIMD_Vector t(std::min(std::max((ray.time - time0) * inv_duration, 0.f), 1.f));
+    SIMD_Vector min_point = SIMD_Vector::load4(interpolation_rows[0]) + t * SIMD_Vector::load4(interpolation_rows[2]);
+    SIMD_Vector max_point = SIMD_Vector::load4(interpolation_rows[1]) + t * SIMD_Vector::load4(interpolation_rows[3]);
+    SIMD_Vector inv_dir = SIMD_Vector(1.f) / SIMD_Vector(ray.direction);
+    float box_t_min = t_min, box_t_max = t_max;
+    if (!intersect_slabs(min_point, max_point, SIMD_Vector(ray.origin), inv_dir, box_t_min, box_t_max))
+        return false;
+
+    Ray_Hit left_hit_record;
+    bool left_hit = left->hit(ray, t_min, t_max, left_hit_record);
+
+    Ray_Hit right_hit_record;
+    bool right_hit = right->hit(ray, t_min, left_hit ? left_hit_record.t : t_max, right_hit_record);
+
+    if (right_hit) {
+        hit_record = right_hit_record;
+        return true;
+    }
+    if (left_hit) {
+        hit_record = left_hit_record;
+        return true;
+    }
+    return false;
+}
+
+Bounding_Box Motion_BVH_Node::boudning_box(float t0, float t1) const {
+    Bounding_Box bounds = Bounding_Box::get_union(get_bounds(t0), get_bounds(t1));
+    if (t0 < time_split_point && t1 > time_split_point)
+        bounds = Bounding_Box::get_union(bounds, get_bounds(time_split_point));
+    return bounds;
+}
+
+Shape* build_bvh(RNG& rng, Shape** shapes, int n, float time0, float time1) {
+    bool moving = false;
+    for (int i = 0; i < n && !moving; i++)
+        moving = is_moving(shapes[i], time0, time1);
+
+    if (moving)
+        return new Motion_BVH_Node(shapes, n, time0, time1);
+    else
+        return new BVH_Node(rng, shapes, n, time0, time1);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "bounding_box.h"
+#include "shape.h"
+
+class RNG;
+
+// BVH for scenes with moving primitives. Each node stores its bounds at the start and at the
+// end of its time interval and traversal interpolates them at ray.time, so a fast-moving
+// primitive only bloats a node by how far it moves during the ray's time neighborhood
+// instead of by its whole swept volume.
+//
+// Where interpolated bounds are still loose (primitives moving in different directions),
+// temporal split nodes divide the time interval in two halves and build a separate subtree
+// for each half; rays descend into the half that contains their time.
+class Motion_BVH_Node : public Shape {
+public:
+    Motion_BVH_Node(Shape** shapes, int n, float time0, float time1, int time_split_budget = Max_Time_Splits);
+
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const override;
+    Bounding_Box boudning_box(float t0, float t1) const override;
+
+    void refit() override;
+    float get_sah_cost() const override;
+    void get_features(Shape_Features& features) const override;
+    void create_node_replica(int node) override;
+    void set_parent_transform(const Shape_Transform* transform) override;
+
+    // Bounds that are conservative when linearly interpolated over the node's time interval.
+    void get_linear_bounds(Bounding_Box& bounds0, Bounding_Box& bounds1) const;
+
+    static const int Max_Time_Splits = 4;
+
+private:
+    Bounding_Box get_bounds(float time) const;
+    void update_bounds();
+
+private:
+    Shape* left;
+    Shape* right;
+
+    Bounding_Box box0;
+    Bounding_Box box1;
+    float time0, time1;
+    float inv_duration;
+    // box0 and the change to box1 as rows of four floats (min, max, min change, max change) for
+    // unaligned SSE loads, nodes are not allocated 16-byte aligned.
+    float interpolation_rows[4][4];
+
+    bool time_split;
+    float time_split_point;
+    // Children are Motion_BVH_Nodes rather than primitives.
+    bool node_children;
+};
+
+// Builds a Motion_BVH_Node if any of the shapes moves during [time0, time1] and a BVH_Node otherwise.
+Shape* build_bvh(RNG& rng, Shape** shapes, int n, float time0, float time1);
@@ -0,0 +1,260 @@
+#include "path_guiding.h"
+#include "random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+const int Cell_Coordinate_Bits = 19;
+const uint64_t Cell_Coordinate_Mask = (uint64_t(1) << Cell_Coordinate_Bits) - 1;
+
+// Share of the uniform distribution in every cell, so that directions with few records so far
+// are still sampled now and then.
+const float Uniform_Fraction = 0.05f;
+// Blocks of bins with less energy than this share of the cell are merged, like the leaves of the
+// directional quadtree of practical path guiding. It keeps single noisy records from making spikes.
+const float Subdivision_Threshold = 0.01f;
+
+const size_t Max_Buffered_Record_Count = 4096;
+
+struct Guiding_Record {
+    // Of the cells of all levels, the shard is the one of the finest cell.
+    uint64_t keys[Guiding_Field::Level_Count];
+    int shard_index;
+    int bin;
+    float value;
+};
+
+// Records of the current task of the thread, a thread renders for one field at a time.
+thread_local std::vector<Guiding_Record> buffered_records;
+thread_local std::vector<Guiding_Record> sorted_record_buffer;
+
+// Dominant axis and its sign of the normal, like the cells of the radiance cache, so that the
+// faces of a box corner learn their own hemisphere.
+uint64_t get_normal_bin(const Vector& normal) {
+    float ax = std::abs(normal.x), ay = std::abs(normal.y), az = std::abs(normal.z);
+    int axis = (ax > ay) ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+    return uint64_t(2 * axis + (normal[axis] < 0.f ? 1 : 0));
+}
+
+// Summed area table of the bin sums, one row and column larger than the bins.
+typedef float Bin_Table[Guiding_Distribution::Theta_Bin_Count + 1][Guiding_Distribution::Phi_Bin_Count + 1];
+
+// Spreads the energy of the square block of bins at (theta_bin, phi_bin) evenly over it unless it
+// has enough energy to be split into four.
+void merge_bins(const Bin_Table& table, float total, int theta_bin, int phi_bin, int size, float* probabilities) {
+    float energy = table[theta_bin + size][phi_bin + size] - table[theta_bin][phi_bin + size] -
+        table[theta_bin + size][phi_bin] + table[theta_bin][phi_bin];
+
+    if (size == 1 || energy <= Subdivision_Threshold * total) {
+        float probability = std::max(energy, 0.f) / (total * float(size * size));
+        for (int i = theta_bin; i < theta_bin + size; i++) {
+            for (int j = phi_bin; j < phi_bin + size; j++)
+                probabilities[i * Guiding_Distribution::Phi_Bin_Count + j] = probability;
+        }
+        return;
+    }
+
+    int half = size / 2;
+    merge_bins(table, total, theta_bin, phi_bin, half, probabilities);
+    merge_bins(table, total, theta_bin, phi_bin + half, half, probabilities);
+    merge_bins(table, total, theta_bin + half, phi_bin, half, probabilities);
+    merge_bins(table, total, theta_bin + half, phi_bin + half, half, probabilities);
+}
+}
+
+int Guiding_Distribution::get_bin(const Vector& direction) {
+    float cos_theta = direction.z / direction.length();
+    float phi = std::atan2(direction.y, direction.x);
+    if (phi < 0.f)
+        phi += 2.f * PI;
+
+    int theta_bin = std::min(int((cos_theta + 1.f) * 0.5f * Theta_Bin_Count), Theta_Bin_Count - 1);
+    int phi_bin = std::min(int(phi * (0.5f / PI) * Phi_Bin_Count), Phi_Bin_Count - 1);
+    return std::max(theta_bin, 0) * Phi_Bin_Count + std::max(phi_bin, 0);
+}
+
+float Guiding_Distribution::value(const Vector& direction) const {
+    int bin = get_bin(direction);
+    float probability = cdf[bin] - (bin > 0 ? cdf[bin - 1] : 0.f);
+    return probability * (Bin_Count / (4.f * PI));
+}
+
+Vector Guiding_Distribution::generate(RNG& rng) const {
+    int bin = int(std::upper_bound(cdf, cdf + Bin_Count, rng.random_float()) - cdf);
+    bin = std::min(bin, Bin_Count - 1);
+
+    float cos_theta = -1.f + 2.f * (float(bin / Phi_Bin_Count) + rng.random_float()) / Theta_Bin_Count;
+    float phi = 2.f * PI * (float(bin % Phi_Bin_Count) + rng.random_float()) / Phi_Bin_Count;
+    float sin_theta = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+    return Vector(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+}
+
+Guiding_Field::Guiding_Field(float cell_size, int min_sample_count)
+    : inv_cell_size(1.f / cell_size)
+    , min_sample_count(min_sample_count)
+    , training(true)
+{}
+
+uint64_t Guiding_Field::get_key(const Vector& p, const Vector& normal, int level) const {
+    // Cell coordinates wrap around, far away cells may alias in very large scenes.
+    uint64_t key = (uint64_t(level) << 3) | get_normal_bin(normal);
+    for (int axis = 0; axis < 3; axis++) {
+        int64_t cell = static_cast<int64_t>(std::floor(p[axis] * inv_cell_size)) >> level;
+        key = (key << Cell_Coordinate_Bits) | (uint64_t(cell) & Cell_Coordinate_Mask);
+    }
+    return key;
+}
+
+int Guiding_Field::get_shard_index(uint64_t key) {
+    uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+    return int((hash >> 32) % Shard_Count);
+}
+
+const Guiding_Distribution* Guiding_Field::find_distribution(const Vector& p, const Vector& normal) const {
+    if (distribution_indices.empty())
+        return nullptr;
+    // Cells without records of their own, e.g. first reached in this pass, sample a coarser cell.
+    for (int level = 0; level < Level_Count; level++) {
+        auto it = distribution_indices.find(get_key(p, normal, level));
+        if (it != distribution_indices.end())
+            return &distributions[it->second];
+    }
+    return nullptr;
+}
+
+void Guiding_Field::record(const Vector& p, const Vector& normal, const Vector& direction, const Vector& radiance, float pdf) {
+    if (!training)
+        return;
+
+    // The estimate of the radiance integrated over the bin, summed over the color channels.
+    float value = (radiance.x + radiance.y + radiance.z) / pdf;
+    if (!std::isfinite(value) || value < 0.f)
+        return;
+
+    std::vector<Guiding_Record>& records = buffered_records;
+    Guiding_Record record;
+    for (int level = 0; level < Level_Count; level++)
+        record.keys[level] = get_key(p, normal, level);
+    record.shard_index = get_shard_index(record.keys[0]);
+    record.bin = Guiding_Distribution::get_bin(direction);
+    record.value = value;
+    records.push_back(record);
+    if (records.size() >= Max_Buffered_Record_Count)
+        flush();
+}
+
+void Guiding_Field::flush() {
+    std::vector<Guiding_Record>& records = buffered_records;
+    if (records.empty())
+        return;
+
+    // Sorted by shard, for one lock per shard and flush, so the threads rarely wait for each other.
+    int shard_offsets[Shard_Count + 1] = {};
+    for (const Guiding_Record& record : records)
+        shard_offsets[record.shard_index + 1]++;
+    for (int i = 0; i < Shard_Count; i++)
+        shard_offsets[i + 1] += shard_offsets[i];
+
+    std::vector<Guiding_Record>& sorted_records = sorted_record_buffer;
+    sorted_records.resize(records.size());
+    int next_record[Shard_Count];
+    std::copy(shard_offsets, shard_offsets + Shard_Count, next_record);
+    for (const Guiding_Record& record : records)
+        sorted_records[next_record[record.shard_index]++] = record;
+
+    for (int shard_index = 0; shard_index < Shard_Count; shard_index++) {
+        if (shard_offsets[shard_index] == shard_offsets[shard_index + 1])
+            continue;
+        Shard& shard = shards[shard_index];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (int i = shard_offsets[shard_index]; i < shard_offsets[shard_index + 1]; i++) {
+            const Guiding_Record& record = sorted_records[i];
+            Cell& cell = shard.cells[record.keys[0]];
+            if (cell.sample_count == 0)
+                std::copy(record.keys + 1, record.keys + Level_Count, cell.coarse_keys);
+            cell.bin_sums[record.bin] += record.value;
+            cell.sample_count++;
+        }
+    }
+    records.clear();
+}
+
+int Guiding_Field::add_distribution(const Cell& cell) {
+    Bin_Table table = {};
+    for (int i = 0; i < Guiding_Distribution::Theta_Bin_Count; i++) {
+        for (int j = 0; j < Guiding_Distribution::Phi_Bin_Count; j++) {
+            table[i + 1][j + 1] = cell.bin_sums[i * Guiding_Distribution::Phi_Bin_Count + j] +
+                table[i][j + 1] + table[i + 1][j] - table[i][j];
+        }
+    }
+    float total = table[Guiding_Distribution::Theta_Bin_Count][Guiding_Distribution::Phi_Bin_Count];
+    if (cell.sample_count < min_sample_count || !(total > 0.f))
+        return -1;
+
+    float probabilities[Guiding_Distribution::Bin_Count];
+    merge_bins(table, total, 0, 0, Guiding_Distribution::Theta_Bin_Count, probabilities);
+
+    Guiding_Distribution distribution;
+    float cumulative = 0.f;
+    for (int i = 0; i < Guiding_Distribution::Bin_Count; i++) {
+        cumulative += (1.f - Uniform_Fraction) * probabilities[i] + Uniform_Fraction / Guiding_Distribution::Bin_Count;
+        distribution.cdf[i] = cumulative;
+    }
+    distribution.cdf[Guiding_Distribution::Bin_Count - 1] = 1.f;
+    distributions.push_back(distribution);
+    return int(distributions.size() - 1);
+}
+
+void Guiding_Field::update() {
+    distributions.clear();
+    distribution_indices.clear();
+
+    // The coarser cells are the sums of the finest ones.
+    std::unordered_map<uint64_t, Cell> coarse_cells;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& entry : shard.cells) {
+            for (uint64_t coarse_key : entry.second.coarse_keys) {
+                Cell& coarse_cell = coarse_cells[coarse_key];
+                for (int i = 0; i < Guiding_Distribution::Bin_Count; i++)
+                    coarse_cell.bin_sums[i] += entry.second.bin_sums[i];
+                coarse_cell.sample_count += entry.second.sample_count;
+            }
+        }
+    }
+    // The keys hold the level, so the coarse cells share the index map with the finest ones.
+    std::unordered_map<uint64_t, int> coarse_indices;
+    for (const auto& entry : coarse_cells) {
+        int index = add_distribution(entry.second);
+        coarse_indices[entry.first] = index;
+        if (index >= 0)
+            distribution_indices[entry.first] = index;
+    }
+
+    // A cell without enough records of its own samples the smallest cell around it that has them.
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& entry : shard.cells) {
+            int index = add_distribution(entry.second);
+            for (int level = 1; index < 0 && level < Level_Count; level++)
+                index = coarse_indices[entry.second.coarse_keys[level - 1]];
+            if (index >= 0)
+                distribution_indices[entry.first] = index;
+        }
+    }
+}
+
+void Guiding_Field::clear() {
+    distributions.clear();
+    distribution_indices.clear();
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.cells.clear();
+    }
+}
+
+size_t Guiding_Field::get_cell_count() const {
+    return distribution_indices.size();
+}
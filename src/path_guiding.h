@@ -0,0 +1,102 @@
+#pragma once
+
+#include "material.h"
+#include "vector.h"
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Directional distribution of the light arriving in a cell, a histogram over the equal-area
+// cylindrical map of the sphere (cos theta and phi of the world axes), so all bins have the same
+// solid angle.
+struct Guiding_Distribution {
+    // Square, the bins are merged in quadtree blocks.
+    static const int Theta_Bin_Count = 16;
+    static const int Phi_Bin_Count = 16;
+    static const int Bin_Count = Theta_Bin_Count * Phi_Bin_Count;
+
+    static int get_bin(const Vector& direction);
+
+    float value(const Vector& direction) const;
+    Vector generate(RNG& rng) const;
+
+    // Running sum of the bin probabilities.
+    float cdf[Bin_Count];
+};
+
+// Path guiding: a hashed world-space grid of cells keyed by position and facing normal, each
+// learning the distribution of the light arriving at diffuse surfaces in it. The paths of a pass
+// record their incident radiance estimates and update builds the distributions the next passes
+// sample, so the field is trained online from the early passes of a frame.
+class Guiding_Field {
+public:
+    // Each level doubles the cell size, so that sparse regions learn from a larger neighborhood.
+    static const int Level_Count = 3;
+
+    Guiding_Field(float cell_size, int min_sample_count);
+
+    // Null while neither the cell nor a larger one around it has the minimum sample count.
+    const Guiding_Distribution* find_distribution(const Vector& p, const Vector& normal) const;
+
+    // Adds the radiance arriving from direction, sampled with the given pdf. The records are
+    // buffered per thread and added to the field by flush.
+    void record(const Vector& p, const Vector& normal, const Vector& direction, const Vector& radiance, float pdf);
+    // Adds the records of the calling thread, each render task does it when it is done.
+    void flush();
+    // Records are dropped while not training, for the final pass of a frame.
+    void set_training(bool training) { this->training = training; }
+
+    // Rebuilds the distributions from all the records so far. Not thread-safe, called between passes.
+    void update();
+    // Has to be called when the scene changes.
+    void clear();
+    // Cells of all levels with a distribution.
+    size_t get_cell_count() const;
+
+private:
+    static const int Shard_Count = 64;
+
+    // The shards hold the finest cells, update sums them up for the coarser levels.
+    struct Cell {
+        float bin_sums[Guiding_Distribution::Bin_Count] = {};
+        int64_t sample_count = 0;
+        uint64_t coarse_keys[Level_Count - 1] = {};
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, Cell> cells;
+    };
+
+    uint64_t get_key(const Vector& p, const Vector& normal, int level) const;
+    static int get_shard_index(uint64_t key);
+    // Returns the index of the distribution, or -1 if the cell has too few records.
+    int add_distribution(const Cell& cell);
+
+    float inv_cell_size;
+    int64_t min_sample_count;
+    bool training;
+    Shard shards[Shard_Count];
+    // Read by the render threads during a pass, by the keys of the cells of all levels.
+    std::vector<Guiding_Distribution> distributions;
+    std::unordered_map<uint64_t, int> distribution_indices;
+};
+
+// Samples the learned distribution of a cell, combined with the other pdfs of a vertex by a
+// Mixture_Pdf (one-sample MIS with the balance heuristic).
+class Guiding_Pdf : public Pdf {
+public:
+    explicit Guiding_Pdf(const Guiding_Distribution* distribution)
+        : distribution(distribution) {}
+
+    float value(const Vector& direction) const override {
+        return distribution->value(direction);
+    }
+    Vector generate(RNG& rng) const override {
+        return distribution->generate(rng);
+    }
+
+    const Guiding_Distribution* distribution;
+};
@@ -1,93 +1,160 @@
+#include "perlin.h"
 #include "random.h"
 #include "vector.h"
 
-static Vector* random_vectors;
-static int* permutation_x;
-static int* permutation_y;
-static int* permutation_z;
+#include <algorithm>
+#include <xmmintrin.h>
 
-static Vector* perlin_generate(RNG& rng) {
-    Vector* p = new Vector[256];
+static void perlin_generate_perm(RNG& rng, unsigned char* p) {
     for (int i = 0; i < 256; i++) {
-        p[i] = Vector(
-            -1 + 2*rng.random_float(),
-            -1 + 2*rng.random_float(),
-            -1 + 2*rng.random_float()
-        ).normalized();
-    }
-    return p;
-}
-
-static int* perlin_generate_perm(RNG& rng) {
-    int* p = new int[256];
-    for (int i = 0; i < 256; i++) {
-        p[i] = i;
+        p[i] = static_cast<unsigned char>(i);
     }
     for (int i = 255; i > 0; i--) {
         int target = int(rng.random_float() * (i + 1));
-        int tmp = p[i];
+        unsigned char tmp = p[i];
         p[i] = p[target];
         p[target] = tmp;
     }
-    return p;
 }
 
-static float perlin_interpolation(Vector c[2][2][2], float u, float v, float w) {
-    float uu = u * u*(3 - 2 * u);
-    float vv = v * v*(3 - 2 * v);
-    float ww = w * w*(3 - 2 * w);
-
-    float accum = 0.f;
+Perlin::Perlin(RNG& rng) {
+    for (int i = 0; i < 256; i++) {
+        Vector g = Vector(
+            -1 + 2*rng.random_float(),
+            -1 + 2*rng.random_float(),
+            -1 + 2*rng.random_float()
+        ).normalized();
 
-    for (int i = 0; i < 2; i++) {
-        for (int j = 0; j < 2; j++) {
-            for (int k = 0; k < 2; k++) {
-                Vector weight_v(u - i, v - j, w - k);
-                accum += (i*uu + (1 - i)*(1.f - uu))*
-                    (j*vv + (1 - j)*(1.f - vv))*
-                    (k*ww + (1 - k)*(1.f - ww)) * dot_product(c[i][j][k], weight_v);
-            }
-        }
+        gradient_x[i] = g.x;
+        gradient_y[i] = g.y;
+        gradient_z[i] = g.z;
     }
-    return accum;
+    perlin_generate_perm(rng, permutation_x);
+    perlin_generate_perm(rng, permutation_y);
+    perlin_generate_perm(rng, permutation_z);
 }
 
-void perlin_initialize(RNG& rng) {
-    random_vectors = perlin_generate(rng);
-    permutation_x = perlin_generate_perm(rng);
-    permutation_y = perlin_generate_perm(rng);
-    permutation_z = perlin_generate_perm(rng);
-}
+float Perlin::noise(const Vector& p) const {
+    float fx = std::floor(p.x);
+    float fy = std::floor(p.y);
+    float fz = std::floor(p.z);
 
-float perlin_noise(const Vector& p) {
-    float u = p.x - std::floor(p.x);
-    float v = p.y - std::floor(p.y);
-    float w = p.z - std::floor(p.z);
+    float u = p.x - fx;
+    float v = p.y - fy;
+    float w = p.z - fz;
 
-    int i = static_cast<int>(std::floor(p.x));
-    int j = static_cast<int>(std::floor(p.y));
-    int k = static_cast<int>(std::floor(p.z));
+    int i = static_cast<int>(fx);
+    int j = static_cast<int>(fy);
+    int k = static_cast<int>(fz);
 
-    Vector c[2][2][2];
-    for (int di = 0; di < 2; di++) {
-        for (int dj = 0; dj < 2; dj++) {
-            for (int dk = 0; dk < 2; dk++) {
-                c[di][dj][dk] = random_vectors[permutation_x[(i + di) & 255] ^ permutation_y[(j + dj) & 255] ^ permutation_z[(k + dk) & 255]];
-            }
-        }
-    }
-    return perlin_interpolation(c, u, v, w);
+    int px0 = permutation_x[i & 255], px1 = permutation_x[(i + 1) & 255];
+    int py0 = permutation_y[j & 255], py1 = permutation_y[(j + 1) & 255];
+    int pz0 = permutation_z[k & 255], pz1 = permutation_z[(k + 1) & 255];
+
+    // Corner order within a 4-wide group: (dj, dk) = (0,0), (0,1), (1,0), (1,1).
+    // Group a has di = 0, group b has di = 1.
+    int a0 = px0 ^ py0 ^ pz0, a1 = px0 ^ py0 ^ pz1, a2 = px0 ^ py1 ^ pz0, a3 = px0 ^ py1 ^ pz1;
+    int b0 = px1 ^ py0 ^ pz0, b1 = px1 ^ py0 ^ pz1, b2 = px1 ^ py1 ^ pz0, b3 = px1 ^ py1 ^ pz1;
+
+    __m128 gx_a = _mm_setr_ps(gradient_x[a0], gradient_x[a1], gradient_x[a2], gradient_x[a3]);
+    __m128 gy_a = _mm_setr_ps(gradient_y[a0], gradient_y[a1], gradient_y[a2], gradient_y[a3]);
+    __m128 gz_a = _mm_setr_ps(gradient_z[a0], gradient_z[a1], gradient_z[a2], gradient_z[a3]);
+    __m128 gx_b = _mm_setr_ps(gradient_x[b0], gradient_x[b1], gradient_x[b2], gradient_x[b3]);
+    __m128 gy_b = _mm_setr_ps(gradient_y[b0], gradient_y[b1], gradient_y[b2], gradient_y[b3]);
+    __m128 gz_b = _mm_setr_ps(gradient_z[b0], gradient_z[b1], gradient_z[b2], gradient_z[b3]);
+
+    // Offsets from the corners to the point.
+    __m128 dx_a = _mm_set1_ps(u);
+    __m128 dx_b = _mm_set1_ps(u - 1.f);
+    __m128 dy = _mm_setr_ps(v, v, v - 1.f, v - 1.f);
+    __m128 dz = _mm_setr_ps(w, w - 1.f, w, w - 1.f);
+
+    __m128 dot_a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx_a, dx_a), _mm_mul_ps(gy_a, dy)), _mm_mul_ps(gz_a, dz));
+    __m128 dot_b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx_b, dx_b), _mm_mul_ps(gy_b, dy)), _mm_mul_ps(gz_b, dz));
+
+    // Hermite interpolation weights.
+    float uu = u * u*(3 - 2 * u);
+    float vv = v * v*(3 - 2 * v);
+    float ww = w * w*(3 - 2 * w);
+
+    __m128 wy = _mm_setr_ps(1.f - vv, 1.f - vv, vv, vv);
+    __m128 wz = _mm_setr_ps(1.f - ww, ww, 1.f - ww, ww);
+
+    __m128 x_lerp = _mm_add_ps(_mm_mul_ps(dot_a, _mm_set1_ps(1.f - uu)), _mm_mul_ps(dot_b, _mm_set1_ps(uu)));
+    __m128 weighted = _mm_mul_ps(x_lerp, _mm_mul_ps(wy, wz));
+
+    // Horizontal sum.
+    __m128 shuffled = _mm_shuffle_ps(weighted, weighted, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(weighted, shuffled);
+    shuffled = _mm_movehl_ps(shuffled, sums);
+    sums = _mm_add_ss(sums, shuffled);
+    return _mm_cvtss_f32(sums);
 }
 
-float perlin_turbulence(const Vector& p, int depth) {
+float Perlin::turbulence(const Vector& p, int depth) const {
     float accum = 0.f;
     Vector temp_p = p;
     float weight = 1.f;
 
     for (int i = 0; i < depth; i++) {
-        accum += weight * perlin_noise(temp_p);
+        accum += weight * noise(temp_p);
         weight *= 0.5f;
         temp_p *= 2.f;
     }
     return std::abs(accum);
 }
+
+Baked_Turbulence::Baked_Turbulence(const Perlin& perlin, const Bounding_Box& bounds, int resolution, int depth)
+    : bounds(bounds)
+{
+    Vector extent = bounds.max_point - bounds.min_point;
+    float max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+
+    // An axis without extent gets two samples at the same coordinate and a scale of 0, so every
+    // point on it samples the first of them.
+    Vector spacing;
+    for (int i = 0; i < 3; i++) {
+        int cell_count = extent[i] > 0.f ? static_cast<int>(std::ceil(resolution * extent[i] / max_extent)) : 1;
+        size[i] = std::max(2, cell_count + 1);
+        cell_scale[i] = extent[i] > 0.f ? (size[i] - 1) / extent[i] : 0.f;
+        spacing[i] = extent[i] / (size[i] - 1);
+    }
+
+    values.resize(size_t(size[0]) * size[1] * size[2]);
+    add_memory_usage(values.size() * sizeof(float));
+    for (int z = 0; z < size[2]; z++) {
+        for (int y = 0; y < size[1]; y++) {
+            for (int x = 0; x < size[0]; x++) {
+                Vector p = bounds.min_point + Vector(x * spacing.x, y * spacing.y, z * spacing.z);
+                values[(size_t(z) * size[1] + y) * size[0] + x] = perlin.turbulence(p, depth);
+            }
+        }
+    }
+}
+
+bool Baked_Turbulence::sample(const Vector& p, float& value) const {
+    if (!bounds.contain(p))
+        return false;
+
+    Vector grid_p = (p - bounds.min_point) * cell_scale;
+    int i[3];
+    float f[3];
+    for (int c = 0; c < 3; c++) {
+        i[c] = std::min(static_cast<int>(grid_p[c]), size[c] - 2);
+        f[c] = grid_p[c] - i[c];
+    }
+
+    auto at = [this](int x, int y, int z) {
+        return values[(size_t(z) * size[1] + y) * size[0] + x];
+    };
+
+    float c00 = at(i[0], i[1], i[2])         * (1 - f[0]) + at(i[0] + 1, i[1], i[2])         * f[0];
+    float c10 = at(i[0], i[1] + 1, i[2])     * (1 - f[0]) + at(i[0] + 1, i[1] + 1, i[2])     * f[0];
+    float c01 = at(i[0], i[1], i[2] + 1)     * (1 - f[0]) + at(i[0] + 1, i[1], i[2] + 1)     * f[0];
+    float c11 = at(i[0], i[1] + 1, i[2] + 1) * (1 - f[0]) + at(i[0] + 1, i[1] + 1, i[2] + 1) * f[0];
+
+    float c0 = c00 * (1 - f[1]) + c10 * f[1];
+    float c1 = c01 * (1 - f[1]) + c11 * f[1];
+    value = c0 * (1 - f[2]) + c1 * f[2];
+    return true;
+}
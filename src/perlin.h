@@ -1,8 +1,46 @@
 #pragma once
 
+#include "bounding_box.h"
+#include "scene_resources.h"
+
+#include <vector>
+
 class RNG;
 class Vector;
 
-void perlin_initialize(RNG& rng);
-float perlin_noise(const Vector& p);
-float perlin_turbulence(const Vector& p, int depth = 7);
+// Perlin noise with its own random tables, so scenes with different seeds can coexist.
+// The 8 lattice corners are evaluated together with SSE.
+class Perlin : public Scene_Object {
+public:
+    explicit Perlin(RNG& rng);
+
+    float noise(const Vector& p) const;
+    float turbulence(const Vector& p, int depth = 7) const;
+
+private:
+    // Gradients are stored as structure of arrays for SIMD evaluation.
+    alignas(16) float gradient_x[256];
+    alignas(16) float gradient_y[256];
+    alignas(16) float gradient_z[256];
+
+    unsigned char permutation_x[256];
+    unsigned char permutation_y[256];
+    unsigned char permutation_z[256];
+};
+
+// Turbulence precomputed on a regular grid and sampled with trilinear interpolation.
+// Trades memory and some high frequency detail for much cheaper lookups.
+class Baked_Turbulence : public Scene_Object {
+public:
+    // bounds are in noise space; resolution is the number of samples along the longest axis.
+    Baked_Turbulence(const Perlin& perlin, const Bounding_Box& bounds, int resolution, int depth = 7);
+
+    // Returns false if the point is outside of the baked region.
+    bool sample(const Vector& p, float& value) const;
+
+private:
+    Bounding_Box bounds;
+    int size[3];
+    Vector cell_scale;
+    std::vector<float> values;
+};
@@ -0,0 +1,258 @@
+#include "photon_map.h"
+#include "material.h"
+#include "render.h"
+#include "scenes.h"
+#include "thread.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+const int Max_Photon_Depth = 16;
+
+struct Photon_Neighbor {
+    float distance_sq;
+    int index;
+
+    bool operator<(const Photon_Neighbor& other) const { return distance_sq < other.distance_sq; }
+};
+
+void trace_photon(RNG& rng, const Scene& scene, float power_scale, std::vector<Photon>& photons) {
+    float time = scene.camera.sample_time(rng);
+    Intersection light;
+    float area_pdf;
+    if (!sample_light_point(rng, scene, time, light, area_pdf))
+        return;
+
+    // Cosine-weighted emission, the cosine cancels out of the power.
+    Vector emission = light.material->emitted(Ray(light.p + light.normal, -light.normal), light, light.u, light.v, light.p);
+    Vector power = emission * (PI * power_scale / area_pdf);
+    Ray ray(light.p, Axes(light.normal).from_local_to_world(random_cosine_direction(rng)), time);
+
+    for (int depth = 0; depth < Max_Photon_Depth; depth++) {
+        Ray_Hit ray_hit;
+        if (!scene.shape->hit(ray, 0.001f, std::numeric_limits<float>::max(), ray_hit))
+            return;
+
+        Intersection hit;
+        evaluate_hit(ray, ray_hit, hit);
+        hit.footprint = 0.f;
+
+        Scatter_Info scatter_info;
+        if (!hit.material->scatter(rng, ray, hit, scatter_info))
+            return;
+
+        if (!scatter_info.is_specular) {
+            delete scatter_info.pdf;
+            if (depth > 0) {
+                Vector facing_normal = dot_product(hit.normal, ray.direction) < 0.f ? hit.normal : -hit.normal;
+                Photon photon;
+                for (int i = 0; i < 3; i++) {
+                    photon.position[i] = hit.p[i];
+                    photon.power[i] = power[i];
+                    photon.normal[i] = facing_normal[i];
+                }
+                photon.axis = 0;
+                photons.push_back(photon);
+            }
+            return;
+        }
+
+        power = power * scatter_info.attenuation;
+        ray = scatter_info.specular_ray;
+    }
+}
+
+class Photon_Trace_Task : public Task {
+public:
+    Photon_Trace_Task(const Scene* scene, int photon_count, float power_scale)
+        : scene(scene), photon_count(photon_count), power_scale(power_scale) {}
+
+    void run(RNG& rng) override {
+        for (int i = 0; i < photon_count; i++)
+            trace_photon(rng, *scene, power_scale, photons);
+    }
+
+    std::vector<Photon> photons;
+
+private:
+    const Scene* scene;
+    int photon_count;
+    float power_scale;
+};
+
+void build_kd_tree(Photon* photons, int n) {
+    if (n <= 1)
+        return;
+
+    float min_point[3], max_point[3];
+    for (int axis = 0; axis < 3; axis++) {
+        min_point[axis] = std::numeric_limits<float>::max();
+        max_point[axis] = -std::numeric_limits<float>::max();
+    }
+    for (int i = 0; i < n; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            min_point[axis] = std::min(min_point[axis], photons[i].position[axis]);
+            max_point[axis] = std::max(max_point[axis], photons[i].position[axis]);
+        }
+    }
+
+    int split_axis = 0;
+    for (int axis = 1; axis < 3; axis++) {
+        if (max_point[axis] - min_point[axis] > max_point[split_axis] - min_point[split_axis])
+            split_axis = axis;
+    }
+
+    int middle = n / 2;
+    std::nth_element(photons, photons + middle, photons + n, [split_axis](const Photon& a, const Photon& b) {
+        return a.position[split_axis] < b.position[split_axis];
+    });
+    photons[middle].axis = split_axis;
+
+    build_kd_tree(photons, middle);
+    build_kd_tree(photons + middle + 1, n - middle - 1);
+}
+
+bool faces_normal(const Photon& photon, const Vector& normal) {
+    return dot_product(normal, Vector(photon.normal[0], photon.normal[1], photon.normal[2])) > 0.5f;
+}
+
+// Adds the power of the photons of [begin, end) within the radius that arrived on the side of normal.
+void sum_photons_in_radius(const std::vector<Photon>& photons, int begin, int end, const Vector& p, const Vector& normal,
+                           float radius_sq, Vector& power)
+{
+    while (begin < end) {
+        int middle = begin + (end - begin) / 2;
+        const Photon& photon = photons[middle];
+        float plane_distance = p[photon.axis] - photon.position[photon.axis];
+
+        Vector d = p - Vector(photon.position[0], photon.position[1], photon.position[2]);
+        if (dot_product(d, d) < radius_sq && faces_normal(photon, normal))
+            power += Vector(photon.power[0], photon.power[1], photon.power[2]);
+
+        // Recurses into the side p is not on only if the disc reaches over the splitting plane.
+        bool near_left = plane_distance < 0.f;
+        if (plane_distance * plane_distance < radius_sq) {
+            if (near_left)
+                sum_photons_in_radius(photons, middle + 1, end, p, normal, radius_sq, power);
+            else
+                sum_photons_in_radius(photons, begin, middle, p, normal, radius_sq, power);
+        }
+        if (near_left)
+            end = middle;
+        else
+            begin = middle + 1;
+    }
+}
+
+// Keeps the k nearest photons of [begin, end) in a max-heap, max_distance_sq shrinks to the
+// distance of the farthest one once the heap is full.
+void find_neighbors(const std::vector<Photon>& photons, int begin, int end, const Vector& p, int k,
+                    Photon_Neighbor* neighbors, int& count, float& max_distance_sq)
+{
+    if (begin >= end)
+        return;
+
+    int middle = begin + (end - begin) / 2;
+    const Photon& photon = photons[middle];
+    float plane_distance = p[photon.axis] - photon.position[photon.axis];
+
+    if (plane_distance < 0.f)
+        find_neighbors(photons, begin, middle, p, k, neighbors, count, max_distance_sq);
+    else
+        find_neighbors(photons, middle + 1, end, p, k, neighbors, count, max_distance_sq);
+
+    Vector d = p - Vector(photon.position[0], photon.position[1], photon.position[2]);
+    float distance_sq = dot_product(d, d);
+    if (distance_sq < max_distance_sq) {
+        if (count == k) {
+            std::pop_heap(neighbors, neighbors + count);
+            count--;
+        }
+        neighbors[count++] = Photon_Neighbor{distance_sq, middle};
+        std::push_heap(neighbors, neighbors + count);
+        if (count == k)
+            max_distance_sq = neighbors[0].distance_sq;
+    }
+
+    if (plane_distance * plane_distance < max_distance_sq) {
+        if (plane_distance < 0.f)
+            find_neighbors(photons, middle + 1, end, p, k, neighbors, count, max_distance_sq);
+        else
+            find_neighbors(photons, begin, middle, p, k, neighbors, count, max_distance_sq);
+    }
+}
+}
+
+Caustic_Photon_Map::Caustic_Photon_Map(int photons_per_pass, float initial_radius, int pass_count,
+                                       Photon_Gather gather_mode, int neighbor_count, float alpha)
+    : photons_per_pass(photons_per_pass)
+    , gather_mode(gather_mode)
+    , neighbor_count(std::min(std::max(neighbor_count, 1), Max_Neighbor_Count))
+    , initial_radius(initial_radius)
+    , pass_count(std::max(pass_count, 1))
+    , alpha(alpha)
+{
+    reset();
+}
+
+float Caustic_Photon_Map::get_radius() const {
+    return std::sqrt(radius_sq);
+}
+
+void Caustic_Photon_Map::reset() {
+    pass_index = 0;
+    radius_sq = initial_radius * initial_radius;
+    photons.clear();
+}
+
+void Caustic_Photon_Map::trace_pass(const Scene& scene, int thread_count) {
+    // r(i+1)^2 = r(i)^2 * (i + alpha) / (i + 1), counting passes from 1.
+    if (pass_index > 0 && gather_mode == Photon_Gather::progressive)
+        radius_sq *= (pass_index + alpha) / (pass_index + 1);
+    pass_index++;
+
+    photons.clear();
+    if (!scene.lights)
+        return;
+
+    int task_count = std::max(thread_count, 1);
+    float power_scale = 1.f / float(photons_per_pass);
+    std::vector<Photon_Trace_Task> tasks;
+    for (int i = 0; i < task_count; i++) {
+        int count = photons_per_pass * (i + 1) / task_count - photons_per_pass * i / task_count;
+        tasks.push_back(Photon_Trace_Task(&scene, count, power_scale));
+    }
+    for (int i = 0; i < task_count; i++)
+        Thread::queue_task(&tasks[i], i % Thread::get_node_count());
+    Thread::wait_for_tasks();
+
+    for (const auto& task : tasks)
+        photons.insert(photons.end(), task.photons.begin(), task.photons.end());
+    build_kd_tree(photons.data(), static_cast<int>(photons.size()));
+}
+
+Vector Caustic_Photon_Map::gather(const Vector& p, const Vector& normal, const Vector& albedo) const {
+    if (photons.empty())
+        return Vector(0);
+
+    // Photons on other surfaces in the neighborhood (corners, the back of thin walls) are left out.
+    Vector power(0);
+    float disc_radius_sq = radius_sq;
+    if (gather_mode == Photon_Gather::progressive) {
+        sum_photons_in_radius(photons, 0, static_cast<int>(photons.size()), p, normal, radius_sq, power);
+    } else {
+        Photon_Neighbor neighbors[Max_Neighbor_Count];
+        int count = 0;
+        find_neighbors(photons, 0, static_cast<int>(photons.size()), p, neighbor_count, neighbors, count, disc_radius_sq);
+        for (int i = 0; i < count; i++) {
+            const Photon& photon = photons[neighbors[i].index];
+            if (faces_normal(photon, normal))
+                power += Vector(photon.power[0], photon.power[1], photon.power[2]);
+        }
+    }
+
+    // Lambertian BRDF albedo / PI over the disc the photons were collected from.
+    return albedo * power / (PI * PI * disc_radius_sq);
+}
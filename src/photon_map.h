@@ -0,0 +1,66 @@
+#pragma once
+
+#include "vector.h"
+
+#include <vector>
+
+struct Scene;
+
+struct Photon {
+    float position[3];
+    float power[3];
+    // Normal of the surface on the side the photon arrived from.
+    float normal[3];
+    // Split axis of the kd-tree node.
+    int axis;
+};
+
+// How the photons around a point are gathered.
+enum class Photon_Gather {
+    // All photons within the gather radius, which shrinks every pass so that the bias goes to
+    // zero (probabilistic progressive photon mapping, Knaus and Zwicker 2011).
+    progressive,
+    // The k nearest photons within the gather radius, over the disc of the farthest one. It adapts
+    // to the photon density, but the disc does not shrink over the passes, so it stays biased.
+    nearest_neighbors
+};
+
+// Photons that reached a diffuse surface from a light over one or more specular bounces, gathered
+// at diffuse hits instead of waiting for paths to find the light through the specular surfaces.
+// Paths leave those caustic paths to the map (see render.cpp).
+//
+// Rendering is split into passes that each trace a new set of photons, averaging their estimates.
+class Caustic_Photon_Map {
+public:
+    static const int Max_Neighbor_Count = 64;
+
+    // The neighbor count is only used by Photon_Gather::nearest_neighbors.
+    Caustic_Photon_Map(int photons_per_pass, float initial_radius, int pass_count,
+                       Photon_Gather gather_mode = Photon_Gather::progressive, int neighbor_count = 32, float alpha = 0.7f);
+
+    int get_pass_count() const { return pass_count; }
+    size_t get_photon_count() const { return photons.size(); }
+    float get_radius() const;
+
+    // Restarts the radius sequence, for a new frame.
+    void reset();
+    // Traces the photons of the next pass from the lights of the scene with the render threads.
+    void trace_pass(const Scene& scene, int thread_count);
+
+    // Caustic radiance leaving a Lambertian surface with the given albedo, estimated from the
+    // photons around p.
+    Vector gather(const Vector& p, const Vector& normal, const Vector& albedo) const;
+
+private:
+    int photons_per_pass;
+    Photon_Gather gather_mode;
+    int neighbor_count;
+    float initial_radius;
+    int pass_count;
+    float alpha;
+
+    int pass_index;
+    float radius_sq;
+    // kd-tree with each subtree stored as a contiguous range and its root in the middle.
+    std::vector<Photon> photons;
+};
@@ -0,0 +1,78 @@
+#include "radiance_cache.h"
+
+#include <cmath>
+
+namespace {
+const int Cell_Coordinate_Bits = 20;
+const uint64_t Cell_Coordinate_Mask = (uint64_t(1) << Cell_Coordinate_Bits) - 1;
+
+// One of six bins by the dominant axis and its sign, so that both sides of a wall or
+// the faces of a box corner don't share a cell.
+uint64_t get_normal_bin(const Vector& normal) {
+    float ax = std::abs(normal.x), ay = std::abs(normal.y), az = std::abs(normal.z);
+    int axis = (ax > ay) ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+    return uint64_t(2 * axis + (normal[axis] < 0.f ? 1 : 0));
+}
+}
+
+Radiance_Cache::Radiance_Cache(float cell_size, int min_sample_count)
+    : inv_cell_size(1.f / cell_size)
+    , min_sample_count(min_sample_count)
+{}
+
+uint64_t Radiance_Cache::get_key(const Vector& p, const Vector& normal) const {
+    // Cell coordinates wrap around, far away cells may alias in very large scenes.
+    uint64_t key = get_normal_bin(normal);
+    for (int axis = 0; axis < 3; axis++) {
+        int64_t cell = static_cast<int64_t>(std::floor(p[axis] * inv_cell_size));
+        key = (key << Cell_Coordinate_Bits) | (uint64_t(cell) & Cell_Coordinate_Mask);
+    }
+    return key;
+}
+
+Radiance_Cache::Shard& Radiance_Cache::get_shard(uint64_t key) const {
+    uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+    return shards[(hash >> 32) % Shard_Count];
+}
+
+bool Radiance_Cache::lookup(const Vector& p, const Vector& normal, Vector& radiance) const {
+    uint64_t key = get_key(p, normal);
+    Shard& shard = get_shard(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.cells.find(key);
+    if (it == shard.cells.end() || it->second.sample_count < min_sample_count)
+        return false;
+    radiance = it->second.sum / float(it->second.sample_count);
+    return true;
+}
+
+void Radiance_Cache::record(const Vector& p, const Vector& normal, const Vector& radiance) {
+    // A single NaN or infinite sample would spoil the cell for good.
+    if (!std::isfinite(radiance.x) || !std::isfinite(radiance.y) || !std::isfinite(radiance.z))
+        return;
+
+    uint64_t key = get_key(p, normal);
+    Shard& shard = get_shard(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Cell& cell = shard.cells[key];
+    cell.sum += radiance;
+    cell.sample_count++;
+}
+
+void Radiance_Cache::clear() {
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.cells.clear();
+    }
+}
+
+size_t Radiance_Cache::get_cell_count() const {
+    size_t count = 0;
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        count += shard.cells.size();
+    }
+    return count;
+}
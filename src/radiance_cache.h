@@ -0,0 +1,46 @@
+#pragma once
+
+#include "vector.h"
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+// World-space cache of the light arriving at diffuse surfaces: a hashed grid of cells keyed by
+// position and facing normal, filled by the paths while rendering. Once a cell has enough samples,
+// paths reaching it after their first diffuse bounce end at a lookup instead of bouncing further.
+// The bias grows with the cell size and the noise of the cached values falls with the minimum
+// sample count. Meant for previews and lookdev, not for final frames.
+class Radiance_Cache {
+public:
+    Radiance_Cache(float cell_size, int min_sample_count);
+
+    // Cosine-weighted incident radiance (irradiance / PI) of the cell, the diffuse albedo is
+    // applied by the caller. Fails while the cell has fewer than the minimum sample count.
+    bool lookup(const Vector& p, const Vector& normal, Vector& radiance) const;
+    void record(const Vector& p, const Vector& normal, const Vector& radiance);
+
+    // Has to be called when the scene changes.
+    void clear();
+    size_t get_cell_count() const;
+
+private:
+    static const int Shard_Count = 64;
+
+    struct Cell {
+        Vector sum = Vector(0);
+        int64_t sample_count = 0;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<uint64_t, Cell> cells;
+    };
+
+    uint64_t get_key(const Vector& p, const Vector& normal) const;
+    Shard& get_shard(uint64_t key) const;
+
+    float inv_cell_size;
+    int64_t min_sample_count;
+    mutable Shard shards[Shard_Count];
+};
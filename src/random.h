@@ -13,6 +13,15 @@ public:
         inc = Init_Inc;
     }
 
+    // Sequence selected by the seed and one of 2^63 streams, for reproducible renders.
+    RNG(uint64_t seed, uint64_t stream) {
+        state = 0;
+        inc = (stream << 1u) | 1u;
+        random_uint32();
+        state += seed;
+        random_uint32();
+    }
+
     uint32_t random_uint32() {
         uint64_t oldstate = state;
         state = oldstate * 6364136223846793005ULL + inc;
@@ -8,11 +8,23 @@ public:
     Ray() {}
 
     Ray(const Vector& origin, const Vector& direction, float time = 0.f)
-        : origin(origin), direction(direction), time(time) {}
+        : origin(origin), direction(direction), time(time), cone_width(0.f), cone_spread(0.f) {}
 
     Vector PointAtParameter(float t) const { return origin + t * direction; }
+
+    void set_cone(float width, float spread) {
+        cone_width = width;
+        cone_spread = spread;
+    }
+
+    // Width of the ray cone at the given distance from the origin.
+    float get_cone_width(float distance) const { return cone_width + distance * cone_spread; }
     
     Vector origin;
     Vector direction;
     float time;
+
+    // Ray cone used to select texture MIP levels: width at the origin and spread angle.
+    float cone_width;
+    float cone_spread;
 };
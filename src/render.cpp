@@ -0,0 +1,568 @@
+#include "render.h"
+#include "bdpt.h"
+#include "material.h"
+#include "path_guiding.h"
+#include "photon_map.h"
+#include "radiance_cache.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <utility>
+
+unsigned get_render_features(const Scene& scene) {
+    Shape_Features shape_features;
+    scene.shape->get_features(shape_features);
+
+    unsigned features = 0;
+    if (scene.camera.has_depth_of_field())
+        features |= Render_Depth_Of_Field;
+    if (scene.camera.has_shutter_interval() && shape_features.moving)
+        features |= Render_Motion_Blur;
+    if (shape_features.uses_footprint)
+        features |= Render_Texture_Filtering;
+    if (shape_features.emissive)
+        features |= Render_Emitters;
+    if (scene.lights)
+        features |= Render_Light_Sampling;
+    if (shape_features.streamed)
+        features |= Render_Streamed_Geometry;
+    return features;
+}
+
+namespace {
+// Radiance emitted at a point of a light towards the given side, by hitting the scene there.
+Vector probe_emission(const Scene& scene, const Vector& point, const Vector& side, float time, Intersection& isect) {
+    const float offset = 1e-2f;
+    Ray ray(point + offset * side, -side, time);
+    Ray_Hit ray_hit;
+    if (!scene.shape->hit(ray, 0.f, 2.f * offset, ray_hit))
+        return Vector(0);
+
+    evaluate_hit(ray, ray_hit, isect);
+    isect.footprint = 0.f;
+    return isect.material->emitted(ray, isect, isect.u, isect.v, isect.p);
+}
+
+bool is_black(const Vector& v) {
+    return v.x <= 0.f && v.y <= 0.f && v.z <= 0.f;
+}
+}
+
+bool sample_light_point(RNG& rng, const Scene& scene, float time, Intersection& isect, float& pdf) {
+    Vector point, normal;
+    if (!scene.lights || !scene.lights->sample_surface(rng, point, normal, pdf))
+        return false;
+
+    Intersection side_isects[2];
+    bool emits[2] = {
+        !is_black(probe_emission(scene, point, normal, time, side_isects[0])),
+        !is_black(probe_emission(scene, point, -normal, time, side_isects[1]))
+    };
+    int side;
+    if (emits[0] && emits[1]) {
+        side = rng.random_float() < 0.5f ? 0 : 1;
+        pdf *= 0.5f;
+    } else if (emits[0] || emits[1]) {
+        side = emits[0] ? 0 : 1;
+    } else {
+        return false;
+    }
+
+    isect = side_isects[side];
+    isect.p = point;
+    isect.normal = side ? -normal : normal;
+    return true;
+}
+
+float get_light_point_pdf(const Scene& scene, const Intersection& isect, float time) {
+    if (!scene.lights)
+        return 0.f;
+    float pdf = scene.lights->surface_pdf(isect.p);
+    if (pdf == 0.f)
+        return 0.f;
+
+    Intersection back_isect;
+    if (!is_black(probe_emission(scene, isect.p, -isect.normal, time, back_isect)))
+        pdf *= 0.5f;
+    return pdf;
+}
+
+namespace {
+// The vertices a ray comes from. With a caustic photon map, light reaching a diffuse surface over
+// specular bounces (caustic rays hitting an emitter) is left to the map.
+enum class Path_State {
+    other,
+    after_diffuse,
+    caustic
+};
+
+template <unsigned Features>
+Vector shade_path(RNG& rng, const Ray& ray, const Scene& scene, int depth, Path_State state, bool surface_hit, const Ray_Hit& ray_hit);
+
+template <unsigned Features>
+Vector trace_path(RNG& rng, const Ray& ray, const Scene& scene, int depth, Path_State state)
+{
+    STATS_INCREMENT_DEPTH(depth);
+
+    Ray_Hit ray_hit;
+    bool surface_hit = scene.shape->hit(ray, 0.001f, std::numeric_limits<float>::max(), ray_hit);
+    return shade_path<Features>(rng, ray, scene, depth, state, surface_hit, ray_hit);
+}
+
+// Continues a path from the closest surface hit of ray, if any.
+template <unsigned Features>
+Vector shade_path(RNG& rng, const Ray& ray, const Scene& scene, int depth, Path_State state, bool surface_hit, const Ray_Hit& ray_hit)
+{
+    float t_end = surface_hit ? ray_hit.t : std::numeric_limits<float>::max();
+
+    // Scatter at the closest medium collision in front of the surface. Collisions are
+    // sampled independently per medium, each one shortens the interval for the next.
+    const Medium* scattering_medium = nullptr;
+    for (const Medium* medium : scene.media) {
+        float t;
+        if (!medium->is_absorbing_only() && medium->sample_scattering(rng, ray, 0.001f, t_end, t)) {
+            t_end = t;
+            scattering_medium = medium;
+        }
+    }
+
+    float transmittance = 1.f;
+    for (const Medium* medium : scene.media) {
+        if (medium->is_absorbing_only())
+            transmittance *= medium->transmittance(rng, ray, 0.001f, t_end);
+    }
+    if (transmittance == 0.f) {
+        STATS_INCREMENT(paths_absorbed);
+        return Vector(0);
+    }
+
+    Intersection hit;
+    if (scattering_medium) {
+        hit.t = t_end;
+        hit.p = ray.PointAtParameter(t_end);
+        hit.normal = -ray.direction.normalized();
+        hit.u = hit.v = 0.f;
+        hit.uv_density = 0.f;
+        hit.material = scattering_medium->get_phase_function();
+        surface_hit = true;
+    } else if (surface_hit) {
+        evaluate_hit(ray, ray_hit, hit);
+    }
+
+    if (surface_hit)
+    {
+        float cone_width = 0.f;
+        hit.footprint = 0.f;
+        if (Features & Render_Texture_Filtering) {
+            cone_width = ray.get_cone_width(hit.t * ray.direction.length());
+            float cosine = std::abs(dot_product(ray.direction.normalized(), hit.normal));
+            hit.footprint = cone_width * hit.uv_density / std::max(cosine, 0.01f);
+        }
+
+        Vector emitted(0);
+        if ((Features & Render_Emitters) && !(state == Path_State::caustic && scene.caustic_map))
+            emitted = transmittance * hit.material->emitted(ray, hit, hit.u, hit.v, hit.p);
+        Scatter_Info scatter_info;
+        if (depth >= 50) {
+            STATS_INCREMENT(paths_depth_limit);
+            return emitted;
+        }
+        if (hit.material->scatter(rng, ray, hit, scatter_info))
+        {
+            if (scatter_info.is_specular) {
+                if (Features & Render_Texture_Filtering)
+                    scatter_info.specular_ray.set_cone(cone_width, ray.cone_spread);
+                Path_State next_state = (state == Path_State::other) ? Path_State::other : Path_State::caustic;
+                return transmittance * scatter_info.attenuation * trace_path<Features>(rng, scatter_info.specular_ray, scene, depth + 1, next_state);
+            } else {
+                // Past the first diffuse bounce the path can end at a radiance cache lookup.
+                Radiance_Cache* cache = scattering_medium ? nullptr : scene.radiance_cache;
+                Vector facing_normal = dot_product(hit.normal, ray.direction) < 0.f ? hit.normal : -hit.normal;
+                Vector caustic(0);
+                if (scene.caustic_map && !scattering_medium)
+                    caustic = scene.caustic_map->gather(hit.p, facing_normal, scatter_info.attenuation);
+
+                Vector cached_radiance;
+                if (cache && state == Path_State::after_diffuse && cache->lookup(hit.p, facing_normal, cached_radiance)) {
+                    STATS_INCREMENT(paths_cached);
+                    delete scatter_info.pdf;
+                    return emitted + transmittance * (caustic + scatter_info.attenuation * cached_radiance);
+                }
+
+                // The learned distribution of the cell is one more strategy of a one-sample MIS. It shares
+                // the half of the samples that isn't BSDF sampled with light sampling, so that the
+                // directions it misses are weighted at most twice as high, like those light sampling misses.
+                Guiding_Field* guiding_field = scattering_medium ? nullptr : scene.guiding_field;
+                Guiding_Pdf guiding_pdf(guiding_field ? guiding_field->find_distribution(hit.p, facing_normal) : nullptr);
+                Shape_Pdf plight(scene.lights, hit.p);
+                Mixture_Pdf guided_light(&guiding_pdf, &plight);
+
+                Pdf* other_pdf = nullptr;
+                if (Features & Render_Light_Sampling)
+                    other_pdf = guiding_pdf.distribution ? static_cast<Pdf*>(&guided_light) : &plight;
+                else if (guiding_pdf.distribution)
+                    other_pdf = &guiding_pdf;
+                Mixture_Pdf mixture(other_pdf, scatter_info.pdf);
+                Pdf* sampling_pdf = other_pdf ? &mixture : scatter_info.pdf;
+
+                Ray scattered(hit.p, sampling_pdf->generate(rng), ray.time);
+                float pdf = sampling_pdf->value(scattered.direction);
+                if (Features & Render_Texture_Filtering)
+                    scattered.set_cone(cone_width, ray.cone_spread);
+
+                delete scatter_info.pdf;
+
+                Path_State next_state = scattering_medium ? Path_State::other : Path_State::after_diffuse;
+                Vector incoming = trace_path<Features>(rng, scattered, scene, depth + 1, next_state);
+                Vector incident_radiance = hit.material->scattering_pdf(ray, hit, scattered) * incoming / pdf;
+                if (guiding_field && dot_product(scattered.direction, facing_normal) > 0.f)
+                    guiding_field->record(hit.p, facing_normal, scattered.direction, incoming, pdf);
+                if (cache)
+                    cache->record(hit.p, facing_normal, incident_radiance);
+
+                return emitted + transmittance * (caustic + scatter_info.attenuation * incident_radiance);
+            }
+        }
+        else {
+            STATS_INCREMENT(paths_absorbed);
+            return emitted;
+        }
+    }
+    else {
+        STATS_INCREMENT(paths_missed);
+        return Vector(0);
+    }
+}
+
+// Renders the tile one sample per pixel at a time, the primary rays of each pass are intersected as one batch.
+template <unsigned Features>
+void render_pixels_batched(RNG& rng, const Scene& scene, int image_width, int image_height, int sample_count,
+                           const Tile& tile, Film_Tile* film_tile, std::vector<int64_t>* pixel_costs)
+{
+    constexpr bool depth_of_field = (Features & Render_Depth_Of_Field) != 0;
+    constexpr bool motion_blur = (Features & Render_Motion_Blur) != 0;
+
+    int tile_width = tile.x2 - tile.x1;
+    int pixel_count = tile_width * (tile.y2 - tile.y1);
+    std::vector<float> xs(pixel_count), ys(pixel_count);
+    std::vector<Ray> rays(pixel_count);
+    std::vector<float> t_max(pixel_count);
+    std::vector<Ray_Hit> hits(pixel_count);
+#if ENABLE_STATS
+    std::vector<int64_t> costs(pixel_count, 0);
+#endif
+
+    for (int s = 0; s < sample_count; s++) {
+        for (int p = 0; p < pixel_count; p++) {
+            xs[p] = float(tile.x1 + p % tile_width) + rng.random_float();
+            ys[p] = float(tile.y1 + p / tile_width) + rng.random_float();
+            rays[p] = scene.camera.get_ray<depth_of_field, motion_blur>(rng, xs[p] / float(image_width), ys[p] / float(image_height));
+            t_max[p] = std::numeric_limits<float>::max();
+        }
+
+#if ENABLE_STATS
+        int64_t batch_start_cost = thread_stats.cost();
+#endif
+        scene.shape->hit_batch(rays.data(), pixel_count, 0.001f, t_max.data(), hits.data());
+#if ENABLE_STATS
+        // The batch cost is shared evenly, it cannot be attributed to single pixels.
+        int64_t batch_cost = (thread_stats.cost() - batch_start_cost) / pixel_count;
+#endif
+
+        for (int p = 0; p < pixel_count; p++) {
+#if ENABLE_STATS
+            int64_t start_cost = thread_stats.cost();
+#endif
+            STATS_INCREMENT_DEPTH(0);
+            bool surface_hit = t_max[p] < std::numeric_limits<float>::max();
+            Vector color = shade_path<Features>(rng, rays[p], scene, 0, Path_State::other, surface_hit, hits[p]);
+            if (film_tile)
+                film_tile->add_sample(xs[p], ys[p], color);
+#if ENABLE_STATS
+            costs[p] += thread_stats.cost() - start_cost + batch_cost;
+#endif
+        }
+    }
+
+#if ENABLE_STATS
+    if (pixel_costs) {
+        for (int p = 0; p < pixel_count; p++)
+            (*pixel_costs)[(tile.y1 + p / tile_width) * image_width + tile.x1 + p % tile_width] = costs[p];
+    }
+#endif
+}
+
+template <unsigned Features>
+void render_pixels(RNG& rng, const Scene& scene, int image_width, int image_height, int sample_count,
+                   const Tile& tile, Film_Tile* film_tile, std::vector<int64_t>* pixel_costs)
+{
+    constexpr bool depth_of_field = (Features & Render_Depth_Of_Field) != 0;
+    constexpr bool motion_blur = (Features & Render_Motion_Blur) != 0;
+
+    if (Features & Render_Streamed_Geometry) {
+        render_pixels_batched<Features>(rng, scene, image_width, image_height, sample_count, tile, film_tile, pixel_costs);
+        return;
+    }
+
+    for (int j = tile.y1; j < tile.y2; j++) {
+        for (int i = tile.x1; i < tile.x2; i++) {
+#if ENABLE_STATS
+            int64_t start_cost = thread_stats.cost();
+#endif
+
+            for (int s = 0; s < sample_count; s++) {
+                float x = float(i) + rng.random_float();
+                float y = float(j) + rng.random_float();
+
+                Ray ray = scene.camera.get_ray<depth_of_field, motion_blur>(rng, x / float(image_width), y / float(image_height));
+                Vector color = trace_path<Features>(rng, ray, scene, 0, Path_State::other);
+                if (film_tile)
+                    film_tile->add_sample(x, y, color);
+            }
+
+#if ENABLE_STATS
+            if (pixel_costs)
+                (*pixel_costs)[j * image_width + i] = thread_stats.cost() - start_cost;
+#endif
+        }
+    }
+}
+
+using Render_Kernel = void (*)(RNG&, const Scene&, int, int, int, const Tile&, Film_Tile*, std::vector<int64_t>*);
+
+template <size_t... Features>
+std::array<Render_Kernel, sizeof...(Features)> make_render_kernels(std::index_sequence<Features...>) {
+    return {{ &render_pixels<Features>... }};
+}
+
+const std::array<Render_Kernel, Render_All_Features + 1> render_kernels =
+    make_render_kernels(std::make_index_sequence<Render_All_Features + 1>());
+} // namespace
+
+Vector trace_ray(RNG& rng, const Ray& ray, const Scene& scene, int depth) {
+    return trace_path<Render_All_Features>(rng, ray, scene, depth, Path_State::other);
+}
+
+void Render_Rect_Task::run(RNG& thread_rng) {
+    Timestamp t;
+    Film_Tile film_tile;
+    if (film)
+        film_tile = film->create_tile(get_tile());
+
+    RNG tile_rng(seed, (uint64_t(y1) << 32) | uint32_t(x1));
+    RNG& rng = seed ? tile_rng : thread_rng;
+
+    if (integrator == Integrator::bidirectional) {
+        render_pixels_bidirectional(rng, *scene, image_width, image_height, sample_count, get_tile(),
+                                    film ? &film_tile : nullptr, film, pixel_costs);
+    } else {
+        render_kernels[features](rng, *scene, image_width, image_height, sample_count, get_tile(),
+                                 film ? &film_tile : nullptr, pixel_costs);
+    }
+
+    if (film)
+        film->merge_tile(film_tile);
+    if (scene->guiding_field)
+        scene->guiding_field->flush();
+    elapsed_microseconds = ::elapsed_microseconds(t);
+    // The owner may destroy the task once the counter is complete, the event outlives it.
+    HANDLE event = done_event;
+    if (progress_counter)
+        *progress_counter += int64_t(x2 - x1) * (y2 - y1);
+    if (event)
+        ::SetEvent(event);
+}
+
+void run_tasks(std::vector<Render_Rect_Task>& tasks) {
+    for (auto& task : tasks) {
+		Thread::queue_task(&task, task.get_node());
+	}
+	Thread::wait_for_tasks();
+}
+
+namespace {
+class Node_Replica_Task : public Task {
+public:
+    Node_Replica_Task(Shape* shape, int node) : shape(shape), node(node) {}
+    void run(RNG& rng) override { shape->create_node_replica(node); }
+
+private:
+    Shape* shape;
+    int node;
+};
+}
+
+void replicate_scene_to_nodes(Scene& scene) {
+    for (int node = 1; node < Thread::get_node_count(); node++) {
+        Node_Replica_Task task(scene.shape, node);
+        Thread::queue_task(&task, node, true);
+        Thread::wait_for_tasks();
+    }
+}
+
+namespace {
+// Measures the costs for scheduling with a 1 spp pass that doesn't touch the film.
+void measure_costs(const Scene& scene, Cost_Map& cost_map, int nx, int ny, unsigned features,
+                   std::vector<int64_t>& pixel_costs, Integrator integrator)
+{
+    int block_size = cost_map.get_block_size();
+    std::vector<Render_Rect_Task> tasks;
+    for (int y = 0; y < ny; y += block_size) {
+        for (int x = 0; x < nx; x += block_size) {
+            tasks.push_back(Render_Rect_Task(&scene, nx, ny, 1, x, y, std::min(x + block_size, nx), std::min(y + block_size, ny), nullptr, &pixel_costs, features));
+            tasks.back().set_integrator(integrator);
+        }
+    }
+    run_tasks(tasks);
+    for (const auto& task : tasks)
+        cost_map.add_tile_cost(task.get_tile(), float(task.get_elapsed_microseconds()));
+}
+
+// Adds sample_count samples per pixel to the film and the render time of each tile to tile_costs.
+void render_pass(const Scene& scene, Film& film, const std::vector<Tile>& tiles, int nx, int ny, int sample_count,
+                 unsigned features, std::vector<int64_t>& pixel_costs, Integrator integrator, uint64_t seed,
+                 std::vector<int64_t>& tile_costs)
+{
+    std::vector<Render_Rect_Task> tasks;
+    for (const Tile& tile : tiles) {
+        tasks.push_back(Render_Rect_Task(&scene, nx, ny, sample_count, tile.x1, tile.y1, tile.x2, tile.y2, &film, &pixel_costs, features));
+        tasks.back().set_integrator(integrator);
+        tasks.back().set_seed(seed);
+    }
+    run_tasks(tasks);
+
+    for (size_t i = 0; i < tasks.size(); i++)
+        tile_costs[i] += tasks[i].get_elapsed_microseconds();
+}
+
+uint64_t get_pass_seed(uint64_t seed, int pass) {
+    return seed ? seed + uint64_t(pass) * 0x9e3779b97f4a7c15ull : 0;
+}
+}
+
+void render_frame(const Scene& scene, Film& film, Cost_Map& cost_map, int nx, int ny, int ns,
+                  int thread_count, std::vector<int64_t>& pixel_costs, Integrator integrator,
+                  int tile_size, uint64_t seed)
+{
+    unsigned features = get_render_features(scene);
+
+    if (seed) {
+        // Seeded renders schedule the plain tile grid.
+        cost_map.clear();
+    } else if (!cost_map.has_measurements()) {
+        measure_costs(scene, cost_map, nx, ny, features, pixel_costs, integrator);
+    }
+
+    // With a caustic photon map the samples are split into passes, each with a new set of photons.
+    // Path guiding doubles the samples of each pass instead and learns from the passes before.
+    Caustic_Photon_Map* caustic_map = (integrator == Integrator::path) ? scene.caustic_map : nullptr;
+    Guiding_Field* guiding_field = (integrator == Integrator::path) ? scene.guiding_field : nullptr;
+    std::vector<int> pass_sample_counts;
+    if (guiding_field) {
+        for (int done = 0; done < ns; ) {
+            int pass_sample_count = std::min(std::max(done, 1), ns - done);
+            // A short last pass joins the one before.
+            if (ns - done - pass_sample_count < pass_sample_count)
+                pass_sample_count = ns - done;
+            pass_sample_counts.push_back(pass_sample_count);
+            done += pass_sample_count;
+        }
+    } else {
+        int pass_count = caustic_map ? std::max(1, std::min(caustic_map->get_pass_count(), ns)) : 1;
+        for (int pass = 0; pass < pass_count; pass++)
+            pass_sample_counts.push_back(ns * (pass + 1) / pass_count - ns * pass / pass_count);
+    }
+    if (caustic_map)
+        caustic_map->reset();
+
+    film.clear();
+    film.set_splat_scale(1.f / float(ns));
+    std::vector<Tile> tiles = schedule_tiles(cost_map, nx, ny, tile_size, thread_count);
+    std::vector<int64_t> tile_costs(tiles.size(), 0);
+    for (int pass = 0; pass < int(pass_sample_counts.size()); pass++) {
+        if (caustic_map && pass < caustic_map->get_pass_count())
+            caustic_map->trace_pass(scene, thread_count);
+
+        // The last pass only samples the field.
+        bool last_pass = (pass + 1 == int(pass_sample_counts.size()));
+        if (guiding_field)
+            guiding_field->set_training(!last_pass || pass == 0);
+
+        render_pass(scene, film, tiles, nx, ny, pass_sample_counts[pass], features, pixel_costs, integrator,
+                    get_pass_seed(seed, pass), tile_costs);
+        if (guiding_field && !last_pass)
+            guiding_field->update();
+    }
+
+    cost_map.clear();
+    for (size_t i = 0; i < tiles.size(); i++)
+        cost_map.add_tile_cost(tiles[i], float(tile_costs[i]));
+}
+
+int render_frame_with_deadline(const Scene& scene, Film& film, Cost_Map& cost_map, int nx, int ny, int max_ns,
+                               int64_t time_budget_microseconds, int thread_count, std::vector<int64_t>& pixel_costs,
+                               Integrator integrator, int tile_size, uint64_t seed)
+{
+    // Margin on the estimated time of a pass, for the variance of the pass times.
+    const double Safety_Factor = 1.25;
+
+    Timestamp t;
+    unsigned features = get_render_features(scene);
+    if (seed)
+        cost_map.clear();
+
+    // A photon pass is traced before each of the first passes, like with the split of render_frame.
+    Caustic_Photon_Map* caustic_map = (integrator == Integrator::path) ? scene.caustic_map : nullptr;
+    if (caustic_map)
+        caustic_map->reset();
+    Guiding_Field* guiding_field = (integrator == Integrator::path) ? scene.guiding_field : nullptr;
+    if (guiding_field)
+        guiding_field->set_training(true);
+
+    film.clear();
+    // Without measurements the first pass runs on the plain grid and its timings schedule the rest,
+    // instead of a pre-pass that would only cost time.
+    std::vector<Tile> tiles = schedule_tiles(cost_map, nx, ny, tile_size, thread_count);
+    Cost_Map measured_costs(nx, ny, cost_map.get_block_size());
+
+    int sample_count = 0;
+    double sample_time = 0.0;
+    for (int pass = 0; sample_count < max_ns; pass++) {
+        // The sample count doubles with every pass, to keep the per-pass overhead small, but a pass
+        // is only started if it is estimated to finish before the deadline. The first one always runs.
+        int pass_sample_count = std::min(std::max(sample_count, 1), max_ns - sample_count);
+        if (sample_count > 0) {
+            int64_t remaining = time_budget_microseconds - elapsed_microseconds(t);
+            pass_sample_count = std::min(pass_sample_count, int(remaining / (sample_time * Safety_Factor)));
+            if (pass_sample_count <= 0)
+                break;
+        }
+
+        Timestamp pass_start;
+        if (caustic_map && pass < caustic_map->get_pass_count())
+            caustic_map->trace_pass(scene, thread_count);
+
+        std::vector<int64_t> tile_costs(tiles.size(), 0);
+        render_pass(scene, film, tiles, nx, ny, pass_sample_count, features, pixel_costs, integrator,
+                    get_pass_seed(seed, pass), tile_costs);
+        sample_count += pass_sample_count;
+        film.set_splat_scale(1.f / float(sample_count));
+        if (guiding_field)
+            guiding_field->update();
+
+        // The latest pass is the best estimate, the first ones include more fixed overhead.
+        sample_time = std::max(double(elapsed_microseconds(pass_start)), 1.0) / pass_sample_count;
+
+        for (size_t i = 0; i < tiles.size(); i++)
+            measured_costs.add_tile_cost(tiles[i], float(tile_costs[i]));
+        if (!cost_map.has_measurements() && !seed) {
+            cost_map = measured_costs;
+            tiles = schedule_tiles(cost_map, nx, ny, tile_size, thread_count);
+        }
+    }
+
+    cost_map = measured_costs;
+    return sample_count;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "film.h"
+#include "scenes.h"
+#include "thread.h"
+#include "tile_scheduler.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Scene features the render kernel is specialized on. Every combination is compiled separately
+// and the one matching the scene is picked once per render, so unused features cost nothing per path.
+enum Render_Feature : unsigned {
+    Render_Depth_Of_Field = 1 << 0,
+    Render_Motion_Blur = 1 << 1,
+    Render_Texture_Filtering = 1 << 2,
+    Render_Emitters = 1 << 3,
+    Render_Light_Sampling = 1 << 4,
+    // Primary rays of a tile are intersected as a batch, for geometry that is paged in.
+    Render_Streamed_Geometry = 1 << 5,
+    Render_All_Features = (1 << 6) - 1
+};
+
+enum class Integrator {
+    path,
+    // Connects subpaths from the camera and the lights, see bdpt.h.
+    bidirectional
+};
+
+// Features of the scene as seen from its camera, a combination of Render_Feature flags.
+unsigned get_render_features(const Scene& scene);
+
+// Traces a path with all features enabled.
+Vector trace_ray(RNG& rng, const Ray& ray, const Scene& scene, int depth);
+
+// A point on the lights of the scene with the emitting surface of the scene there, found by
+// probing both sides since the lights themselves carry no materials. The normal of isect faces
+// the emitting side. Sampled uniformly by area, pdf is per unit area.
+bool sample_light_point(RNG& rng, const Scene& scene, float time, Intersection& isect, float& pdf);
+// Density of sample_light_point at a point of an emitting surface hit from its emitting side.
+float get_light_point_pdf(const Scene& scene, const Intersection& isect, float time);
+
+class Render_Rect_Task : public Task {
+public:
+	Render_Rect_Task(
+        const Scene* scene,
+        int image_width,
+        int image_height,
+        int sample_count,
+        int x1, int y1, int x2, int y2,
+        Film* film,
+        std::vector<int64_t>* pixel_costs,
+        unsigned features = Render_All_Features
+    )
+        : scene(scene)
+        , image_width(image_width)
+        , image_height(image_height)
+        , sample_count(sample_count)
+        , x1(x1), y1(y1), x2(x2), y2(y2)
+        , film(film)
+        , pixel_costs(pixel_costs)
+        , features(features)
+        , elapsed_microseconds(0)
+        , progress_counter(nullptr)
+        , done_event(NULL)
+        , integrator(Integrator::path)
+        , seed(0)
+    {}
+
+    Tile get_tile() const { return Tile{x1, y1, x2, y2}; }
+    // NUMA node that renders the tile, each node takes a band of rows of the image.
+    int get_node() const { return y1 * Thread::get_node_count() / image_height; }
+    int64_t get_elapsed_microseconds() const { return elapsed_microseconds; }
+
+	void run(RNG& rng) override;
+
+    // Adds the number of finished pixels to the counter when the task is done.
+    void set_progress_counter(std::atomic<int64_t>* counter) { progress_counter = counter; }
+    // Signals the event when the task is done, after the progress counter.
+    void set_done_event(HANDLE event) { done_event = event; }
+    void set_integrator(Integrator integrator) { this->integrator = integrator; }
+    // With a nonzero seed the tile samples its own generator, seeded from it and the tile position,
+    // instead of the one of the thread that runs it.
+    void set_seed(uint64_t seed) { this->seed = seed; }
+
+private:
+    const Scene* scene;
+    int image_width, image_height;
+    int sample_count;
+	int x1, y1;
+	int	x2, y2;
+
+    Film* film;
+    std::vector<int64_t>* pixel_costs;
+    unsigned features;
+    int64_t elapsed_microseconds;
+    std::atomic<int64_t>* progress_counter;
+    HANDLE done_event;
+    Integrator integrator;
+    uint64_t seed;
+};
+
+void run_tasks(std::vector<Render_Rect_Task>& tasks);
+
+// Copies the hierarchies of the scene into the memory of every NUMA node but the first one (where
+// the main thread built them), on the threads of each node. The scene must not be rendered meanwhile.
+void replicate_scene_to_nodes(Scene& scene);
+
+// Renders one frame into the film. Scheduling uses the costs measured in the previous frame of
+// a sequence; without measurements a cheap 1 spp pre-pass estimates them first.
+// A nonzero seed makes the image reproducible for the same seed and tile size: the tiles are a
+// plain grid then, independent of timings and of the thread count.
+// With a guiding field the samples are split into passes that double, the field learns from each
+// pass for the ones after it.
+void render_frame(const Scene& scene, Film& film, Cost_Map& cost_map, int nx, int ny, int ns,
+                  int thread_count, std::vector<int64_t>& pixel_costs, Integrator integrator = Integrator::path,
+                  int tile_size = 32, uint64_t seed = 0);
+
+// Renders progressive passes over the whole image until the next one is estimated to miss the
+// deadline, time_budget_microseconds after the call, or max_ns samples per pixel are reached.
+// The cost of a pass is estimated from the time per sample of the previous one; the first pass
+// (1 spp) always runs. Returns the samples per pixel in the film.
+int render_frame_with_deadline(const Scene& scene, Film& film, Cost_Map& cost_map, int nx, int ny, int max_ns,
+                               int64_t time_budget_microseconds, int thread_count, std::vector<int64_t>& pixel_costs,
+                               Integrator integrator = Integrator::path, int tile_size = 32, uint64_t seed = 0);
@@ -1,10 +1,73 @@
 #include "scenes.h"
 
+#include "compressed_bvh.h"
+#include "dynamic_bvh.h"
+#include "flat_bvh.h"
+#include "motion_bvh.h"
+#include "perlin.h"
+#include "streamed_geometry.h"
+#include "tiled_texture.h"
+
+#include <map>
+#include <string>
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "../third_party//stb_image.h"
 
+// Loads an image texture once per file. A pre-tiled version of the image (same name with
+// the .tex extension, see convert_to_tiled_texture) is preferred: it is memory-mapped and
+// paged in through the texture cache instead of decoding the whole image at startup.
+static Texture* load_image_texture(const std::string& file_name) {
+    static std::map<std::string, Texture*> textures;
+
+    auto it = textures.find(file_name);
+    if (it != textures.end())
+        return it->second;
+
+    Texture* texture = nullptr;
+    // Image textures are shared by all scenes that use them.
+    Scene_Resources::Recording_Scope shared_scope(nullptr);
+
+    std::string tiled_file_name = file_name.substr(0, file_name.find_last_of('.')) + ".tex";
+    auto tiled_file = new Tiled_Texture_File;
+    if (tiled_file->open(tiled_file_name)) {
+        texture = new Tiled_Image_Texture(tiled_file, &get_texture_cache());
+    } else {
+        delete tiled_file;
+        int w, h, c;
+        unsigned char* pixels = stbi_load(file_name.c_str(), &w, &h, &c, STBI_rgb);
+        if (pixels) {
+            texture = new Image_Texture(pixels, w, h);
+        } else {
+            fprintf(stderr, "failed to load %s, using a constant texture\n", file_name.c_str());
+            texture = new Constant_Texture(Vector(0.5f));
+        }
+    }
+
+    textures[file_name] = texture;
+    return texture;
+}
+
+// Hierarchy over many static shapes, the cache file is used by Flat_BVH only.
+static Shape* create_static_bvh(const std::vector<Shape*>& shapes, const std::string& cache_file) {
+#if USE_COMPRESSED_BVH
+    return new Compressed_BVH(shapes, 0, 1);
+#else
+    return new Flat_BVH(shapes, 0, 1, cache_file);
+#endif
+}
+
+static Camera cornell_camera(float aspect) {
+    return Camera(
+        Vector (278, 278, -800),
+        Vector(278, 278, 0),
+        Vector(0, 1, 0),
+        40.f, aspect, 0.f, 10.f, 0.f, 1.f
+    );
+}
+
 Scene cornell_box(float aspect) {
-    Shape** list = new Shape*[8];
+    Shape** list = new_scene_array<Shape*>(8);
     
     Material* red = new Lambertian(new Constant_Texture(Vector(0.65f, 0.05f, 0.05f)));
     Material* white = new Lambertian(new Constant_Texture(Vector(0.73f, 0.73f, 0.73f)));
@@ -34,104 +97,404 @@ Scene cornell_box(float aspect) {
                     15),
                 Vector(265, 0, 295));
 
+    Shape** lights = new_scene_array<Shape*>(2);
+    lights[0] = new XZ_Rect(213, 343, 227, 332, 554, nullptr);
+    lights[1] = new Sphere(Vector(190, 90, 190), 90, nullptr);
+
+    Scene scene{new HitableList(list, 8), cornell_camera(aspect)};
+    scene.lights = new HitableList(lights, 2);
+    return scene;
+}
+
+Scene cornell_smoke(float aspect) {
+    Shape** list = new_scene_array<Shape*>(6);
+    
+    Material* red = new Lambertian(new Constant_Texture(Vector(0.65f, 0.05f, 0.05f)));
+    Material* white = new Lambertian(new Constant_Texture(Vector(0.73f, 0.73f, 0.73f)));
+    Material* green = new Lambertian(new Constant_Texture(Vector(0.12f, 0.45f, 0.15f)));
+    Material* light = new Diffuse_Light(new Constant_Texture(Vector(7, 7, 7)));
+
+    list[0] = new Flip_Normals(new YZ_Rect(0, 555, 0, 555, 555, green));
+    list[1] = new YZ_Rect(0, 555, 0, 555, 0, red);
+    list[2] = new Flip_Normals(new XZ_Rect(113, 443, 127, 432, 554, light));
+    list[3] = new Flip_Normals(new XZ_Rect(0, 555, 0, 555, 555, white));
+    list[4] = new XZ_Rect(0, 555, 0, 555, 0, white);
+    list[5] = new Flip_Normals(new XY_Rect(0, 555, 0, 555, 555, white));
+
+    auto b1 = new Translate(
+                    new Rotate_Y(
+                        new Box(Vector(0), Vector(165, 165, 165), white),
+                        -18),
+                    Vector(130, 0, 65));
+
+    auto b2 = new Translate(
+                new Rotate_Y(
+                    new Box(Vector(0), Vector(165, 330, 165), white),
+                    15),
+                Vector(265, 0, 295));
+
+    Scene scene{new HitableList(list, 6), cornell_camera(aspect)};
+    scene.lights = new XZ_Rect(113, 443, 127, 432, 554, nullptr);
+    scene.media.push_back(new Homogeneous_Medium(b1, 0.01f, new Constant_Texture(Vector(1.f))));
+    scene.media.push_back(new Homogeneous_Medium(b2, 0.01f, new Constant_Texture(Vector(0.f)), true));
+    return scene;
+}
+
+Scene cornell_cloud(float aspect) {
+    Shape** list = new_scene_array<Shape*>(6);
+
+    Material* red = new Lambertian(new Constant_Texture(Vector(0.65f, 0.05f, 0.05f)));
+    Material* white = new Lambertian(new Constant_Texture(Vector(0.73f, 0.73f, 0.73f)));
+    Material* green = new Lambertian(new Constant_Texture(Vector(0.12f, 0.45f, 0.15f)));
+    Material* light = new Diffuse_Light(new Constant_Texture(Vector(15, 15, 15)));
+
+    list[0] = new Flip_Normals(new YZ_Rect(0, 555, 0, 555, 555, green));
+    list[1] = new YZ_Rect(0, 555, 0, 555, 0, red);
+    list[2] = new Flip_Normals(new XZ_Rect(213, 343, 227, 332, 554, light));
+    list[3] = new Flip_Normals(new XZ_Rect(0, 555, 0, 555, 555, white));
+    list[4] = new XZ_Rect(0, 555, 0, 555, 0, white);
+    list[5] = new Flip_Normals(new XY_Rect(0, 555, 0, 555, 555, white));
+
+    RNG rng;
+    Perlin perlin(rng);
+    Bounding_Box cloud_bounds(Vector(80, 60, 80), Vector(475, 420, 475));
+
+    Scene scene{new HitableList(list, 6), cornell_camera(aspect)};
+    scene.lights = new XZ_Rect(213, 343, 227, 332, 554, nullptr);
+    scene.media.push_back(create_noise_medium(perlin, cloud_bounds, 128, 0.01f, 0.05f, new Constant_Texture(Vector(0.9f))));
+    return scene;
+}
+
+namespace {
+class Cornell_Animation : public Animation {
+public:
+    Cornell_Animation(float aspect, Rotate_Y* box_rotation, Translate* sphere_translation, Translate* cube_translation)
+        : aspect(aspect)
+        , box_rotation(box_rotation)
+        , sphere_translation(sphere_translation)
+        , cube_translation(cube_translation)
+    {}
+
+    void set_frame(Scene& scene, float time) override {
+        box_rotation->set_angle(15.f + 360.f * time);
+
+        float bounce = std::abs(std::sin(3.f * PI * time));
+        sphere_translation->set_translation(Vector(400, 70 + 250 * bounce, 150));
+        cube_translation->set_translation(Vector(60 + 300 * time, 0, 60));
+
+        float camera_angle = 0.12f * std::sin(2.f * PI * time);
+        Vector look_at(278, 278, 0);
+        Vector look_from = look_at + 1078.f * Vector(std::sin(camera_angle), 0, -std::cos(camera_angle));
+        scene.camera = Camera(look_from, look_at, Vector(0, 1, 0), 40.f, aspect, 0.f, 10.f, 0.f, 1.f);
+    }
+
+private:
+    float aspect;
+    Rotate_Y* box_rotation;
+    Translate* sphere_translation;
+    Translate* cube_translation;
+};
+}
+
+Scene cornell_animation(float aspect) {
+    Material* red = new Lambertian(new Constant_Texture(Vector(0.65f, 0.05f, 0.05f)));
+    Material* white = new Lambertian(new Constant_Texture(Vector(0.73f, 0.73f, 0.73f)));
+    Material* green = new Lambertian(new Constant_Texture(Vector(0.12f, 0.45f, 0.15f)));
+    Material* light = new Diffuse_Light(new Constant_Texture(Vector(15, 15, 15)));
+    Material* aluminum = new Metal(Vector(0.8f, 0.85f, 0.88f), 0.f);
+
+    std::vector<Shape*> shapes;
+    shapes.push_back(new Flip_Normals(new YZ_Rect(0, 555, 0, 555, 555, green)));
+    shapes.push_back(new YZ_Rect(0, 555, 0, 555, 0, red));
+    shapes.push_back(new Flip_Normals(new XZ_Rect(213, 343, 227, 332, 554, light)));
+    shapes.push_back(new Flip_Normals(new XZ_Rect(0, 555, 0, 555, 555, white)));
+    shapes.push_back(new XZ_Rect(0, 555, 0, 555, 0, white));
+    shapes.push_back(new Flip_Normals(new XY_Rect(0, 555, 0, 555, 555, white)));
+
+    // The box rotates around its own vertical axis.
+    auto box_rotation = new Rotate_Y(new Translate(new Box(Vector(0), Vector(165, 330, 165), white), Vector(-82.5f, 0, -82.5f)), 15);
+    shapes.push_back(new Translate(box_rotation, Vector(347, 0, 377)));
+
+    auto sphere_translation = new Translate(new Sphere(Vector(0), 70, aluminum), Vector(400, 70, 150));
+    shapes.push_back(sphere_translation);
+
+    auto cube_translation = new Translate(new Box(Vector(0), Vector(100, 100, 100), red), Vector(60, 0, 60));
+    shapes.push_back(cube_translation);
+
+    auto animation = new Cornell_Animation(aspect, box_rotation, sphere_translation, cube_translation);
+
+    Scene scene{new Dynamic_BVH(shapes, 0.f, 1.f), cornell_camera(aspect)};
+    scene.lights = new XZ_Rect(213, 343, 227, 332, 554, nullptr);
+    scene.animation = animation;
+    animation->set_frame(scene, 0.f);
+    scene.shape->refit();
+    return scene;
+}
+
+Scene final_scene(float aspect) {
+    RNG rng;
+    rng.random_float();
+
+    int nb = 20;
+    Shape** list = new_scene_array<Shape*>(30);
+    std::vector<Shape*> boxlist;
+    std::vector<Shape*> boxlist2;
+    Material* white = new Lambertian(new Constant_Texture(Vector(0.73f)));
+    Material* ground = new Lambertian(new Constant_Texture(Vector(0.48f, 0.83f, 0.53f)));
+
+    for (int i = 0; i < nb; i++) {
+        for (int j = 0; j < nb; j++) {
+            float w = 100;
+            float x0 = -1000 + i*w;
+            float z0 = -1000 + j*w;
+            float y0 = 0;
+            float x1 = x0 + w;
+            float y1 = 100 * (rng.random_float() + 0.01f);
+            float z1 = z0 + w;
+            boxlist.push_back(new Box(Vector(x0, y0, z0), Vector(x1, y1, z1), ground));
+        }
+    }
+
+    int l = 0;
+
+    list[l++] = create_static_bvh(boxlist, "final_scene_ground.bvh");
+
+    Material* light = new Diffuse_Light(new Constant_Texture(Vector(7)));
+    list[l++] = new Flip_Normals(new XZ_Rect(123, 423, 147, 412, 554, light));
+
+    Vector center(400, 400, 200);
+    list[l++] = new Moving_Sphere(center, center + Vector(30, 0, 0), 0, 1, 50,
+        new Lambertian(new Constant_Texture(Vector(0.7f, 0.3f, 0.1f))));
+
+    list[l++] = new Sphere(Vector(260, 150, 45), 50, new Dielectric(1.5f));
+    list[l++] = new Sphere(Vector(0, 150, 145), 50, new Metal(Vector(0.8f, 0.8f, 0.9f), 10.f));
+
+    std::vector<Medium*> media;
+
+    Shape* boundary = new Sphere(Vector(360, 150, 145), 70, new Dielectric(1.5f));
+    list[l++] = boundary;
+    media.push_back(new Homogeneous_Medium(boundary, 0.2f, new Constant_Texture(Vector(0.2f, 0.4f, 0.9f))));
+
+    boundary = new Sphere(Vector(0), 5000, nullptr);
+    media.push_back(new Homogeneous_Medium(boundary, 1e-4f, new Constant_Texture(Vector(1))));
+
+    Material* mat = new Lambertian(load_image_texture("texture.jpg"));
+    list[l++] = new Sphere(Vector(400, 200, 400), 100, mat);
+
+    // The turbulence is baked over the sphere in noise space (scaled by the texture scale).
+    const float noise_scale = 0.1f;
+    Vector noise_center(220, 280, 300);
+    float noise_radius = 80;
+    Perlin* perlin = new Perlin(rng);
+    Baked_Turbulence* baked_turbulence = new Baked_Turbulence(*perlin,
+        Bounding_Box(noise_scale * (noise_center - Vector(noise_radius)), noise_scale * (noise_center + Vector(noise_radius))), 64);
+    Texture* perlin_tex = new Noise_Texture(perlin, noise_scale, baked_turbulence);
+    list[l++] = new Sphere(noise_center, noise_radius, new Lambertian(perlin_tex));
+
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        boxlist2.push_back(new Sphere(
+            Vector(165.f * rng.random_float(),
+                   165.f * rng.random_float(),
+                   165.f * rng.random_float()),
+            10.f, white));
+    }
+    Shape* spheres = create_static_bvh(boxlist2, "final_scene_spheres.bvh");
+    list[l++] = new Translate(new Rotate_Y(spheres, 15.f), Vector(-100, 270, 395));
+
     Camera camera(
-        Vector (278, 278, -800),
+        Vector(478, 278, -600),
         Vector(278, 278, 0),
         Vector(0, 1, 0),
         40.f, aspect, 0.f, 10.f, 0.f, 1.f
     );
 
-    return Scene{new HitableList(list, 8), camera};
+    // The moving sphere makes the top level a motion BVH.
+    Scene scene{build_bvh(rng, list, l, 0.f, 1.f), camera};
+    scene.lights = new XZ_Rect(123, 423, 147, 412, 554, nullptr);
+    scene.media = std::move(media);
+    return scene;
+}
+
+// The random spheres of the first book, the diffuse ones bouncing up while the shutter is open.
+Scene bouncing_spheres(float aspect) {
+    RNG rng;
+
+    Texture* checker = new Checker_Texture(
+        new Constant_Texture(Vector(0.2f, 0.3f, 0.1f)),
+        new Constant_Texture(Vector(0.9f, 0.9f, 0.9f))
+    );
+
+    std::vector<Shape*> shapes;
+    shapes.push_back(new Sphere(Vector(0, -1000, 0), 1000, new Lambertian(checker)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            float choose_material = rng.random_float();
+            Vector center(a + 0.9f*rng.random_float(), 0.2f, b + 0.9f*rng.random_float());
+            if ((center - Vector(4, 0.2f, 0)).length() <= 0.9f)
+                continue;
+
+            if (choose_material < 0.8f) {
+                Vector albedo(rng.random_float()*rng.random_float(), rng.random_float()*rng.random_float(), rng.random_float()*rng.random_float());
+                shapes.push_back(new Moving_Sphere(center, center + Vector(0, 0.5f*rng.random_float(), 0), 0.f, 1.f, 0.2f,
+                    new Lambertian(new Constant_Texture(albedo))));
+            } else if (choose_material < 0.95f) {
+                Vector albedo(0.5f*(1 + rng.random_float()), 0.5f*(1 + rng.random_float()), 0.5f*(1 + rng.random_float()));
+                shapes.push_back(new Sphere(center, 0.2f, new Metal(albedo, 0.5f*rng.random_float())));
+            } else {
+                shapes.push_back(new Sphere(center, 0.2f, new Dielectric(1.5f)));
+            }
+        }
+    }
+
+    shapes.push_back(new Sphere(Vector(0, 1, 0), 1.0f, new Dielectric(1.5f)));
+    shapes.push_back(new Sphere(Vector(-4, 1, 0), 1.0f, new Lambertian(new Constant_Texture(Vector(0.4f, 0.2f, 0.1f)))));
+    shapes.push_back(new Sphere(Vector(4, 1, 0), 1.0f, new Metal(Vector(0.7f, 0.6f, 0.5f), 0.f)));
+
+    // There is no sky, a large area light above the spheres stands in for it.
+    Material* light = new Diffuse_Light(new Constant_Texture(Vector(4)));
+    shapes.push_back(new Flip_Normals(new XZ_Rect(-15, 15, -15, 15, 20, light)));
+
+    Camera camera(
+        Vector(13, 2, 3),
+        Vector(0, 0, 0),
+        Vector(0, 1, 0),
+        20.f, aspect, 0.1f, 10.f, 0.f, 1.f
+    );
+
+    Scene scene{build_bvh(rng, shapes.data(), static_cast<int>(shapes.size()), 0.f, 1.f), camera};
+    scene.lights = new XZ_Rect(-15, 15, -15, 15, 20, nullptr);
+    return scene;
+}
+
+// A field of spheres streamed from chunk files, which are generated on first use.
+Scene streamed_field(float aspect) {
+    const char* index_file = "streamed_field.geo";
+    const size_t residency_budget = size_t(8) << 20;
+
+    std::vector<Material*> materials = {
+        new Lambertian(new Constant_Texture(Vector(0.65f, 0.05f, 0.05f))),
+        new Lambertian(new Constant_Texture(Vector(0.12f, 0.45f, 0.15f))),
+        new Lambertian(new Constant_Texture(Vector(0.2f, 0.3f, 0.7f))),
+        new Lambertian(new Constant_Texture(Vector(0.73f))),
+        new Metal(Vector(0.8f, 0.85f, 0.88f), 0.1f)
+    };
+
+    auto field = new Streamed_Geometry(index_file, materials, residency_budget);
+    if (!field->is_valid()) {
+        RNG rng;
+        std::vector<Streamed_Sphere> spheres(400000);
+        for (Streamed_Sphere& sphere : spheres) {
+            sphere.radius = 2.f + 6.f * rng.random_float();
+            sphere.center[0] = -2000.f + 4000.f * rng.random_float();
+            sphere.center[1] = sphere.radius;
+            sphere.center[2] = -2000.f + 4000.f * rng.random_float();
+            sphere.material = std::min(static_cast<uint32_t>(rng.random_float() * materials.size()), uint32_t(materials.size() - 1));
+        }
+        write_streamed_geometry(index_file, std::move(spheres), static_cast<uint32_t>(materials.size()), 8192);
+        field = new Streamed_Geometry(index_file, materials, residency_budget);
+    }
+
+    Shape** list = new_scene_array<Shape*>(3);
+    Material* ground = new Lambertian(new Constant_Texture(Vector(0.48f, 0.83f, 0.53f)));
+    Material* light = new Diffuse_Light(new Constant_Texture(Vector(4)));
+    list[0] = field;
+    list[1] = new XZ_Rect(-3000, 3000, -3000, 3000, 0, ground);
+    list[2] = new Flip_Normals(new XZ_Rect(-1000, 1000, -1000, 1000, 1500, light));
+
+    Camera camera(
+        Vector(0, 120, -2100),
+        Vector(0, 0, -1000),
+        Vector(0, 1, 0),
+        40.f, aspect, 0.f, 10.f, 0.f, 1.f
+    );
+
+    Scene scene{new HitableList(list, 3), camera};
+    scene.lights = new XZ_Rect(-1000, 1000, -1000, 1000, 1500, nullptr);
+    return scene;
 }
 
-//Shape* final_scene(RNG& rng) {
-//    rng.random_float();
-//
-//    int nb = 20;
-//    Shape** list = new Shape*[30];
-//    Shape** boxlist = new Shape*[10000];
-//    Shape** boxlist2 = new Shape*[10000];
-//    Material* white = new Lambertian(new Constant_Texture(Vector(0.73f)));
-//    Material* ground = new Lambertian(new Constant_Texture(Vector(0.48f, 0.83f, 0.53f)));
-//    int b = 0;
-//
-//    for (int i = 0; i < nb; i++) {
-//        for (int j = 0; j < nb; j++) {
-//            float w = 100;
-//            float x0 = -1000 + i*w;
-//            float z0 = -1000 + j*w;
-//            float y0 = 0;
-//            float x1 = x0 + w;
-//            float y1 = 100 * (rng.random_float() + 0.01f);
-//            float z1 = z0 + w;
-//            boxlist[b++] = new Box(Vector(x0, y0, z0), Vector(x1, y1, z1), ground);
-//        }
-//    }
-//
-//    int l = 0;
-//
-//    list[l++] = new BVH_Node(rng, boxlist, b, 0, 1);
-//
-//    Material* light = new Diffuse_Light(new Constant_Texture(Vector(7)));
-//    list[l++] = new XZ_Rect(123, 423, 147, 412, 554, light);
-//
-//    Vector center(400, 400, 200);
-//    list[l++] = new Moving_Sphere(center, center + Vector(30, 0, 0), 0, 1, 50,
-//        new Lambertian(new Constant_Texture(Vector(0.7f, 0.3f, 0.1f))));
-//
-//    list[l++] = new Sphere(Vector(260, 150, 45), 50, new Dielectric(1.5f));
-//    list[l++] = new Sphere(Vector(0, 150, 145), 50, new Metal(Vector(0.8f, 0.8f, 0.9f), 10.f));
-//
-//    Shape* boundary = new Sphere(Vector(360, 150, 145), 70, new Dielectric(1.5f));
-//    list[l++] = boundary;
-//    list[l++] = new Constant_Medium(boundary, 0.2f, new Constant_Texture(Vector(0.2f, 0.4f, 0.9f)));
-//
-//    boundary = new Sphere(Vector(0), 5000, new Dielectric(1.5));
-//    list[l++] = new Constant_Medium(boundary, 1e-4f, new Constant_Texture(Vector(1)));
-//
-//    int nx, ny, nn;
-//    unsigned char* tex_data = stbi_load("texture.jpg", &nx, &ny, &nn, STBI_rgb);
-//    Material* mat = new Lambertian(new Image_Texture(tex_data, nx, ny));
-//    list[l++] = new Sphere(Vector(400, 200, 400), 100, mat);
-//
-//    Texture* perlin_tex = new Noise_Texture(0.1f);
-//    list[l++] = new Sphere(Vector(220, 280, 300), 80, new Lambertian(perlin_tex));
-//
-//    int ns = 1000;
-//    for (int j = 0; j < ns; j++) {
-//        boxlist2[j] = new Sphere(
-//            Vector(165.f * rng.random_float(),
-//                   165.f * rng.random_float(),
-//                   165.f * rng.random_float()),
-//            10.f, white);
-//    }
-//    list[l++] = new Translate(new Rotate_Y(new BVH_Node(rng, boxlist2, ns, 0, 1), 15.f), Vector(-100, 270, 395));
-//
-//    return new HitableList(list, l);
-//}
+Scene* create_scene(const std::string& name, float aspect) {
+    static const struct {
+        const char* name;
+        Scene (*create)(float aspect);
+    } scenes[] = {
+        {"cornell_box", cornell_box},
+        {"cornell_smoke", cornell_smoke},
+        {"cornell_cloud", cornell_cloud},
+        {"cornell_animation", cornell_animation},
+        {"final_scene", final_scene},
+        {"bouncing_spheres", bouncing_spheres},
+        {"streamed_field", streamed_field},
+        {"two_spheres", two_spheres_scene},
+        {"simple_light", simple_light_scene},
+    };
+
+    for (const auto& entry : scenes) {
+        if (name == entry.name)
+            return new Scene(entry.create(aspect));
+    }
+    return nullptr;
+}
 
 Shape* two_perlin_spheres() {
-    int w, h, c;
-    unsigned char* pixels = stbi_load("texture.jpg", &w, &h, &c, STBI_rgb);
+    RNG rng;
+    Perlin* perlin = new Perlin(rng);
 
-    Texture* perlin_texture = new Noise_Texture(5.f);
-    Shape** list = new Shape*[2];
+    Texture* perlin_texture = new Noise_Texture(perlin, 5.f);
+    Shape** list = new_scene_array<Shape*>(2);
     list[0] = new Sphere(Vector(0, -1000, 0), 1000, new Lambertian(perlin_texture));
-    list[1] = new Sphere(Vector(0, 2, 0), 2, new Lambertian(new Image_Texture(pixels, w, h)/*perlin_texture*/));
+    list[1] = new Sphere(Vector(0, 2, 0), 2, new Lambertian(load_image_texture("texture.jpg")/*perlin_texture*/));
     return new HitableList(list, 2);
 }
 
 Shape* simple_light() {
-    int w, h, c;
-    unsigned char* pixels = stbi_load("texture.jpg", &w, &h, &c, STBI_rgb);
-    Texture* image_texture = new Image_Texture(pixels, w, h);
+    Texture* image_texture = load_image_texture("texture.jpg");
 
-    Texture* perlin_texture = new Noise_Texture(4.f);
+    RNG rng;
+    Perlin* perlin = new Perlin(rng);
+    Texture* perlin_texture = new Noise_Texture(perlin, 4.f);
 
-    Shape** list = new Shape*[4];
+    Shape** list = new_scene_array<Shape*>(4);
     list[0] = new Sphere(Vector(0, -1000, 0), 1000, new Lambertian(perlin_texture));
     list[1] = new Sphere(Vector(0, 2, 0), 2, new Lambertian(image_texture));
     list[2] = new Sphere(Vector(0, 7, -1), 2, new Diffuse_Light(new Constant_Texture(Vector(4, 4, 4))));
     list[3] = new XY_Rect(3, 5, 1, 3, -2, new Diffuse_Light(new Constant_Texture(Vector(4, 4, 4))));
     return new HitableList(list, 4);
+}
+
+Scene two_spheres_scene(float aspect) {
+    // The spheres are lit by a rect behind the camera, there is no sky.
+    Shape** list = new_scene_array<Shape*>(2);
+    list[0] = two_spheres();
+    list[1] = new Flip_Normals(new YZ_Rect(-3, 5, -2, 6, 16, new Diffuse_Light(new Constant_Texture(Vector(4, 4, 4)))));
+
+    Camera camera(
+        Vector(13, 2, 3),
+        Vector(0, 0, 0),
+        Vector(0, 1, 0),
+        20.f, aspect, 0.f, 10.f, 0.f, 1.f
+    );
+
+    Scene scene{new HitableList(list, 2), camera};
+    scene.lights = new YZ_Rect(-3, 5, -2, 6, 16, nullptr);
+    return scene;
+}
+
+Scene simple_light_scene(float aspect) {
+    Camera camera(
+        Vector(26, 3, 6),
+        Vector(0, 2, 0),
+        Vector(0, 1, 0),
+        20.f, aspect, 0.f, 10.f, 0.f, 1.f
+    );
+
+    Shape** lights = new_scene_array<Shape*>(2);
+    lights[0] = new Sphere(Vector(0, 7, -1), 2, nullptr);
+    lights[1] = new XY_Rect(3, 5, 1, 3, -2, nullptr);
+
+    Scene scene{simple_light(), camera};
+    scene.lights = new HitableList(lights, 2);
+    return scene;
 }
\ No newline at end of file
@@ -0,0 +1,38 @@
+#include "scene_resources.h"
+
+#include <new>
+
+static thread_local Scene_Resources* recording_resources = nullptr;
+
+void* Scene_Object::operator new(size_t size) {
+    void* p = ::operator new(size);
+    if (recording_resources) {
+        recording_resources->objects.push_back(static_cast<Scene_Object*>(p));
+        recording_resources->memory_usage += size;
+    }
+    return p;
+}
+
+void Scene_Object::operator delete(void* p) {
+    ::operator delete(p);
+}
+
+void Scene_Object::add_memory_usage(size_t bytes) {
+    if (recording_resources)
+        recording_resources->memory_usage += bytes;
+}
+
+Scene_Resources::~Scene_Resources() {
+    for (auto it = objects.rbegin(); it != objects.rend(); ++it)
+        delete *it;
+}
+
+Scene_Resources::Recording_Scope::Recording_Scope(Scene_Resources* resources)
+    : previous(recording_resources)
+{
+    recording_resources = resources;
+}
+
+Scene_Resources::Recording_Scope::~Recording_Scope() {
+    recording_resources = previous;
+}
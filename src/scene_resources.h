@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class Scene_Resources;
+
+// Base of the objects a scene is made of (shapes, materials, textures, media...). Scene objects
+// allocated on a thread that is recording into a Scene_Resources are owned by it and are
+// destroyed together with it, which lets a long running process drop whole scenes.
+// Recorded objects must not be deleted individually.
+class Scene_Object {
+public:
+    virtual ~Scene_Object() {}
+
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
+
+protected:
+    // Accounts memory held by the object outside of its own allocation (arrays, grids).
+    static void add_memory_usage(size_t bytes);
+};
+
+// Array owned like a scene object, for the arrays scenes are built from (the shape lists of
+// HitableList and the BVH builders). Use new_scene_array.
+template <typename T>
+class Scene_Array : public Scene_Object {
+public:
+    explicit Scene_Array(size_t count)
+        : elements(new T[count]())
+    {
+        add_memory_usage(count * sizeof(T));
+    }
+
+    std::unique_ptr<T[]> elements;
+};
+
+template <typename T>
+T* new_scene_array(size_t count) {
+    return (new Scene_Array<T>(count))->elements.get();
+}
+
+class Scene_Resources {
+public:
+    Scene_Resources() {}
+    ~Scene_Resources();
+
+    Scene_Resources(const Scene_Resources&) = delete;
+    Scene_Resources& operator=(const Scene_Resources&) = delete;
+
+    size_t get_memory_usage() const { return memory_usage; }
+
+    // Records the scene objects allocated by this thread into resources while the scope is alive.
+    // A null resources pointer suspends recording, for objects shared between scenes.
+    class Recording_Scope {
+    public:
+        explicit Recording_Scope(Scene_Resources* resources);
+        ~Recording_Scope();
+
+    private:
+        Scene_Resources* previous;
+    };
+
+private:
+    friend class Scene_Object;
+
+    std::vector<Scene_Object*> objects;
+    size_t memory_usage = 0;
+};
@@ -6,14 +6,58 @@
 #include "texture.h"
 #include "hitable_list.h"
 #include "material.h"
+#include "medium.h"
 #include "sphere.h"
 
+#include <string>
+#include <vector>
+
+class Caustic_Photon_Map;
+class Guiding_Field;
+class Radiance_Cache;
+struct Scene;
+
+// Moves the animated shapes and the camera of a scene between the frames of a sequence.
+class Animation : public Scene_Object {
+public:
+    // Time goes from 0 at the first frame to 1 at the last one.
+    virtual void set_frame(Scene& scene, float time) = 0;
+};
+
 struct Scene {
     Shape* shape;
     Camera camera;
+
+    // Shapes that are importance sampled for direct lighting, can be null.
+    Shape* lights = nullptr;
+    std::vector<Medium*> media;
+
+    // Null for static scenes.
+    Animation* animation = nullptr;
+
+    // Optional, owned by the caller and filled while rendering, see Radiance_Cache.
+    Radiance_Cache* radiance_cache = nullptr;
+
+    // Optional, owned by the caller and traced by render_frame, see Caustic_Photon_Map.
+    Caustic_Photon_Map* caustic_map = nullptr;
+
+    // Optional, owned by the caller, trained and sampled by render_frame, see Guiding_Field.
+    Guiding_Field* guiding_field = nullptr;
 };
 
 Scene cornell_box(float aspect);
+Scene cornell_smoke(float aspect);
+Scene cornell_cloud(float aspect);
+Scene cornell_animation(float aspect);
+Scene final_scene(float aspect);
+Scene bouncing_spheres(float aspect);
+Scene streamed_field(float aspect);
+// two_spheres and simple_light with a camera and their lights.
+Scene two_spheres_scene(float aspect);
+Scene simple_light_scene(float aspect);
+
+// Creates one of the scenes above by name, returns null for unknown names.
+Scene* create_scene(const std::string& name, float aspect);
 
 inline Shape* two_spheres() {
     Texture* checker = new Checker_Texture(
@@ -22,50 +66,13 @@ inline Shape* two_spheres() {
     );
 
     int n = 50;
-    Shape** list = new Shape*[n+1];
+    Shape** list = new_scene_array<Shape*>(n+1);
     list[0] = new Sphere(Vector(0, -10, 0), 10, new Lambertian(checker));
     list[1] = new Sphere(Vector(0, 10, 0), 10, new Lambertian(checker));
 
     return new HitableList(list, 2);
 }
 
-
-
-
-
-//inline Shape* cornell_smoke(RNG& rng) {
-//    Shape** list = new Shape*[8];
-//    
-//    Material* red = new Lambertian(new Constant_Texture(Vector(0.65f, 0.05f, 0.05f)));
-//    Material* white = new Lambertian(new Constant_Texture(Vector(0.73f, 0.73f, 0.73f)));
-//    Material* green = new Lambertian(new Constant_Texture(Vector(0.12f, 0.45f, 0.15f)));
-//    Material* light = new Diffuse_Light(new Constant_Texture(Vector(7, 7, 7)));
-//
-//    list[0] = new Flip_Normals(new YZ_Rect(0, 555, 0, 555, 555, green));
-//    list[1] = new YZ_Rect(0, 555, 0, 555, 0, red);
-//    list[2] = new XZ_Rect(113, 443, 127, 432, 554, light);
-//    list[3] = new Flip_Normals(new XZ_Rect(0, 555, 0, 555, 555, white));
-//    list[4] = new XZ_Rect(0, 555, 0, 555, 0, white);
-//    list[5] = new Flip_Normals(new XY_Rect(0, 555, 0, 555, 555, white));
-//
-//    auto b1 = new Translate(
-//                    new Rotate_Y(
-//                        new Box(Vector(0), Vector(165, 165, 165), white),
-//                        -18),
-//                    Vector(130, 0, 65));
-//
-//    auto b2 = new Translate(
-//                new Rotate_Y(
-//                    new Box(Vector(0), Vector(165, 330, 165), white),
-//                    15),
-//                Vector(265, 0, 295));
-//
-//    list[6] = new Constant_Medium(b1, 0.01f, new Constant_Texture(Vector(1.f)));
-//    list[7] = new Constant_Medium(b2, 0.01f, new Constant_Texture(Vector(0.f)));
-//
-//    return new HitableList(list, 8);
-//}
-
 //inline Shape* random_scene(float time0, float time1)
 //{
 //    const int n = 500;
@@ -0,0 +1,377 @@
+#include <winsock2.h>
+#include <afunix.h>
+
+#include "service.h"
+#include "film.h"
+#include "job.h"
+#include "render.h"
+#include "scene_resources.h"
+#include "scenes.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace {
+const size_t Max_Job_Length = 4096;
+
+struct Cached_Scene {
+    // The scene is destroyed before the objects it references.
+    std::unique_ptr<Scene_Resources> resources;
+    std::unique_ptr<Scene> scene;
+};
+
+// Loaded scenes by name, the least recently used ones are dropped when over the memory budget.
+// Jobs hold a reference to their scene, so a dropped scene is destroyed when its last job is done.
+class Scene_Cache {
+public:
+    explicit Scene_Cache(size_t memory_budget)
+        : memory_budget(memory_budget)
+        , memory_usage(0)
+    {}
+
+    std::shared_ptr<const Cached_Scene> get_scene(const std::string& name) {
+        auto it = entries.find(name);
+        if (it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second.lru_position);
+            return it->second.scene;
+        }
+
+        auto cached = std::make_shared<Cached_Scene>();
+        cached->resources.reset(new Scene_Resources);
+        {
+            Scene_Resources::Recording_Scope scope(cached->resources.get());
+            cached->scene.reset(create_scene(name, 1.f));
+        }
+        if (!cached->scene)
+            return nullptr;
+        replicate_scene_to_nodes(*cached->scene);
+
+        lru.push_front(name);
+        entries[name] = Entry{cached, lru.begin(), cached->resources->get_memory_usage()};
+        memory_usage += cached->resources->get_memory_usage();
+
+        while (memory_usage > memory_budget && lru.size() > 1) {
+            auto evicted = entries.find(lru.back());
+            memory_usage -= evicted->second.memory_usage;
+            entries.erase(evicted);
+            lru.pop_back();
+        }
+        return cached;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<Cached_Scene> scene;
+        std::list<std::string>::iterator lru_position;
+        size_t memory_usage;
+    };
+
+    size_t memory_budget;
+    size_t memory_usage;
+    std::map<std::string, Entry> entries;
+    std::list<std::string> lru;
+};
+
+bool send_all(SOCKET socket, const std::string& text) {
+    size_t sent = 0;
+    while (sent < text.size()) {
+        int result = send(socket, text.c_str() + sent, static_cast<int>(text.size() - sent), 0);
+        if (result <= 0)
+            return false;
+        sent += result;
+    }
+    return true;
+}
+
+// Connection of one client. The scheduler queues the reply lines and the thread of the connection
+// sends them, so a client that reads slowly only holds up its own replies.
+class Client_Connection {
+public:
+    explicit Client_Connection(SOCKET socket)
+        : socket(socket)
+    {}
+
+    SOCKET get_socket() const { return socket; }
+
+    void send_line(const std::string& line) {
+        std::lock_guard<std::mutex> lock(mutex);
+        lines.push_back(line + "\n");
+        condition.notify_one();
+    }
+
+    // The socket is closed once the queued lines are sent.
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        condition.notify_one();
+    }
+
+    // Sends the queued lines until close(), lines to a client that went away are dropped.
+    void send_lines() {
+        bool connected = true;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            condition.wait(lock, [this] { return !lines.empty() || closing; });
+            if (lines.empty())
+                break;
+            std::string text = std::move(lines.front());
+            lines.pop_front();
+
+            lock.unlock();
+            connected = connected && send_all(socket, text);
+            lock.lock();
+        }
+        closesocket(socket);
+    }
+
+private:
+    SOCKET socket;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::string> lines;
+    bool closing = false;
+};
+
+struct Pending_Job {
+    Render_Job job;
+    std::shared_ptr<Client_Connection> client;
+};
+
+struct Active_Job {
+    Render_Job job;
+    std::shared_ptr<Client_Connection> client;
+    uint64_t sequence_number;
+
+    std::shared_ptr<const Cached_Scene> cached_scene;
+    std::unique_ptr<Scene> scene;
+    std::unique_ptr<Film> film;
+
+    std::vector<Render_Rect_Task> tasks;
+    size_t next_task = 0;
+
+    std::atomic<int64_t> completed_pixels{0};
+    int reported_percent = -1;
+};
+
+struct Service_State {
+    SOCKET listen_socket;
+    std::mutex mutex;
+    std::vector<Pending_Job> pending_jobs;
+    HANDLE job_event;
+    // Signaled by every tile that finishes.
+    HANDLE tile_event;
+};
+
+bool receive_line(SOCKET client, std::string& line) {
+    line.clear();
+    char buffer[256];
+    while (line.size() < Max_Job_Length) {
+        int received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+            return !line.empty();
+        line.append(buffer, received);
+
+        size_t end = line.find('\n');
+        if (end != std::string::npos) {
+            line.resize(end);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Runs on a thread per connection: receives the job and then sends the replies to it.
+void serve_client(Service_State* state, std::shared_ptr<Client_Connection> client) {
+    std::string line, error;
+    Pending_Job pending;
+    pending.client = client;
+    if (!receive_line(client->get_socket(), line) || !parse_render_job(line, pending.job, error)) {
+        client->send_line("error " + (error.empty() ? std::string("no job received") : error));
+        client->close();
+    } else {
+        client->send_line("queued");
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->pending_jobs.push_back(pending);
+        }
+        ::SetEvent(state->job_event);
+    }
+    client->send_lines();
+}
+
+DWORD WINAPI accept_connections(PVOID pv_param) {
+    Service_State* state = static_cast<Service_State*>(pv_param);
+
+    while (true) {
+        SOCKET socket = accept(state->listen_socket, NULL, NULL);
+        if (socket == INVALID_SOCKET)
+            continue;
+        std::thread(serve_client, state, std::make_shared<Client_Connection>(socket)).detach();
+    }
+    return 0;
+}
+
+std::unique_ptr<Active_Job> start_job(const Pending_Job& pending, Scene_Cache& scene_cache, int thread_count, uint64_t sequence_number,
+                                      HANDLE tile_event) {
+    const Render_Job& job = pending.job;
+    if (job.frames > 1 || job.radiance_cache || job.caustic_photon_map || job.path_guiding ||
+        job.time_budget > 0.f)
+    {
+        pending.client->send_line("error frames, radiance_cache, caustic_photon_map, path_guiding and time_budget are not supported by the service");
+        pending.client->close();
+        return nullptr;
+    }
+
+    auto cached_scene = scene_cache.get_scene(job.scene);
+    if (!cached_scene) {
+        pending.client->send_line("error unknown scene " + job.scene);
+        pending.client->close();
+        return nullptr;
+    }
+
+    std::unique_ptr<Active_Job> active(new Active_Job);
+    active->job = job;
+    active->client = pending.client;
+    active->sequence_number = sequence_number;
+    active->cached_scene = cached_scene;
+
+    float aspect = float(job.width) / float(job.height);
+    active->scene.reset(new Scene(*cached_scene->scene));
+    if (job.custom_camera)
+        active->scene->camera = Camera(job.look_from, job.look_at, Vector(0, 1, 0), job.vfov, aspect, 0.f, 10.f, 0.f, 1.f);
+    else
+        active->scene->camera.set_aspect(aspect);
+    active->scene->camera.set_image_height(job.height);
+
+    active->film.reset(new Film(job.width, job.height, create_filter(Filter_Type::mitchell)));
+    active->film->set_splat_scale(1.f / float(job.samples));
+
+    unsigned features = get_render_features(*active->scene);
+    Cost_Map cost_map(job.width, job.height);
+    for (const Tile& tile : schedule_tiles(cost_map, job.width, job.height, job.tile_size, thread_count)) {
+        active->tasks.push_back(Render_Rect_Task(active->scene.get(), job.width, job.height, job.samples,
+                                                 tile.x1, tile.y1, tile.x2, tile.y2, active->film.get(), nullptr, features));
+    }
+    for (auto& task : active->tasks) {
+        task.set_progress_counter(&active->completed_pixels);
+        task.set_done_event(tile_event);
+        task.set_integrator(job.integrator);
+        task.set_seed(job.seed);
+    }
+    return active;
+}
+
+// Sends progress and returns true if all tiles of the job are done.
+bool update_progress(Active_Job& active) {
+    int64_t total_pixels = int64_t(active.job.width) * active.job.height;
+    int percent = static_cast<int>(100 * active.completed_pixels / total_pixels);
+    if (percent != active.reported_percent) {
+        active.reported_percent = percent;
+        active.client->send_line("progress " + std::to_string(percent));
+    }
+    return active.completed_pixels == total_pixels;
+}
+
+void finish_job(Active_Job& active) {
+    std::ofstream file(active.job.output);
+    if (file) {
+        write_ppm(file, active.film->develop(), active.job.width, active.job.height);
+        active.client->send_line("done " + active.job.output);
+    } else {
+        active.client->send_line("error cannot write " + active.job.output);
+    }
+    active.client->close();
+}
+}
+
+bool run_render_service(const std::string& socket_path, size_t scene_memory_budget, int thread_count) {
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+        return false;
+
+    Service_State state;
+    state.listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (state.listen_socket == INVALID_SOCKET)
+        return false;
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    remove(socket_path.c_str());
+
+    if (bind(state.listen_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+        listen(state.listen_socket, SOMAXCONN) == SOCKET_ERROR)
+    {
+        closesocket(state.listen_socket);
+        return false;
+    }
+
+    state.job_event = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+    state.tile_event = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+    ::CreateThread(NULL, 0, &accept_connections, &state, 0, NULL);
+    fprintf(stderr, "Listening on %s\n", socket_path.c_str());
+
+    Scene_Cache scene_cache(scene_memory_budget);
+    std::list<std::unique_ptr<Active_Job>> active_jobs;
+    uint64_t next_sequence_number = 0;
+
+    while (true) {
+        std::vector<Pending_Job> pending_jobs;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            pending_jobs.swap(state.pending_jobs);
+        }
+        for (const Pending_Job& pending : pending_jobs) {
+            auto active = start_job(pending, scene_cache, thread_count, next_sequence_number++, state.tile_event);
+            if (active)
+                active_jobs.push_back(std::move(active));
+        }
+
+        // Next tile comes from the job with the highest priority, the oldest one among equals.
+        Active_Job* next_job = nullptr;
+        for (auto& active : active_jobs) {
+            if (active->next_task == active->tasks.size())
+                continue;
+            if (!next_job || active->job.priority > next_job->job.priority ||
+                (active->job.priority == next_job->job.priority && active->sequence_number < next_job->sequence_number))
+            {
+                next_job = active.get();
+            }
+        }
+
+        if (next_job) {
+            Thread::commit_task(&next_job->tasks[next_job->next_task++]);
+        } else if (!active_jobs.empty()) {
+            // All tiles are handed out. New jobs start while the last ones are still running.
+            HANDLE events[2] = {state.job_event, state.tile_event};
+            ::WaitForMultipleObjects(2, events, FALSE, INFINITE);
+        } else {
+            ::WaitForSingleObject(state.job_event, INFINITE);
+            continue;
+        }
+
+        for (auto it = active_jobs.begin(); it != active_jobs.end();) {
+            if (update_progress(**it)) {
+                finish_job(**it);
+                it = active_jobs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    return true;
+}
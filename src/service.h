@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Render service: listens on a Unix domain socket for render jobs, one job per connection
+// written as a single line (see Render_Job). Scenes stay loaded between jobs as long as they
+// fit into scene_memory_budget, and the jobs share the thread pool tile by tile in priority order.
+// The service replies with lines of text: "queued", "progress <percent>", and finally
+// "done <output file>" or "error <message>".
+// The thread pool must be running. Does not return unless the socket can't be set up.
+bool run_render_service(const std::string& socket_path, size_t scene_memory_budget, int thread_count);
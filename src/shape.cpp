@@ -1,12 +1,21 @@
 #include "common.h"
 #include "hitable_list.h"
+#include "material.h"
 #include "ray.h"
 #include "shape.h"
 #include "bounding_box.h"
+#include "stats.h"
 
-bool XY_Rect::hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const {
+void Shape_Features::add_material(const Material* material) {
+    emissive = emissive || material->is_emissive();
+    uses_footprint = uses_footprint || material->uses_footprint();
+}
+
+bool XY_Rect::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const {
+    STATS_INCREMENT_PRIMITIVE(xy_rect);
     float t = (k - ray.origin.z) / ray.direction.z;
-    if (t < t_min || t > t_max)
+    // Written to also reject the NaN of a ray lying in the plane.
+    if (!(t >= t_min && t <= t_max))
         return false;
 
     float x = ray.origin.x + t * ray.direction.x;
@@ -14,22 +23,45 @@ bool XY_Rect::hit(const Ray& ray, float t_min, float t_max, Intersection& hit) c
     if (x < x0 || x > x1 || y < y0 || y > y1)
         return false;
 
-    hit.u = (x - x0) / (x1 - x0);
-    hit.v = (y - y0) / (y1 - y0);
-    hit.t = t;
-    hit.material = material;
-    hit.p = ray.PointAtParameter(t);
-    hit.normal = Vector(0, 0, 1);
+    hit.set(t, this);
     return true;
 }
 
+void XY_Rect::evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const {
+    isect.t = hit.t;
+    isect.p = ray.PointAtParameter(hit.t);
+    isect.normal = Vector(0, 0, 1);
+    isect.u = (isect.p.x - x0) / (x1 - x0);
+    isect.v = (isect.p.y - y0) / (y1 - y0);
+    isect.uv_density = 1.f / std::sqrt((x1 - x0) * (y1 - y0));
+    isect.material = material;
+}
+
 Bounding_Box XY_Rect::boudning_box(float t0, float t1) const {
     return Bounding_Box(Vector(x0, y0, k - 1e-4f), Vector(x1, y1, k + 1e-4f));
 }
 
-bool XZ_Rect::hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const {
+bool XY_Rect::sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const {
+    float x = x0 + rng.random_float() * (x1 - x0);
+    float y = y0 + rng.random_float() * (y1 - y0);
+    point = Vector(x, y, k);
+    normal = Vector(0, 0, 1);
+    pdf = 1.f / ((x1 - x0) * (y1 - y0));
+    return true;
+}
+
+float XY_Rect::surface_pdf(const Vector& point) const {
+    if (std::abs(point.z - k) > 1e-3f * (1.f + std::abs(k)))
+        return 0.f;
+    if (point.x < x0 || point.x > x1 || point.y < y0 || point.y > y1)
+        return 0.f;
+    return 1.f / ((x1 - x0) * (y1 - y0));
+}
+
+bool XZ_Rect::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const {
+    STATS_INCREMENT_PRIMITIVE(xz_rect);
     float t = (k - ray.origin.y) / ray.direction.y;
-    if (t < t_min || t > t_max)
+    if (!(t >= t_min && t <= t_max))
         return false;
 
     float x = ray.origin.x + t * ray.direction.x;
@@ -37,22 +69,45 @@ bool XZ_Rect::hit(const Ray& ray, float t_min, float t_max, Intersection& hit) c
     if (x < x0 || x > x1 || z < z0 || z > z1)
         return false;
 
-    hit.u = (x - x0) / (x1 - x0);
-    hit.v = (z - z0) / (z1 - z0);
-    hit.t = t;
-    hit.material = material;
-    hit.p = ray.PointAtParameter(t);
-    hit.normal = Vector(0, 1, 0);
+    hit.set(t, this);
     return true;
 }
 
+void XZ_Rect::evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const {
+    isect.t = hit.t;
+    isect.p = ray.PointAtParameter(hit.t);
+    isect.normal = Vector(0, 1, 0);
+    isect.u = (isect.p.x - x0) / (x1 - x0);
+    isect.v = (isect.p.z - z0) / (z1 - z0);
+    isect.uv_density = 1.f / std::sqrt((x1 - x0) * (z1 - z0));
+    isect.material = material;
+}
+
 Bounding_Box XZ_Rect::boudning_box(float t0, float t1) const {
     return Bounding_Box(Vector(x0, k - 1e-4f, z0), Vector(x1, k + 1e-4f, z1));
 }
 
-bool YZ_Rect::hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const {
+bool XZ_Rect::sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const {
+    float x = x0 + rng.random_float() * (x1 - x0);
+    float z = z0 + rng.random_float() * (z1 - z0);
+    point = Vector(x, k, z);
+    normal = Vector(0, 1, 0);
+    pdf = 1.f / ((x1 - x0) * (z1 - z0));
+    return true;
+}
+
+float XZ_Rect::surface_pdf(const Vector& point) const {
+    if (std::abs(point.y - k) > 1e-3f * (1.f + std::abs(k)))
+        return 0.f;
+    if (point.x < x0 || point.x > x1 || point.z < z0 || point.z > z1)
+        return 0.f;
+    return 1.f / ((x1 - x0) * (z1 - z0));
+}
+
+bool YZ_Rect::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const {
+    STATS_INCREMENT_PRIMITIVE(yz_rect);
     float t = (k - ray.origin.x) / ray.direction.x;
-    if (t < t_min || t > t_max)
+    if (!(t >= t_min && t <= t_max))
         return false;
 
     float y = ray.origin.y + t * ray.direction.y;
@@ -60,24 +115,46 @@ bool YZ_Rect::hit(const Ray& ray, float t_min, float t_max, Intersection& hit) c
     if (y < y0 || y > y1 || z < z0 || z > z1)
         return false;
 
-    hit.u = (y - y0) / (y1 - y0);
-    hit.v = (z - z0) / (z1 - z0);
-    hit.t = t;
-    hit.material = material;
-    hit.p = ray.PointAtParameter(t);
-    hit.normal = Vector(1, 0, 0);
+    hit.set(t, this);
     return true;
 }
 
+void YZ_Rect::evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const {
+    isect.t = hit.t;
+    isect.p = ray.PointAtParameter(hit.t);
+    isect.normal = Vector(1, 0, 0);
+    isect.u = (isect.p.y - y0) / (y1 - y0);
+    isect.v = (isect.p.z - z0) / (z1 - z0);
+    isect.uv_density = 1.f / std::sqrt((y1 - y0) * (z1 - z0));
+    isect.material = material;
+}
+
 Bounding_Box YZ_Rect::boudning_box(float t0, float t1) const {
     return Bounding_Box(Vector(k - 1e-4f, y0, z0), Vector(k + 1e-4f, y1, z1));
 }
 
+bool YZ_Rect::sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const {
+    float y = y0 + rng.random_float() * (y1 - y0);
+    float z = z0 + rng.random_float() * (z1 - z0);
+    point = Vector(k, y, z);
+    normal = Vector(1, 0, 0);
+    pdf = 1.f / ((y1 - y0) * (z1 - z0));
+    return true;
+}
+
+float YZ_Rect::surface_pdf(const Vector& point) const {
+    if (std::abs(point.x - k) > 1e-3f * (1.f + std::abs(k)))
+        return 0.f;
+    if (point.y < y0 || point.y > y1 || point.z < z0 || point.z > z1)
+        return 0.f;
+    return 1.f / ((y1 - y0) * (z1 - z0));
+}
+
 Box::Box(const Vector& p0, const Vector& p1, Material* material)
     : pmin(p0)
     , pmax(p1)
 {
-    Shape** list = new Shape*[6];
+    Shape** list = new_scene_array<Shape*>(6);
     list[0] = new XY_Rect(p0.x, p1.x, p0.y, p1.y, p1.z, material);
     list[1] = new Flip_Normals(new XY_Rect(p0.x, p1.x, p0.y, p1.y, p0.z, material));
     list[2] = new XZ_Rect(p0.x, p1.x, p0.z, p1.z, p1.y, material);
@@ -87,7 +164,7 @@ Box::Box(const Vector& p0, const Vector& p1, Material* material)
     list_ptr = new HitableList(list, 6);
 }
 
-bool Box::hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const {
+bool Box::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const {
     return list_ptr->hit(ray, t_min, t_max, hit);
 }
 
@@ -95,13 +172,20 @@ Bounding_Box Box::boudning_box(float t0, float t1) const {
     return Bounding_Box(pmin, pmax);
 }
 
-bool Translate::hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const {
-    Ray translated_ray(ray.origin - translation, ray.direction, ray.time);
-    if (shape->hit(translated_ray, t_min, t_max, hit)) {
-        hit.p += translation;
-        return true;
-    }
-    return false;
+Ray Flip_Normals::to_object_space(const Ray& ray) const {
+    return ray;
+}
+
+bool Translate::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const {
+    return shape->hit(to_object_space(ray), t_min, t_max, hit);
+}
+
+Ray Translate::to_object_space(const Ray& ray) const {
+    return Ray(ray.origin - translation, ray.direction, ray.time);
+}
+
+void Translate::to_world_space(Intersection& isect) const {
+    isect.p += translation;
 }
 
 Bounding_Box Translate::boudning_box(float t0, float t1) const {
@@ -114,16 +198,31 @@ Bounding_Box Translate::boudning_box(float t0, float t1) const {
 Rotate_Y::Rotate_Y(Shape* p, float angle)
     : shape(p)
 {
+    shape->set_parent_transform(this);
+    set_angle(angle);
+}
+
+void Rotate_Y::set_angle(float angle) {
     float radians = (PI / 180.f) * angle;
     sin_theta = std::sin(radians);
     cos_theta = std::cos(radians);
+    update_bounds();
+}
 
+void Rotate_Y::refit() {
+    shape->refit();
+    update_bounds();
+}
+
+void Rotate_Y::update_bounds() {
+    Bounding_Box shape_box = shape->boudning_box(0, 1);
+    box = Bounding_Box();
     for (int i = 0; i < 2; i++) {
         for (int j = 0; j < 2; j++) {
             for (int k = 0; k < 2; k++) {
-                float x = i * box.max_point.x + (1 - i) * box.min_point.x;
-                float y = j * box.max_point.y + (1 - j) * box.min_point.y;
-                float z = k * box.max_point.z + (1 - k) * box.min_point.z;
+                float x = i * shape_box.max_point.x + (1 - i) * shape_box.min_point.x;
+                float y = j * shape_box.max_point.y + (1 - j) * shape_box.min_point.y;
+                float z = k * shape_box.max_point.z + (1 - k) * shape_box.min_point.z;
 
                 float new_x = cos_theta * x + sin_theta * z;
                 float new_z = -sin_theta * x + cos_theta * z;
@@ -140,7 +239,7 @@ Rotate_Y::Rotate_Y(Shape* p, float angle)
     }
 }
 
-bool Rotate_Y::hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const {
+Ray Rotate_Y::to_object_space(const Ray& ray) const {
     Vector o = ray.origin;
     Vector d = ray.direction;
 
@@ -150,58 +249,43 @@ bool Rotate_Y::hit(const Ray& ray, float t_min, float t_max, Intersection& hit)
     d[0] = cos_theta * ray.direction[0] - sin_theta * ray.direction[2];
     d[2] = sin_theta * ray.direction[0] + cos_theta * ray.direction[2];
 
-    Ray rotated_ray(o, d, ray.time);
+    return Ray(o, d, ray.time);
+}
 
-    if (shape->hit(rotated_ray, t_min, t_max, hit)) {
-        Vector p = hit.p;
-        Vector n = hit.normal;
+bool Rotate_Y::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const {
+    return shape->hit(to_object_space(ray), t_min, t_max, hit);
+}
 
-        p[0] = cos_theta * hit.p[0] + sin_theta * hit.p[2];
-        p[2] = -sin_theta * hit.p[0] + cos_theta * hit.p[2];
+void Rotate_Y::to_world_space(Intersection& isect) const {
+    Vector p = isect.p;
+    Vector n = isect.normal;
 
-        n[0] = cos_theta * hit.normal[0] + sin_theta * hit.normal[2];
-        n[2] = -sin_theta * hit.normal[0] + cos_theta * hit.normal[2];
+    p[0] = cos_theta * isect.p[0] + sin_theta * isect.p[2];
+    p[2] = -sin_theta * isect.p[0] + cos_theta * isect.p[2];
 
-        hit.p = p;
-        hit.normal = n;
-        return true;
-    }
-    return false;
+    n[0] = cos_theta * isect.normal[0] + sin_theta * isect.normal[2];
+    n[2] = -sin_theta * isect.normal[0] + cos_theta * isect.normal[2];
+
+    isect.p = p;
+    isect.normal = n;
 }
 
 Bounding_Box Rotate_Y::boudning_box(float t0, float t1) const {
     return box;
 }
 
-//thread_local RNG Constant_Medium::rng;
-//
-//bool Constant_Medium::hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const {
-//    Intersection hit1, hit2;
-//
-//    if (boundary->hit(ray, -FLT_MAX, FLT_MAX, hit1)) {
-//        if (boundary->hit(ray, hit1.t + 1e-4f, FLT_MAX, hit2)) {
-//            hit1.t = std::max(hit1.t, t_min);
-//            hit2.t = std::min(hit2.t, t_max);
-//
-//            if (hit1.t >= hit2.t)
-//                return false;
-//            hit1.t = std::max(hit1.t, 0.f);
-//
-//            float distance_inside_boundary = (hit2.t - hit1.t);
-//            float hit_distance = -(1 / density) * std::log(rng.random_float());
-//            if (hit_distance < distance_inside_boundary) {
-//                hit.t = hit1.t + hit_distance;
-//                hit.p = ray.PointAtParameter(hit.t);
-//                hit.normal = Vector(1, 0, 0);
-//                hit.material = phase_function;
-//                return true;
-//            }
-//        }
-//    }
-//
-//    return false;
-//}
-//
-//Bounding_Box Constant_Medium::boudning_box(float t0, float t1) const {
-//    return boundary->boudning_box(t0, t1);
-//}
+namespace {
+// The ray in the space below the transform, the transforms above it are applied first.
+Ray get_object_space_ray(const Shape_Transform* transform, const Ray& ray) {
+    if (!transform)
+        return ray;
+    return transform->to_object_space(get_object_space_ray(transform->get_parent_transform(), ray));
+}
+}
+
+void evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) {
+    const Shape_Transform* transform = hit.primitive->get_parent_transform();
+    hit.primitive->evaluate_hit(get_object_space_ray(transform, ray), hit, isect);
+    for (; transform; transform = transform->get_parent_transform())
+        transform->to_world_space(isect);
+}
@@ -3,28 +3,118 @@
 #include "bounding_box.h"
 #include "vector.h"
 #include "random.h"
+#include "scene_resources.h"
+
+#include <cassert>
+#include <cstdint>
 
 class Bounding_Box;
 class Material;
 class Ray;
+class Shape;
+class Shape_Transform;
 class Texture;
 
+// Result of Shape::hit(). Traversal only records the distance and the primitive hit; the surface
+// attributes are computed once, for the closest hit, by evaluate_hit(). The transforms above the
+// primitive are found from the primitive (see Shape::set_parent_transform).
+struct Ray_Hit {
+    float t;
+    const Shape* primitive;
+    // Identifies the hit inside primitives that stand for many (streamed geometry), 0 otherwise.
+    uint64_t primitive_id;
+
+    void set(float hit_t, const Shape* hit_primitive, uint64_t hit_primitive_id = 0) {
+        t = hit_t;
+        primitive = hit_primitive;
+        primitive_id = hit_primitive_id;
+    }
+};
+
 struct Intersection
 {
     float t;
     Vector p;
     Vector normal;
     float u, v;
+    // Approximate change of the uv coordinates per unit of world space distance.
+    float uv_density;
+    // Size of the ray footprint in uv space, filled by the integrator for texture filtering.
+    float footprint;
     Material* material;
 };
 
-class Shape {
+// Properties of a group of shapes that the render kernel is specialized on.
+struct Shape_Features {
+    bool emissive = false;
+    bool uses_footprint = false;
+    bool moving = false;
+    bool streamed = false;
+
+    void add_material(const Material* material);
+};
+
+class Shape : public Scene_Object {
 public:
-    virtual bool hit(const Ray& ray, float t_min, float t_max, Intersection& hit_record) const = 0;
+    // Finds the closest hit in (t_min, t_max), leaves hit_record unchanged on a miss.
+    virtual bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const = 0;
     virtual Bounding_Box boudning_box(float t0, float t1) const = 0;
 
+    // Finds the closest hits of a batch of rays. t_max[i] is lowered to the distance of a hit
+    // closer than it and hits[i] set; shapes that page in data override this to amortize it.
+    virtual void hit_batch(const Ray* rays, int count, float t_min, float* t_max, Ray_Hit* hits) const {
+        for (int i = 0; i < count; i++) {
+            if (hit(rays[i], t_min, t_max[i], hits[i]))
+                t_max[i] = hits[i].t;
+        }
+    }
+
+    // Fills the surface attributes for a hit of this shape, implemented by primitives. ray is in the
+    // space of the shape, below its transforms.
+    virtual void evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const {
+        assert(!"should not be called");
+    }
+
+    // Transforms call it on the shape they are created for. Hierarchies pass it on to the shapes
+    // below them, so that each primitive knows the innermost transform above it. A shape can be
+    // below one chain of transforms only.
+    virtual void set_parent_transform(const Shape_Transform* transform) {
+        assert(!parent_transform || parent_transform == transform);
+        parent_transform = transform;
+    }
+    const Shape_Transform* get_parent_transform() const { return parent_transform; }
+
+    // Recomputes cached bounds after transforms below this shape have changed.
+    virtual void refit() {}
+    // Surface area heuristic cost of the hierarchy below this shape, not normalized by its area.
+    virtual float get_sah_cost() const { return 0.f; }
+    // Accumulates the features of this shape and the shapes below it.
+    virtual void get_features(Shape_Features& features) const {}
+    // Copies the read-only hierarchy data below this shape into memory local to the NUMA node of the
+    // calling thread, threads of that node traverse the copy (see Thread::get_current_node).
+    virtual void create_node_replica(int node) {}
+
     virtual float pdf_value(const Vector& o, const Vector& v) const { return 0.f; }
     virtual Vector random_direction(RNG& rng, const Vector& o) const { return Vector(1, 0, 0); }
+
+    // Samples a point on the surface with its normal, pdf is per unit area. Implemented by the
+    // shapes used as lights, to emit photons from them.
+    virtual bool sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const { return false; }
+    // Density of sample_surface at a point, zero for points that are not on the surface.
+    virtual float surface_pdf(const Vector& point) const { return 0.f; }
+
+private:
+    const Shape_Transform* parent_transform = nullptr;
+};
+
+// Shape that places the shapes below it in a different space. Hits pass through it and the
+// intersection of the closest one is taken back up by evaluate_hit.
+class Shape_Transform : public Shape {
+public:
+    // From the space above the transform to the space of the shape below it.
+    virtual Ray to_object_space(const Ray& ray) const = 0;
+    // From the space of the shape below the transform to the space above it.
+    virtual void to_world_space(Intersection& isect) const = 0;
 };
 
 class XY_Rect : public Shape {
@@ -32,8 +122,33 @@ public:
     XY_Rect(float x0, float x1, float y0, float y1, float k, Material* material)
         : x0(x0), x1(x1), y0(y0), y1(y1), k(k), material(material) {}
 
-    bool hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const override;
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const override;
+    void evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const override;
     Bounding_Box boudning_box(float t0, float t1) const override;
+    bool sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const override;
+    float surface_pdf(const Vector& point) const override;
+    void get_features(Shape_Features& features) const override { features.add_material(material); }
+
+    float pdf_value(const Vector& o, const Vector& v) const override {
+        STATS_INCREMENT(pdf_value_calls);
+        Ray_Hit ray_hit;
+        if (hit(Ray(o, v), 1e-3f, FLT_MAX, ray_hit)) {
+            float area = (x1 - x0) * (y1 - y0);
+            float distance_sq = ray_hit.t * ray_hit.t;
+            float cosine = std::abs(v.z);
+            return distance_sq / (cosine * area);
+        }
+        else
+            return 0.f;
+    }
+    Vector random_direction(RNG& rng, const Vector& o) const override {
+        Vector random_point = Vector(
+            x0 + rng.random_float() * (x1 - x0),
+            y0 + rng.random_float() * (y1 - y0),
+            k
+        );
+        return (random_point - o).normalized();
+    }
 
     float x0, x1, y0, y1, k;
     Material* material;
@@ -44,15 +159,20 @@ public:
     XZ_Rect(float x0, float x1, float z0, float z1, float k, Material* material)
         : x0(x0), x1(x1), z0(z0), z1(z1), k(k), material(material) {}
 
-    bool hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const override;
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const override;
+    void evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const override;
     Bounding_Box boudning_box(float t0, float t1) const override;
+    bool sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const override;
+    float surface_pdf(const Vector& point) const override;
+    void get_features(Shape_Features& features) const override { features.add_material(material); }
 
     float pdf_value(const Vector& o, const Vector& v) const override {
-        Intersection isect;
-        if (hit(Ray(o, v), 1e-3f, FLT_MAX, isect)) {
+        STATS_INCREMENT(pdf_value_calls);
+        Ray_Hit ray_hit;
+        if (hit(Ray(o, v), 1e-3f, FLT_MAX, ray_hit)) {
             float area = (x1 - x0) * (z1 - z0);
-            float distance_sq = isect.t * isect.t;
-            float cosine = std::abs(dot_product(v, isect.normal));
+            float distance_sq = ray_hit.t * ray_hit.t;
+            float cosine = std::abs(v.y);
             return distance_sq / (cosine * area);
         }
         else
@@ -76,79 +196,140 @@ public:
     YZ_Rect(float y0, float y1, float z0, float z1, float k, Material* material)
         : y0(y0), y1(y1), z0(z0), z1(z1), k(k), material(material) {}
 
-    bool hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const override;
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const override;
+    void evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const override;
     Bounding_Box boudning_box(float t0, float t1) const override;
+    bool sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const override;
+    float surface_pdf(const Vector& point) const override;
+    void get_features(Shape_Features& features) const override { features.add_material(material); }
+
+    float pdf_value(const Vector& o, const Vector& v) const override {
+        STATS_INCREMENT(pdf_value_calls);
+        Ray_Hit ray_hit;
+        if (hit(Ray(o, v), 1e-3f, FLT_MAX, ray_hit)) {
+            float area = (y1 - y0) * (z1 - z0);
+            float distance_sq = ray_hit.t * ray_hit.t;
+            float cosine = std::abs(v.x);
+            return distance_sq / (cosine * area);
+        }
+        else
+            return 0.f;
+    }
+    Vector random_direction(RNG& rng, const Vector& o) const override {
+        Vector random_point = Vector(
+            k,
+            y0 + rng.random_float() * (y1 - y0),
+            z0 + rng.random_float() * (z1 - z0)
+        );
+        return (random_point - o).normalized();
+    }
 
     float y0, y1, z0, z1, k;
     Material* material;
 };
 
-class Flip_Normals : public Shape {
+class Flip_Normals : public Shape_Transform {
 public:
-    Flip_Normals(Shape* hitable) : hitable(hitable) {}
+    Flip_Normals(Shape* hitable) : hitable(hitable) {
+        hitable->set_parent_transform(this);
+    }
 
-    bool hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const override {
-        if (hitable->hit(ray, t_min, t_max, hit)) {
-            hit.normal = -hit.normal;
-            return true;
-        }
-        return false;
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const override {
+        return hitable->hit(ray, t_min, t_max, hit);
+    }
+
+    Ray to_object_space(const Ray& ray) const override;
+
+    void to_world_space(Intersection& isect) const override {
+        isect.normal = -isect.normal;
     }
 
     Bounding_Box boudning_box(float t0, float t1) const override {
         return hitable->boudning_box(t0, t1);
     }
 
+    void refit() override {
+        hitable->refit();
+    }
+
+    void get_features(Shape_Features& features) const override {
+        hitable->get_features(features);
+    }
+
+    void create_node_replica(int node) override {
+        hitable->create_node_replica(node);
+    }
+
+    bool sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const override {
+        if (!hitable->sample_surface(rng, point, normal, pdf))
+            return false;
+        normal = -normal;
+        return true;
+    }
+
+    float surface_pdf(const Vector& point) const override {
+        return hitable->surface_pdf(point);
+    }
+
     Shape* hitable;
 };
 
 class Box : public Shape {
 public:
     Box(const Vector& p0, const Vector& p1, Material* material);
-    bool hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const override;
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const override;
     Bounding_Box boudning_box(float t0, float t1) const override;
+    void get_features(Shape_Features& features) const override { list_ptr->get_features(features); }
+    void set_parent_transform(const Shape_Transform* transform) override { list_ptr->set_parent_transform(transform); }
 
 private:
     Vector pmin, pmax;
     Shape* list_ptr;
 };
 
-class Translate : public Shape {
+class Translate : public Shape_Transform {
 public:
-    Translate(Shape* shape, const Vector& translation) : shape(shape), translation(translation) {}
-    bool hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const override;
+    Translate(Shape* shape, const Vector& translation) : shape(shape), translation(translation) {
+        shape->set_parent_transform(this);
+    }
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const override;
+    Ray to_object_space(const Ray& ray) const override;
+    void to_world_space(Intersection& isect) const override;
     Bounding_Box boudning_box(float t0, float t1) const override;
 
+    void refit() override { shape->refit(); }
+    void get_features(Shape_Features& features) const override { shape->get_features(features); }
+    void create_node_replica(int node) override { shape->create_node_replica(node); }
+    void set_translation(const Vector& new_translation) { translation = new_translation; }
+
 private:
     Shape* shape;
     Vector translation;
 };
 
-class Rotate_Y : public Shape {
+class Rotate_Y : public Shape_Transform {
 public:
     Rotate_Y(Shape* p, float angle);
-    bool hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const override;
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit) const override;
+    Ray to_object_space(const Ray& ray) const override;
+    void to_world_space(Intersection& isect) const override;
     Bounding_Box boudning_box(float t0, float t1) const override;
 
+    void refit() override;
+    void get_features(Shape_Features& features) const override { shape->get_features(features); }
+    void create_node_replica(int node) override { shape->create_node_replica(node); }
+    // Call refit() on the hierarchy above afterwards.
+    void set_angle(float angle);
+
 private:
+    void update_bounds();
+
+
     Shape* shape;
     float sin_theta;
     float cos_theta;
     Bounding_Box box;
 };
 
-//class Constant_Medium : public Shape {
-//public:
-//    Constant_Medium(Shape* boundary, float density, Texture* a)
-//        : boundary(boundary), density(density), phase_function(new Isotropic(a)) {}
-//
-//    bool hit(const Ray& ray, float t_min, float t_max, Intersection& hit) const override;
-//    Bounding_Box boudning_box(float t0, float t1) const override;
-//
-//private:
-//    Shape* boundary;
-//    float density;
-//    Material* phase_function;
-//
-//    static thread_local RNG rng;
-//};
+// Computes the surface attributes of a hit found by Shape::hit().
+void evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "vector.h"
+
+#include <xmmintrin.h>
+
+// Four floats in an SSE register for inner loops such as box tests. Vector stays the storage
+// type; converting from a Vector sets w to zero and operations that only make sense for three
+// components (min3, max3) ignore w.
+class alignas(16) SIMD_Vector {
+public:
+    SIMD_Vector() {}
+
+    explicit SIMD_Vector(__m128 m)
+        : m(m) {}
+
+    explicit SIMD_Vector(float v)
+        : m(_mm_set1_ps(v)) {}
+
+    explicit SIMD_Vector(const Vector& v)
+        : m(_mm_set_ps(0.f, v.z, v.y, v.x)) {}
+
+    SIMD_Vector(float x, float y, float z, float w = 0.f)
+        : m(_mm_set_ps(w, z, y, x)) {}
+
+    // Loads three floats, for example the corner of a flat BVH node.
+    static SIMD_Vector load3(const float* p) {
+        return SIMD_Vector(p[0], p[1], p[2]);
+    }
+
+    // Loads four floats that do not have to be 16-byte aligned.
+    static SIMD_Vector load4(const float* p) {
+        return SIMD_Vector(_mm_loadu_ps(p));
+    }
+
+    __m128 m;
+};
+
+inline SIMD_Vector operator+(const SIMD_Vector& a, const SIMD_Vector& b) {
+    return SIMD_Vector(_mm_add_ps(a.m, b.m));
+}
+
+inline SIMD_Vector operator-(const SIMD_Vector& a, const SIMD_Vector& b) {
+    return SIMD_Vector(_mm_sub_ps(a.m, b.m));
+}
+
+inline SIMD_Vector operator*(const SIMD_Vector& a, const SIMD_Vector& b) {
+    return SIMD_Vector(_mm_mul_ps(a.m, b.m));
+}
+
+inline SIMD_Vector operator/(const SIMD_Vector& a, const SIMD_Vector& b) {
+    return SIMD_Vector(_mm_div_ps(a.m, b.m));
+}
+
+// Like _mm_min_ps/_mm_max_ps these return b if either argument is NaN.
+inline SIMD_Vector min(const SIMD_Vector& a, const SIMD_Vector& b) {
+    return SIMD_Vector(_mm_min_ps(a.m, b.m));
+}
+
+inline SIMD_Vector max(const SIMD_Vector& a, const SIMD_Vector& b) {
+    return SIMD_Vector(_mm_max_ps(a.m, b.m));
+}
+
+inline float min3(const SIMD_Vector& v) {
+    __m128 yz = _mm_min_ss(_mm_shuffle_ps(v.m, v.m, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(v.m, v.m, _MM_SHUFFLE(2, 2, 2, 2)));
+    return _mm_cvtss_f32(_mm_min_ss(yz, v.m));
+}
+
+inline float max3(const SIMD_Vector& v) {
+    __m128 yz = _mm_max_ss(_mm_shuffle_ps(v.m, v.m, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(v.m, v.m, _MM_SHUFFLE(2, 2, 2, 2)));
+    return _mm_cvtss_f32(_mm_max_ss(yz, v.m));
+}
+
+// Slab test of a ray against the box [min_point, max_point], narrowing [t_min, t_max] to the
+// part of the ray inside the box. A NaN from a ray lying in a slab plane leaves the interval as is.
+inline bool intersect_slabs(const SIMD_Vector& min_point, const SIMD_Vector& max_point,
+                            const SIMD_Vector& origin, const SIMD_Vector& inv_dir, float& t_min, float& t_max) {
+    SIMD_Vector t0 = (min_point - origin) * inv_dir;
+    SIMD_Vector t1 = (max_point - origin) * inv_dir;
+
+    float t_near = max3(max(min(t0, t1), SIMD_Vector(t_min)));
+    float t_far = min3(min(max(t0, t1), SIMD_Vector(t_max)));
+    if (t_near > t_far)
+        return false;
+
+    t_min = t_near;
+    t_max = t_far;
+    return true;
+}
@@ -1,18 +1,18 @@
 #include "sphere.h"
+#include "fast_math.h"
+#include "stats.h"
 #include <cassert>
 
 static void get_sphere_uv(const Vector& p, float& u, float& v) {
-    float phi = std::atan2(p.z, p.x);
-    float theta = std::asin(clamp(p.y, -1.f, 1.f));
+    float phi = fast_atan2(p.z, p.x);
+    float theta = fast_asin(p.y);
     u = 1.f - (phi + PI) / (2 * PI);
     v = (theta + PI / 2) / PI;
     assert(!std::isnan(u));
     assert(!std::isnan(v));
 }
 
-static bool ray_sphere_intersect(
-    const Vector& center, float radius, const Ray& ray,
-    float tMin, float tMax, Material* material, Intersection& hitRecord)
+bool ray_sphere_intersect(const Vector& center, float radius, const Ray& ray, float tMin, float tMax, float& t_hit)
 {
     Vector oc = ray.origin - center;
     float b = dot_product(oc, ray.direction);
@@ -30,16 +30,31 @@ static bool ray_sphere_intersect(
             return false;
     }
 
-    hitRecord.t = t;
-    hitRecord.p = ray.PointAtParameter(t);
-    hitRecord.normal = (hitRecord.p - center) / radius;
-    get_sphere_uv((hitRecord.p - center) / radius, hitRecord.u, hitRecord.v);
-    hitRecord.material = material;
+    t_hit = t;
     return true;
 }
 
-bool Sphere::hit(const Ray& ray, float tMin, float tMax, Intersection& hitRecord) const {
-    return ray_sphere_intersect(center, radius, ray, tMin, tMax, material, hitRecord);
+void evaluate_sphere_hit(const Vector& center, float radius, Material* material, const Ray& ray, float t, Intersection& isect) {
+    isect.t = t;
+    isect.p = ray.PointAtParameter(t);
+    isect.normal = (isect.p - center) / radius;
+    get_sphere_uv(isect.normal, isect.u, isect.v);
+    // u spans the circumference and v half of it, use the geometric mean of both densities.
+    isect.uv_density = 1.f / (std::sqrt(2.f) * PI * radius);
+    isect.material = material;
+}
+
+bool Sphere::hit(const Ray& ray, float tMin, float tMax, Ray_Hit& hitRecord) const {
+    STATS_INCREMENT_PRIMITIVE(sphere);
+    float t;
+    if (!ray_sphere_intersect(center, radius, ray, tMin, tMax, t))
+        return false;
+    hitRecord.set(t, this);
+    return true;
+}
+
+void Sphere::evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const {
+    evaluate_sphere_hit(center, radius, material, ray, hit.t, isect);
 }
 
 Bounding_Box Sphere::boudning_box(float t0, float t1) const {
@@ -47,9 +62,10 @@ Bounding_Box Sphere::boudning_box(float t0, float t1) const {
 }
 
 float Sphere::pdf_value(const Vector& o, const Vector& v) const {
-    Intersection isect;
+    STATS_INCREMENT(pdf_value_calls);
+    Ray_Hit ray_hit;
 
-    if (hit(Ray(o, v), 1e-3f, FLT_MAX, isect)) {
+    if (hit(Ray(o, v), 1e-3f, FLT_MAX, ray_hit)) {
         float cos_theta_max = std::sqrt(1.f - radius*radius/(center-o).squared_length());
         float solid_angle = 2*PI*(1 - cos_theta_max);
         return 1.f / solid_angle;
@@ -62,10 +78,10 @@ Vector random_to_sphere(RNG& rng, float radius, float distance_sq) {
     float r1 = rng.random_float();
     float r2 = rng.random_float();
     float z = 1.f + r2 * (std::sqrt(1.f - radius*radius/distance_sq) - 1.f);
-    float phi = 2*PI*r1;
-    float x = std::cos(phi) * std::sqrt(1 - z*z);
-    float y = std::sin(phi) * std::sqrt(1 - z*z);
-    return Vector(x, y, z);
+    float sin_theta = std::sqrt(std::max(0.f, 1 - z*z));
+    float sin_phi, cos_phi;
+    fast_sincos(2*PI*r1, sin_phi, cos_phi);
+    return Vector(cos_phi * sin_theta, sin_phi * sin_theta, z);
 }
 
 Vector Sphere::random_direction(RNG& rng, const Vector& o) const {
@@ -73,9 +89,30 @@ Vector Sphere::random_direction(RNG& rng, const Vector& o) const {
     return Axes(v.normalized()).from_local_to_world(random_to_sphere(rng, radius, v.squared_length()));
 }
 
+bool Sphere::sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const {
+    normal = random_unit_vector(rng);
+    point = center + radius * normal;
+    pdf = 1.f / (4.f * PI * radius * radius);
+    return true;
+}
+
+float Sphere::surface_pdf(const Vector& point) const {
+    if (std::abs((point - center).length() - radius) > 1e-3f * radius)
+        return 0.f;
+    return 1.f / (4.f * PI * radius * radius);
+}
+
+bool Moving_Sphere::hit(const Ray& ray, float tMin, float tMax, Ray_Hit& hitRecord) const {
+    STATS_INCREMENT_PRIMITIVE(moving_sphere);
+    float t;
+    if (!ray_sphere_intersect(get_center(ray.time), radius, ray, tMin, tMax, t))
+        return false;
+    hitRecord.set(t, this);
+    return true;
+}
 
-bool Moving_Sphere::hit(const Ray& ray, float tMin, float tMax, Intersection& hitRecord) const {
-    return ray_sphere_intersect(get_center(ray.time), radius, ray, tMin, tMax, material, hitRecord);
+void Moving_Sphere::evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const {
+    evaluate_sphere_hit(get_center(ray.time), radius, material, ray, hit.t, isect);
 }
 
 Bounding_Box Moving_Sphere::boudning_box(float t0, float t1) const {
@@ -9,10 +9,14 @@ public:
     Sphere(const Vector& center, float radius, Material* material)
         : center(center), radius(radius), material(material) {}
 
-    bool hit(const Ray& ray, float tMin, float tMax, Intersection& hitRecord) const override;
+    bool hit(const Ray& ray, float tMin, float tMax, Ray_Hit& hitRecord) const override;
+    void evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const override;
     Bounding_Box boudning_box(float t0, float t1) const override;
     float pdf_value(const Vector& o, const Vector& v) const override;
     Vector random_direction(RNG& rng, const Vector& o) const override;
+    bool sample_surface(RNG& rng, Vector& point, Vector& normal, float& pdf) const override;
+    float surface_pdf(const Vector& point) const override;
+    void get_features(Shape_Features& features) const override { features.add_material(material); }
 
 private:
     Vector center;
@@ -25,8 +29,13 @@ public:
     Moving_Sphere(const Vector& center0, const Vector& center1, float time0, float time1, float radius, Material* material)
         : center0(center0), center1(center1), time0(time0), time1(time1), radius(radius), material(material) {}
 
-    bool hit(const Ray& ray, float tMin, float tMax, Intersection& hitRecord) const override;
+    bool hit(const Ray& ray, float tMin, float tMax, Ray_Hit& hitRecord) const override;
+    void evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const override;
     Bounding_Box boudning_box(float t0, float t1) const override;
+    void get_features(Shape_Features& features) const override {
+        features.add_material(material);
+        features.moving = true;
+    }
 
 private:
     Vector get_center(float time) const {
@@ -39,3 +48,7 @@ private:
     float radius;
     Material* material;
 };
+
+// Shared by the sphere shapes and by geometry that stores spheres without Sphere objects.
+bool ray_sphere_intersect(const Vector& center, float radius, const Ray& ray, float tMin, float tMax, float& t_hit);
+void evaluate_sphere_hit(const Vector& center, float radius, Material* material, const Ray& ray, float t, Intersection& isect);
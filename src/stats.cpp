@@ -0,0 +1,112 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+
+thread_local Stats thread_stats;
+
+static std::mutex registry_mutex;
+static std::vector<Stats*> registry;
+
+#if ENABLE_STATS
+static const char* primitive_type_names[] = {
+    "sphere", "moving sphere", "xy rect", "xz rect", "yz rect"
+};
+#endif
+
+int64_t Stats::cost() const {
+    int64_t c = box_tests;
+    for (int i = 0; i < static_cast<int>(Primitive_Type::count); i++)
+        c += primitive_tests[i];
+    return c;
+}
+
+void Stats::merge(const Stats& other) {
+    for (int i = 0; i < Stats_Max_Depth; i++)
+        rays_per_depth[i] += other.rays_per_depth[i];
+    bvh_nodes_visited += other.bvh_nodes_visited;
+    box_tests += other.box_tests;
+    for (int i = 0; i < static_cast<int>(Primitive_Type::count); i++)
+        primitive_tests[i] += other.primitive_tests[i];
+    pdf_value_calls += other.pdf_value_calls;
+    paths_missed += other.paths_missed;
+    paths_absorbed += other.paths_absorbed;
+    paths_depth_limit += other.paths_depth_limit;
+    paths_cached += other.paths_cached;
+}
+
+void register_thread_stats() {
+#if ENABLE_STATS
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.push_back(&thread_stats);
+#endif
+}
+
+Stats merge_thread_stats() {
+    Stats total = Stats();
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const Stats* stats : registry)
+        total.merge(*stats);
+    return total;
+}
+
+void print_stats_summary(const Stats& stats) {
+#if ENABLE_STATS
+    fprintf(stderr, "Stats:\n");
+    fprintf(stderr, "  rays per depth:\n");
+    for (int i = 0; i < Stats_Max_Depth; i++) {
+        if (stats.rays_per_depth[i] != 0)
+            fprintf(stderr, "    %2d: %lld\n", i, static_cast<long long>(stats.rays_per_depth[i]));
+    }
+    fprintf(stderr, "  BVH nodes visited: %lld\n", static_cast<long long>(stats.bvh_nodes_visited));
+    fprintf(stderr, "  box tests: %lld\n", static_cast<long long>(stats.box_tests));
+    fprintf(stderr, "  primitive tests:\n");
+    for (int i = 0; i < static_cast<int>(Primitive_Type::count); i++)
+        fprintf(stderr, "    %s: %lld\n", primitive_type_names[i], static_cast<long long>(stats.primitive_tests[i]));
+    fprintf(stderr, "  pdf_value calls: %lld\n", static_cast<long long>(stats.pdf_value_calls));
+    fprintf(stderr, "  terminated paths: missed %lld, absorbed %lld, depth limit %lld, radiance cache %lld\n",
+        static_cast<long long>(stats.paths_missed),
+        static_cast<long long>(stats.paths_absorbed),
+        static_cast<long long>(stats.paths_depth_limit),
+        static_cast<long long>(stats.paths_cached));
+#endif
+}
+
+static void heatmap_color(float t, int& r, int& g, int& b) {
+    // blue -> cyan -> green -> yellow -> red
+    static const float colors[5][3] = {
+        {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}
+    };
+    t = std::min(std::max(t, 0.f), 1.f) * 4.f;
+    int i = std::min(static_cast<int>(t), 3);
+    float f = t - i;
+    r = static_cast<int>(255.99f * (colors[i][0] + f * (colors[i + 1][0] - colors[i][0])));
+    g = static_cast<int>(255.99f * (colors[i][1] + f * (colors[i + 1][1] - colors[i][1])));
+    b = static_cast<int>(255.99f * (colors[i][2] + f * (colors[i + 1][2] - colors[i][2])));
+}
+
+void write_cost_heatmap(const std::string& file_name, const std::vector<int64_t>& pixel_costs, int width, int height) {
+    FILE* file = fopen(file_name.c_str(), "w");
+    if (!file) {
+        fprintf(stderr, "failed to open %s\n", file_name.c_str());
+        return;
+    }
+
+    int64_t max_cost = 1;
+    for (int64_t cost : pixel_costs)
+        max_cost = std::max(max_cost, cost);
+    float log_max = std::log(1.f + static_cast<float>(max_cost));
+
+    fprintf(file, "P3\n%d %d\n255\n", width, height);
+    for (int j = height - 1; j >= 0; j--) {
+        for (int i = 0; i < width; i++) {
+            float t = std::log(1.f + static_cast<float>(pixel_costs[j * width + i])) / log_max;
+            int r, g, b;
+            heatmap_color(t, r, g, b);
+            fprintf(file, "%d %d %d\n", r, g, b);
+        }
+    }
+    fclose(file);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Hot-path counters are compiled out unless ENABLE_STATS is defined to 1
+// (e.g. in the project's PreprocessorDefinitions).
+#ifndef ENABLE_STATS
+#define ENABLE_STATS 0
+#endif
+
+enum class Primitive_Type {
+    sphere,
+    moving_sphere,
+    xy_rect,
+    xz_rect,
+    yz_rect,
+    count
+};
+
+constexpr int Stats_Max_Depth = 64;
+
+// Plain zero-initialized struct so that thread_local access needs no init guard.
+struct Stats {
+    int64_t rays_per_depth[Stats_Max_Depth];
+    int64_t bvh_nodes_visited;
+    int64_t box_tests;
+    int64_t primitive_tests[static_cast<int>(Primitive_Type::count)];
+    int64_t pdf_value_calls;
+    int64_t paths_missed;
+    int64_t paths_absorbed;
+    int64_t paths_depth_limit;
+    int64_t paths_cached;
+
+    // Traversal cost units (box tests + primitive tests), used for the per-pixel cost AOV.
+    int64_t cost() const;
+    void merge(const Stats& other);
+};
+
+extern thread_local Stats thread_stats;
+
+#if ENABLE_STATS
+#define STATS_INCREMENT(counter) (++thread_stats.counter)
+#define STATS_INCREMENT_PRIMITIVE(type) (++thread_stats.primitive_tests[static_cast<int>(Primitive_Type::type)])
+#define STATS_INCREMENT_DEPTH(depth) (++thread_stats.rays_per_depth[(depth) < Stats_Max_Depth ? (depth) : Stats_Max_Depth - 1])
+#else
+#define STATS_INCREMENT(counter) ((void)0)
+#define STATS_INCREMENT_PRIMITIVE(type) ((void)0)
+#define STATS_INCREMENT_DEPTH(depth) ((void)0)
+#endif
+
+// Each thread that updates counters registers its thread_local block once so the
+// blocks can be merged after rendering. No-ops when stats are compiled out.
+void register_thread_stats();
+Stats merge_thread_stats();
+void print_stats_summary(const Stats& stats);
+
+// Writes the per-pixel cost AOV as a false-color PPM (log scale, blue = cheap, red = expensive).
+void write_cost_heatmap(const std::string& file_name, const std::vector<int64_t>& pixel_costs, int width, int height);
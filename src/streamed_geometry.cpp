@@ -0,0 +1,371 @@
+#include "streamed_geometry.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace {
+const char Streamed_Geometry_Magic[4] = {'R', 'S', 'G', 'I'};
+const char Streamed_Chunk_Magic[4] = {'R', 'S', 'G', 'C'};
+const uint32_t Streamed_Geometry_Version = 1;
+
+Vector get_center(const Streamed_Sphere& sphere) {
+    return Vector(sphere.center[0], sphere.center[1], sphere.center[2]);
+}
+
+Bounding_Box get_bounds(const Streamed_Sphere& sphere) {
+    Vector center = get_center(sphere);
+    return Bounding_Box(center - Vector(sphere.radius), center + Vector(sphere.radius));
+}
+
+// Splits the spheres into spatial clusters of at most chunk_size, filling all but the last chunk.
+void cluster_spheres(Streamed_Sphere* spheres, size_t n, size_t chunk_size, std::vector<std::pair<size_t, size_t>>& clusters, size_t offset) {
+    if (n <= chunk_size) {
+        clusters.push_back(std::make_pair(offset, n));
+        return;
+    }
+
+    Bounding_Box centroid_bounds;
+    for (size_t i = 0; i < n; i++)
+        centroid_bounds.extend(get_center(spheres[i]));
+
+    Vector extent = centroid_bounds.max_point - centroid_bounds.min_point;
+    int axis = (extent.x > extent.y) ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+    size_t chunk_count = (n + chunk_size - 1) / chunk_size;
+    size_t left_count = (chunk_count / 2) * chunk_size;
+    std::nth_element(spheres, spheres + left_count, spheres + n,
+        [axis](const Streamed_Sphere& a, const Streamed_Sphere& b) {
+            return a.center[axis] < b.center[axis];
+        });
+
+    cluster_spheres(spheres, left_count, chunk_size, clusters, offset);
+    cluster_spheres(spheres + left_count, n - left_count, chunk_size, clusters, offset + left_count);
+}
+
+std::atomic<uint64_t> next_geometry_id{1};
+
+bool hits_chunk_bounds(const Streamed_Chunk_Record& record, const SIMD_Vector& origin, const SIMD_Vector& inv_dir, float t_min, float t_max) {
+    STATS_INCREMENT(box_tests);
+    return intersect_slabs(SIMD_Vector::load3(record.min_point), SIMD_Vector::load3(record.max_point), origin, inv_dir, t_min, t_max);
+}
+}
+
+std::string get_chunk_file_name(const std::string& index_file, uint32_t chunk) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%05u", chunk);
+    return index_file + suffix;
+}
+
+bool write_streamed_geometry(const std::string& index_file, std::vector<Streamed_Sphere> spheres,
+                             uint32_t material_count, int chunk_size)
+{
+    std::vector<std::pair<size_t, size_t>> clusters;
+    if (!spheres.empty())
+        cluster_spheres(spheres.data(), spheres.size(), std::max(chunk_size, 1), clusters, 0);
+
+    std::vector<Streamed_Chunk_Record> records;
+    for (const auto& cluster : clusters) {
+        const Streamed_Sphere* chunk_spheres = spheres.data() + cluster.first;
+
+        std::vector<Bounding_Box> bounds(cluster.second);
+        for (size_t i = 0; i < cluster.second; i++)
+            bounds[i] = get_bounds(chunk_spheres[i]);
+        std::vector<Flat_BVH_Node> nodes = build_flat_bvh(bounds);
+
+        Streamed_Chunk_Header header;
+        memcpy(header.magic, Streamed_Chunk_Magic, sizeof(header.magic));
+        header.version = Streamed_Geometry_Version;
+        header.primitive_count = static_cast<uint32_t>(cluster.second);
+        header.node_count = static_cast<uint32_t>(nodes.size());
+
+        std::ofstream out(get_chunk_file_name(index_file, static_cast<uint32_t>(records.size())), std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(chunk_spheres), cluster.second * sizeof(Streamed_Sphere));
+        out.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(Flat_BVH_Node));
+        if (!out)
+            return false;
+
+        Streamed_Chunk_Record record;
+        memcpy(record.min_point, nodes[0].min_point, sizeof(record.min_point));
+        memcpy(record.max_point, nodes[0].max_point, sizeof(record.max_point));
+        record.primitive_count = header.primitive_count;
+        record.node_count = header.node_count;
+        records.push_back(record);
+    }
+
+    // The index is written last, an interrupted conversion leaves no valid geometry behind.
+    Streamed_Geometry_Header header;
+    memcpy(header.magic, Streamed_Geometry_Magic, sizeof(header.magic));
+    header.version = Streamed_Geometry_Version;
+    header.chunk_count = static_cast<uint32_t>(records.size());
+    header.material_count = material_count;
+
+    std::ofstream out(index_file, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Streamed_Chunk_Record));
+    return bool(out);
+}
+
+Streamed_Geometry::Streamed_Geometry(const std::string& index_file, std::vector<Material*> materials, size_t residency_budget)
+    : id(next_geometry_id.fetch_add(1, std::memory_order_relaxed))
+    , index_file(index_file)
+    , materials(std::move(materials))
+    , residency_budget(residency_budget)
+{
+    std::ifstream in(index_file, std::ios::binary | std::ios::ate);
+    uint64_t file_size = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+
+    // The records are checked against the file size before they are allocated.
+    Streamed_Geometry_Header header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, Streamed_Geometry_Magic, sizeof(header.magic)) != 0 ||
+        header.version != Streamed_Geometry_Version ||
+        header.material_count > this->materials.size() ||
+        file_size < sizeof(header) + uint64_t(header.chunk_count) * sizeof(Streamed_Chunk_Record))
+    {
+        return;
+    }
+
+    std::vector<Streamed_Chunk_Record> records(header.chunk_count);
+    if (!in.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(Streamed_Chunk_Record)))
+        return;
+    chunk_records = std::move(records);
+
+    std::vector<Bounding_Box> bounds(chunk_records.size());
+    for (size_t i = 0; i < chunk_records.size(); i++) {
+        const Streamed_Chunk_Record& record = chunk_records[i];
+        bounds[i] = Bounding_Box(Vector(record.min_point[0], record.min_point[1], record.min_point[2]),
+                                 Vector(record.max_point[0], record.max_point[1], record.max_point[2]));
+        box = Bounding_Box::get_union(box, bounds[i]);
+    }
+    chunk_nodes = build_flat_bvh(bounds);
+
+    // The mapped chunks count against the scene memory up to the budget.
+    add_memory_usage(chunk_records.capacity() * sizeof(Streamed_Chunk_Record) +
+                     chunk_nodes.capacity() * sizeof(Flat_BVH_Node) + residency_budget);
+}
+
+std::shared_ptr<const Streamed_Geometry::Chunk> Streamed_Geometry::load_chunk(uint32_t chunk_index) const {
+    const Streamed_Chunk_Record& record = chunk_records[chunk_index];
+    auto chunk = std::make_shared<Chunk>();
+    if (!chunk->file.open(get_chunk_file_name(index_file, chunk_index)))
+        return nullptr;
+
+    const Streamed_Chunk_Header* header = reinterpret_cast<const Streamed_Chunk_Header*>(chunk->file.get_data());
+    size_t spheres_size = size_t(record.primitive_count) * sizeof(Streamed_Sphere);
+    if (chunk->file.get_size() < sizeof(Streamed_Chunk_Header) ||
+        memcmp(header->magic, Streamed_Chunk_Magic, sizeof(header->magic)) != 0 ||
+        header->version != Streamed_Geometry_Version ||
+        header->primitive_count != record.primitive_count ||
+        header->node_count != record.node_count ||
+        chunk->file.get_size() < sizeof(Streamed_Chunk_Header) + spheres_size + record.node_count * sizeof(Flat_BVH_Node))
+    {
+        return nullptr;
+    }
+
+    chunk->spheres = reinterpret_cast<const Streamed_Sphere*>(chunk->file.get_data() + sizeof(Streamed_Chunk_Header));
+    chunk->nodes = reinterpret_cast<const Flat_BVH_Node*>(chunk->file.get_data() + sizeof(Streamed_Chunk_Header) + spheres_size);
+    chunk->node_count = record.node_count;
+
+    // Traversal and shading index straight into the mapping, so a corrupted chunk is rejected here.
+    for (uint32_t i = 0; i < record.primitive_count; i++) {
+        if (chunk->spheres[i].material >= materials.size())
+            return nullptr;
+    }
+    for (uint32_t i = 0; i < record.node_count; i++) {
+        const uint32_t children[2] = {chunk->nodes[i].left, chunk->nodes[i].right};
+        for (uint32_t child : children) {
+            // Nodes are stored before their children, which also rules out cycles.
+            bool valid = (child & Flat_BVH_Node::Leaf_Flag)
+                ? (child & ~Flat_BVH_Node::Leaf_Flag) < record.primitive_count
+                : child > i && child < record.node_count;
+            if (!valid)
+                return nullptr;
+        }
+    }
+    return chunk;
+}
+
+const Streamed_Geometry::Chunk* Streamed_Geometry::get_chunk(uint32_t chunk_index) const {
+    // Rays keep coming back to the same few chunks, those are found without locking.
+    thread_local Thread_Cache_Entry thread_cache[Thread_Cache_Size];
+    Thread_Cache_Entry& entry = thread_cache[chunk_index % Thread_Cache_Size];
+    if (entry.geometry_id == id && entry.chunk_index == chunk_index && !entry.chunk->evicted.load(std::memory_order_relaxed)) {
+        // Written only when it changes, so that threads sharing a chunk do not contend for its cache line.
+        uint64_t now = use_clock.load(std::memory_order_relaxed);
+        if (entry.chunk->last_use.load(std::memory_order_relaxed) != now)
+            entry.chunk->last_use.store(now, std::memory_order_relaxed);
+        return entry.chunk.get();
+    }
+
+    std::shared_ptr<const Chunk> chunk = get_resident_chunk(chunk_index);
+    if (!chunk)
+        return nullptr;
+    entry.geometry_id = id;
+    entry.chunk_index = chunk_index;
+    entry.chunk = std::move(chunk);
+    return entry.chunk.get();
+}
+
+std::shared_ptr<const Streamed_Geometry::Chunk> Streamed_Geometry::get_resident_chunk(uint32_t chunk_index) const {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = resident_chunks.find(chunk_index);
+        if (it != resident_chunks.end()) {
+            it->second->last_use.store(use_clock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return it->second;
+        }
+    }
+
+    // Mapped outside of the lock so that rays in resident chunks are not held up.
+    std::shared_ptr<const Chunk> chunk = load_chunk(chunk_index);
+    if (!chunk)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = resident_chunks.find(chunk_index);
+    if (it != resident_chunks.end())
+        return it->second;
+
+    chunk->last_use.store(use_clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    resident_chunks[chunk_index] = chunk;
+    resident_size += chunk->file.get_size();
+    load_count++;
+
+    // Keep at least one chunk so that a budget smaller than a chunk still works.
+    while (resident_size > residency_budget && resident_chunks.size() > 1) {
+        auto evicted = resident_chunks.end();
+        for (auto it = resident_chunks.begin(); it != resident_chunks.end(); ++it) {
+            if (it->first != chunk_index && (evicted == resident_chunks.end() ||
+                it->second->last_use.load(std::memory_order_relaxed) < evicted->second->last_use.load(std::memory_order_relaxed)))
+            {
+                evicted = it;
+            }
+        }
+        evicted->second->evicted.store(true, std::memory_order_relaxed);
+        resident_size -= evicted->second->file.get_size();
+        resident_chunks.erase(evicted);
+    }
+    return chunk;
+}
+
+bool Streamed_Geometry::is_resident(uint32_t chunk_index) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return resident_chunks.count(chunk_index) != 0;
+}
+
+size_t Streamed_Geometry::get_resident_size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return resident_size;
+}
+
+int64_t Streamed_Geometry::get_load_count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return load_count;
+}
+
+bool Streamed_Geometry::hit_chunk(const Chunk& chunk, uint32_t chunk_index, const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const {
+    return traverse_flat_bvh(chunk.nodes, chunk.node_count, ray, t_min, t_max, [&](uint32_t index, float closest_t, float& t) {
+        STATS_INCREMENT_PRIMITIVE(sphere);
+        const Streamed_Sphere& sphere = chunk.spheres[index];
+        if (!ray_sphere_intersect(get_center(sphere), sphere.radius, ray, t_min, closest_t, t))
+            return false;
+        hit_record.set(t, this, (uint64_t(chunk_index) << 32) | index);
+        return true;
+    });
+}
+
+bool Streamed_Geometry::hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const {
+    SIMD_Vector origin(ray.origin);
+    SIMD_Vector inv_dir = SIMD_Vector(1.f) / SIMD_Vector(ray.direction);
+
+    return traverse_flat_bvh(chunk_nodes.data(), static_cast<uint32_t>(chunk_nodes.size()), ray, t_min, t_max,
+        [&](uint32_t chunk_index, float closest_t, float& t) {
+            if (!hits_chunk_bounds(chunk_records[chunk_index], origin, inv_dir, t_min, closest_t))
+                return false;
+            const Chunk* chunk = get_chunk(chunk_index);
+            if (!chunk || !hit_chunk(*chunk, chunk_index, ray, t_min, closest_t, hit_record))
+                return false;
+            t = hit_record.t;
+            return true;
+        });
+}
+
+void Streamed_Geometry::hit_batch(const Ray* rays, int count, float t_min, float* t_max, Ray_Hit* hits) const {
+    // (chunk, ray) pairs for every chunk whose bounds a ray crosses.
+    std::vector<std::pair<uint32_t, int>> requests;
+    for (int i = 0; i < count; i++) {
+        SIMD_Vector origin(rays[i].origin);
+        SIMD_Vector inv_dir = SIMD_Vector(1.f) / SIMD_Vector(rays[i].direction);
+        traverse_flat_bvh(chunk_nodes.data(), static_cast<uint32_t>(chunk_nodes.size()), rays[i], t_min, t_max[i],
+            [&](uint32_t chunk_index, float closest_t, float& t) {
+                if (hits_chunk_bounds(chunk_records[chunk_index], origin, inv_dir, t_min, closest_t))
+                    requests.push_back(std::make_pair(chunk_index, i));
+                return false;
+            });
+    }
+    std::sort(requests.begin(), requests.end());
+
+    struct Chunk_Rays {
+        uint32_t chunk_index;
+        size_t begin, end;
+    };
+    std::vector<Chunk_Rays> groups;
+    for (size_t begin = 0; begin < requests.size();) {
+        size_t end = begin;
+        while (end < requests.size() && requests[end].first == requests[begin].first)
+            end++;
+        groups.push_back(Chunk_Rays{requests[begin].first, begin, end});
+        begin = end;
+    }
+
+    // Resident chunks first: their hits shorten the rays before anything is paged in.
+    std::stable_partition(groups.begin(), groups.end(), [this](const Chunk_Rays& group) {
+        return is_resident(group.chunk_index);
+    });
+
+    for (const Chunk_Rays& group : groups) {
+        const Chunk* chunk = get_chunk(group.chunk_index);
+        if (!chunk)
+            continue;
+        for (size_t r = group.begin; r < group.end; r++) {
+            int i = requests[r].second;
+            Ray_Hit hit_record;
+            if (hit_chunk(*chunk, group.chunk_index, rays[i], t_min, t_max[i], hit_record)) {
+                hits[i] = hit_record;
+                t_max[i] = hit_record.t;
+            }
+        }
+    }
+}
+
+void Streamed_Geometry::evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const {
+    // Pages the chunk back in if it was evicted since the hit was found.
+    const Chunk* chunk = get_chunk(static_cast<uint32_t>(hit.primitive_id >> 32));
+    if (!chunk) {
+        // The chunk file went away or could not be mapped again. Shaded as a surface facing the
+        // ray instead, with the first material (there is one, the chunk passed load_chunk before).
+        std::call_once(reload_failure_reported, [this, &hit]() {
+            fprintf(stderr, "failed to reload %s\n", get_chunk_file_name(index_file, static_cast<uint32_t>(hit.primitive_id >> 32)).c_str());
+        });
+        isect.t = hit.t;
+        isect.p = ray.PointAtParameter(hit.t);
+        isect.normal = -ray.direction.normalized();
+        isect.u = isect.v = 0.f;
+        isect.uv_density = 1.f;
+        isect.material = materials[0];
+        return;
+    }
+    const Streamed_Sphere& sphere = chunk->spheres[static_cast<uint32_t>(hit.primitive_id)];
+    evaluate_sphere_hit(get_center(sphere), sphere.radius, materials[sphere.material], ray, hit.t, isect);
+}
+
+void Streamed_Geometry::get_features(Shape_Features& features) const {
+    for (const Material* material : materials)
+        features.add_material(material);
+    features.streamed = true;
+}
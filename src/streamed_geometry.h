@@ -0,0 +1,120 @@
+#pragma once
+
+#include "flat_bvh.h"
+#include "mapped_file.h"
+#include "shape.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Sphere as stored in a geometry chunk, material indexes the material table of the geometry.
+struct Streamed_Sphere {
+    float center[3];
+    float radius;
+    uint32_t material;
+};
+
+// On-disk layout of streamed geometry. The index file is kept resident:
+//   Streamed_Geometry_Header
+//   Streamed_Chunk_Record[chunk_count]
+// and each chunk is a separate file (see get_chunk_file_name) holding a spatial cluster of spheres
+// with its own hierarchy:
+//   Streamed_Chunk_Header
+//   Streamed_Sphere[primitive_count]
+//   Flat_BVH_Node[node_count]
+struct Streamed_Geometry_Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t chunk_count;
+    uint32_t material_count;
+};
+
+struct Streamed_Chunk_Record {
+    float min_point[3];
+    uint32_t primitive_count;
+    float max_point[3];
+    uint32_t node_count;
+};
+
+struct Streamed_Chunk_Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t primitive_count;
+    uint32_t node_count;
+};
+
+std::string get_chunk_file_name(const std::string& index_file, uint32_t chunk);
+
+// Offline conversion of a sphere set to streamed geometry, clustered into chunks of at most chunk_size spheres.
+bool write_streamed_geometry(const std::string& index_file, std::vector<Streamed_Sphere> spheres,
+                             uint32_t material_count, int chunk_size);
+
+// Geometry larger than memory. Only the index and a hierarchy over the chunk bounds stay resident;
+// chunks are memory-mapped when a ray reaches them and unmapped least recently used first when the
+// mapped chunks exceed the residency budget. Rays still tracing a chunk keep it mapped until they are done.
+// Each thread keeps the chunks it used last and finds them there without locking, an evicted chunk stays
+// mapped until the thread looks up another one in its place.
+class Streamed_Geometry : public Shape {
+public:
+    // materials are indexed by Streamed_Sphere::material.
+    Streamed_Geometry(const std::string& index_file, std::vector<Material*> materials, size_t residency_budget);
+
+    bool is_valid() const { return !chunk_records.empty(); }
+
+    bool hit(const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const override;
+    // Groups the rays by the chunks they reach and traces resident chunks first, so each missing
+    // chunk is paged in once per batch instead of once per ray.
+    void hit_batch(const Ray* rays, int count, float t_min, float* t_max, Ray_Hit* hits) const override;
+    void evaluate_hit(const Ray& ray, const Ray_Hit& hit, Intersection& isect) const override;
+    Bounding_Box boudning_box(float t0, float t1) const override { return box; }
+    void get_features(Shape_Features& features) const override;
+
+    size_t get_resident_size() const;
+    int64_t get_load_count() const;
+
+private:
+    struct Chunk {
+        Mapped_File file;
+        const Streamed_Sphere* spheres = nullptr;
+        const Flat_BVH_Node* nodes = nullptr;
+        uint32_t node_count = 0;
+
+        // Value of use_clock when the chunk was last used, the smallest one is evicted first.
+        mutable std::atomic<uint64_t> last_use{0};
+        mutable std::atomic<bool> evicted{false};
+    };
+
+    struct Thread_Cache_Entry {
+        uint64_t geometry_id = 0;
+        uint32_t chunk_index = 0;
+        std::shared_ptr<const Chunk> chunk;
+    };
+    static const int Thread_Cache_Size = 4;
+
+    // The chunk stays valid until the calling thread gets the next one.
+    const Chunk* get_chunk(uint32_t chunk_index) const;
+    std::shared_ptr<const Chunk> get_resident_chunk(uint32_t chunk_index) const;
+    std::shared_ptr<const Chunk> load_chunk(uint32_t chunk_index) const;
+    bool is_resident(uint32_t chunk_index) const;
+    bool hit_chunk(const Chunk& chunk, uint32_t chunk_index, const Ray& ray, float t_min, float t_max, Ray_Hit& hit_record) const;
+
+    uint64_t id; // identifies the geometry in the thread caches
+    std::string index_file;
+    std::vector<Material*> materials;
+    std::vector<Streamed_Chunk_Record> chunk_records;
+    std::vector<Flat_BVH_Node> chunk_nodes;
+    Bounding_Box box;
+
+    size_t residency_budget;
+    mutable std::atomic<uint64_t> use_clock{0}; // advanced by every chunk load
+    mutable std::mutex mutex;
+    mutable std::unordered_map<uint32_t, std::shared_ptr<const Chunk>> resident_chunks;
+    mutable size_t resident_size = 0;
+    mutable int64_t load_count = 0;
+    mutable std::once_flag reload_failure_reported;
+};
@@ -2,41 +2,107 @@
 #include "texture.h"
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 
-Vector Constant_Texture::value(float, float, const Vector&) const {
+Vector Constant_Texture::value(float, float, const Vector&, float) const {
     return color;
 }
 
-Vector Checker_Texture::value(float u, float v, const Vector& p) const {
+Vector Checker_Texture::value(float u, float v, const Vector& p, float footprint) const {
     float sines = std::sin(10 * p.x) * std::sin(10 * p.y) * std::sin(10 * p.z);
     if (sines < 0.f)
-        return odd->value(u, v, p);
+        return odd->value(u, v, p, footprint);
     else
-        return even->value(u, v, p);
+        return even->value(u, v, p, footprint);
 }
 
-Vector Noise_Texture::value(float u, float v, const Vector& p) const {
-    //float f = 0.5f * (perlin_noise(p * scale) + 1.f);
-    //float f = perlin_turbulence(p * scale);
-    float f = 0.5f * (1.f + std::sin(scale*p.x + 5.f * perlin_turbulence(scale*p)));
+Vector Noise_Texture::value(float u, float v, const Vector& p, float footprint) const {
+    //float f = 0.5f * (perlin->noise(p * scale) + 1.f);
+    //float f = perlin->turbulence(p * scale);
+    Vector noise_p = scale * p;
+    float turbulence;
+    if (!baked_turbulence || !baked_turbulence->sample(noise_p, turbulence))
+        turbulence = perlin->turbulence(noise_p);
+
+    float f = 0.5f * (1.f + std::sin(scale*p.x + 5.f * turbulence));
     return Vector(1) * f;
 }
 
-Vector Image_Texture::value(float u, float v, const Vector& p) const {
-    assert(u >= 0.f && u <= 1.f);
-    assert(v >= 0.f && v <= 1.f);
+void downsample_rgb8(const unsigned char* src, int src_w, int src_h, unsigned char* dst, int dst_w, int dst_h) {
+    for (int y = 0; y < dst_h; y++) {
+        int y0 = std::min(2 * y, src_h - 1);
+        int y1 = std::min(2 * y + 1, src_h - 1);
+
+        for (int x = 0; x < dst_w; x++) {
+            int x0 = std::min(2 * x, src_w - 1);
+            int x1 = std::min(2 * x + 1, src_w - 1);
+
+            for (int c = 0; c < 3; c++) {
+                int sum = src[3 * (x0 + src_w * y0) + c] + src[3 * (x1 + src_w * y0) + c] +
+                          src[3 * (x0 + src_w * y1) + c] + src[3 * (x1 + src_w * y1) + c];
+                dst[3 * (x + dst_w * y) + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+Image_Texture::Image_Texture(unsigned char* pixels, int w, int h) {
+    levels.push_back(Mip_Level{w, h, pixels});
+
+    while (w > 1 || h > 1) {
+        int level_w = std::max(1, w / 2);
+        int level_h = std::max(1, h / 2);
 
-    int x = static_cast<int>(u * w);
-    int y = static_cast<int>((1.f - v) * h);
+        level_storage.emplace_back(3 * level_w * level_h);
+        downsample_rgb8(levels.back().pixels, w, h, level_storage.back().data(), level_w, level_h);
+        levels.push_back(Mip_Level{level_w, level_h, level_storage.back().data()});
+
+        w = level_w;
+        h = level_h;
+    }
+}
 
-    assert(x >= 0 && x <= w);
-    assert(y >= 0 && y <= h);
+Vector Image_Texture::bilinear(const Mip_Level& level, float u, float v) const {
+    float x = u * level.w - 0.5f;
+    float y = (1.f - v) * level.h - 0.5f;
 
-    x = std::min(x, w - 1);
-    y = std::min(y, h - 1);
+    int x0 = static_cast<int>(std::floor(x));
+    int y0 = static_cast<int>(std::floor(y));
+    float fx = x - x0;
+    float fy = y - y0;
+
+    int x1 = std::min(std::max(x0 + 1, 0), level.w - 1);
+    int y1 = std::min(std::max(y0 + 1, 0), level.h - 1);
+    x0 = std::min(std::max(x0, 0), level.w - 1);
+    y0 = std::min(std::max(y0, 0), level.h - 1);
+
+    auto texel = [&level](int x, int y) {
+        auto pixel = &level.pixels[3*(x + level.w*y)];
+        return Vector(pixel[0], pixel[1], pixel[2]);
+    };
+
+    Vector top = (1.f - fx) * texel(x0, y0) + fx * texel(x1, y0);
+    Vector bottom = (1.f - fx) * texel(x0, y1) + fx * texel(x1, y1);
+    return (1.f - fy) * top + fy * bottom;
+}
+
+Vector Image_Texture::value(float u, float v, const Vector& p, float footprint) const {
+    assert(u >= 0.f && u <= 1.f);
+    assert(v >= 0.f && v <= 1.f);
 
     static constexpr float norm_coeff = 1 / 255.f;
 
-    auto pixel = &pixels[3*(x + w*y)];
-    return Vector(pixel[0], pixel[1], pixel[2]) * norm_coeff;
+    // Level 0 has one texel per footprint when footprint * size == 1.
+    float texels = footprint * std::max(levels[0].w, levels[0].h);
+    float level = texels > 1.f ? std::log2(texels) : 0.f;
+    level = std::min(level, float(levels.size() - 1));
+
+    int level0 = static_cast<int>(level);
+    int level1 = std::min(level0 + 1, static_cast<int>(levels.size()) - 1);
+    float t = level - level0;
+
+    Vector color = bilinear(levels[level0], u, v);
+    if (t > 0.f)
+        color = (1.f - t) * color + t * bilinear(levels[level1], u, v);
+    return color * norm_coeff;
 }
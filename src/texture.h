@@ -1,16 +1,22 @@
 #pragma once
 
+#include "scene_resources.h"
 #include "vector.h"
 
-class Texture {
+#include <vector>
+
+class Texture : public Scene_Object {
 public:
-    virtual Vector value(float u, float v, const Vector& p) const = 0;
+    // footprint is the size of the ray footprint in uv space (0 for a point sample).
+    virtual Vector value(float u, float v, const Vector& p, float footprint) const = 0;
+    // True if value() filters by the footprint, which then has to be tracked with ray cones.
+    virtual bool uses_footprint() const { return false; }
 };
 
 class Constant_Texture : public Texture {
 public:
     Constant_Texture(Vector color) : color(color) {}
-    Vector value(float, float, const Vector&) const override;
+    Vector value(float, float, const Vector&, float) const override;
 
 private:
     Vector color;
@@ -19,28 +25,50 @@ private:
 class Checker_Texture : public Texture {
 public:
     Checker_Texture(Texture* odd, Texture* even) : odd(odd), even(even) {}
-    Vector value(float, float, const Vector&) const override;
+    Vector value(float, float, const Vector&, float) const override;
+    bool uses_footprint() const override { return odd->uses_footprint() || even->uses_footprint(); }
 
 private:
     Texture* odd;
     Texture* even;
 };
 
+class Perlin;
+class Baked_Turbulence;
+
 class Noise_Texture : public Texture {
 public:
-    Noise_Texture(float scale) : scale(scale) {}
-    Vector value(float u, float v, const Vector& p) const override;
+    // If baked_turbulence is provided it is sampled instead of evaluating the turbulence
+    // procedurally (the procedural evaluation is still used outside of the baked region).
+    Noise_Texture(const Perlin* perlin, float scale, const Baked_Turbulence* baked_turbulence = nullptr)
+        : perlin(perlin), scale(scale), baked_turbulence(baked_turbulence) {}
+    Vector value(float u, float v, const Vector& p, float footprint) const override;
 
 private:
+    const Perlin* perlin;
     float scale;
+    const Baked_Turbulence* baked_turbulence;
 };
 
+// 2x2 box filter used to build MIP levels of 8-bit RGB images.
+void downsample_rgb8(const unsigned char* src, int src_w, int src_h, unsigned char* dst, int dst_w, int dst_h);
+
+// 8-bit RGB image with a MIP pyramid built at load time. Lookups are trilinear,
+// the MIP level is selected from the footprint of the ray cone.
 class Image_Texture : public Texture {
 public:
-    Image_Texture(unsigned char* pixels, int w, int h) : pixels(pixels), w(w), h(h) {}
-    Vector value(float u, float v, const Vector& p) const override;
+    Image_Texture(unsigned char* pixels, int w, int h);
+    Vector value(float u, float v, const Vector& p, float footprint) const override;
+    bool uses_footprint() const override { return true; }
 
 private:
-    unsigned char* pixels;
-    int w, h;
+    struct Mip_Level {
+        int w, h;
+        const unsigned char* pixels;
+    };
+
+    Vector bilinear(const Mip_Level& level, float u, float v) const;
+
+    std::vector<Mip_Level> levels;
+    std::vector<std::vector<unsigned char>> level_storage;
 };
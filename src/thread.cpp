@@ -1,55 +1,147 @@
 #include "thread.h"
+#include "stats.h"
 
-Task* Thread::pending_task = nullptr;
-HANDLE Thread::task_ready_event = NULL;
-HANDLE Thread::task_commited_event = NULL;
-std::vector<HANDLE> Thread::task_completed_events;
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 
-Thread::Thread(int processor) {
-	if (!task_ready_event) {
-		task_ready_event = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+namespace {
+struct Task_Queues {
+	std::mutex mutex;
+	// Signaled when tasks arrive and when the pool becomes idle.
+	std::condition_variable changed;
+
+	Task* pending_task = nullptr;
+	std::vector<std::deque<Task*>> node_queues;
+	std::vector<std::deque<Task*>> node_local_queues;
+	int running_task_count = 0;
+};
+
+// Never destroyed, the workers still wait on it when the process exits.
+Task_Queues& queues = *new Task_Queues;
+
+thread_local int current_node = 0;
+
+bool has_queued_tasks() {
+	if (queues.pending_task)
+		return true;
+	for (size_t i = 0; i < queues.node_queues.size(); i++) {
+		if (!queues.node_queues[i].empty() || !queues.node_local_queues[i].empty())
+			return true;
 	}
-	if (!task_commited_event) {
-		task_commited_event = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	return false;
+}
+
+// Tasks committed or queued without worker threads run on the calling thread.
+void run_inline(Task* task) {
+	static RNG rng;
+	task->run(rng);
+}
+}
+
+int Thread::thread_count = 0;
+int Thread::node_count = 1;
+
+Thread::Thread(const Logical_Processor* processor)
+	: node(processor ? processor->node_index : 0)
+{
+	{
+		std::lock_guard<std::mutex> lock(queues.mutex);
+		thread_count++;
+		node_count = std::max(node_count, node + 1);
+		queues.node_queues.resize(node_count);
+		queues.node_local_queues.resize(node_count);
 	}
 
 	thread = ::CreateThread(NULL, 0, &Thread::main, (LPVOID)this, 0, NULL);
-	task_completed_event = ::CreateEvent(NULL, FALSE, TRUE, NULL);
-	task_completed_events.push_back(task_completed_event);
-
-	if (thread && processor != -1) {
-		::SetThreadAffinityMask(thread, 1ull << processor);
+	if (thread && processor) {
+		pin_thread(thread, *processor);
 	}
 }
 
 void Thread::commit_task(Task* task) {
-	pending_task = task;
-	::SetEvent(task_ready_event);
-	::WaitForSingleObject(task_commited_event, INFINITE);
+	if (thread_count == 0) {
+		run_inline(task);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(queues.mutex);
+	queues.pending_task = task;
+	queues.changed.notify_all();
+	queues.changed.wait(lock, [] { return queues.pending_task == nullptr; });
+}
+
+void Thread::queue_task(Task* task, int node, bool node_local) {
+	if (thread_count == 0) {
+		run_inline(task);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(queues.mutex);
+	node = std::min(std::max(node, 0), node_count - 1);
+	(node_local ? queues.node_local_queues : queues.node_queues)[node].push_back(task);
+	queues.changed.notify_all();
 }
 
 void Thread::wait_for_tasks() {
-	::WaitForMultipleObjects(static_cast<DWORD>(task_completed_events.size()), task_completed_events.data(), TRUE, INFINITE);
+	std::unique_lock<std::mutex> lock(queues.mutex);
+	queues.changed.wait(lock, [] { return queues.running_task_count == 0 && !has_queued_tasks(); });
+}
+
+int Thread::get_current_node() {
+	return current_node;
+}
+
+// The committed task first since its caller is waiting, then the tasks of the node, then the
+// oldest task of the other nodes.
+Task* Thread::take_task(int node) {
+	Task* task = nullptr;
+	if (queues.pending_task) {
+		task = queues.pending_task;
+		queues.pending_task = nullptr;
+	} else if (!queues.node_local_queues[node].empty()) {
+		task = queues.node_local_queues[node].front();
+		queues.node_local_queues[node].pop_front();
+	} else if (!queues.node_queues[node].empty()) {
+		task = queues.node_queues[node].front();
+		queues.node_queues[node].pop_front();
+	} else {
+		for (int i = 1; i < node_count && !task; i++) {
+			std::deque<Task*>& queue = queues.node_queues[(node + i) % node_count];
+			if (!queue.empty()) {
+				task = queue.front();
+				queue.pop_front();
+			}
+		}
+	}
+	return task;
 }
 
 DWORD Thread::main(PVOID pv_param) {
 	Thread* thread = static_cast<Thread*>(pv_param);
+	current_node = thread->node;
+	register_thread_stats();
 
+	std::unique_lock<std::mutex> lock(queues.mutex);
 	while (true) {
 		// get the next task
-		::WaitForSingleObject(task_ready_event, INFINITE);
-		::ResetEvent(thread->task_completed_event);
-		Task* task = pending_task;
-		::SetEvent(task_commited_event);
-
-		if (!task)
-            break;
+		Task* task = take_task(thread->node);
+		if (!task) {
+			queues.changed.wait(lock);
+			continue;
+		}
+		queues.running_task_count++;
+		queues.changed.notify_all();
+		lock.unlock();
 
-        // do the job
+		// do the job
 		task->run(thread->rng);
 
 		// notify that job is done
-		::SetEvent(thread->task_completed_event);
+		lock.lock();
+		queues.running_task_count--;
+		queues.changed.notify_all();
 	}
 	return 0;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "cpu_topology.h"
 #include "random.h"
 
 #include <vector>
@@ -12,22 +13,33 @@ public:
 	virtual void run(RNG& rng) = 0;
 };
 
+// Worker threads with a task queue per NUMA node. Threads take the tasks of their own node first
+// and help other nodes when they run out of work.
 class Thread {
 public:
-	Thread(int processor = -1);
+	// Pinned to the processor if one is given, serving the node index of the processor.
+	Thread(const Logical_Processor* processor = nullptr);
+
+	// Hands the task to the next free thread of any node, waits until one takes it.
 	static void commit_task(Task* task);
+	// Queues the task for the threads of the node without waiting. Other nodes may take it
+	// unless it is node local.
+	static void queue_task(Task* task, int node, bool node_local = false);
 	static void wait_for_tasks();
 
+	// Node index of the calling thread, 0 for threads outside the pool.
+	static int get_current_node();
+	static int get_node_count() { return node_count; }
+
 private:
 	static DWORD WINAPI main(PVOID pv_param);
+	static Task* take_task(int node);
 
 private:
 	HANDLE thread;
-	HANDLE task_completed_event;
-    RNG rng;
+	int node;
+	RNG rng;
 
-	static Task* pending_task;
-	static HANDLE task_ready_event;
-	static HANDLE task_commited_event;
-	static std::vector<HANDLE> task_completed_events;
+	static int thread_count;
+	static int node_count;
 };
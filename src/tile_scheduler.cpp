@@ -0,0 +1,148 @@
+#include "tile_scheduler.h"
+
+#include <algorithm>
+
+namespace {
+// Expected number of tiles per thread after splitting of expensive tiles.
+const int Tiles_Per_Thread = 8;
+// Tiles in the last part of the frame are split down to this fraction of the regular target cost.
+const int Tail_Split_Factor = 4;
+const int Min_Tile_Size = 4;
+
+struct Scheduled_Tile {
+    Tile tile;
+    float cost;
+};
+}
+
+Cost_Map::Cost_Map(int image_width, int image_height, int block_size)
+    : image_width(image_width)
+    , image_height(image_height)
+    , block_size(block_size)
+    , blocks_x((image_width + block_size - 1) / block_size)
+    , blocks_y((image_height + block_size - 1) / block_size)
+    , block_costs(blocks_x * blocks_y, 0.f)
+    , measured(false)
+{}
+
+void Cost_Map::clear() {
+    std::fill(block_costs.begin(), block_costs.end(), 0.f);
+    measured = false;
+}
+
+void Cost_Map::add_tile_cost(const Tile& tile, float cost) {
+    float cost_per_pixel = cost / float(tile.width() * tile.height());
+
+    for (int by = tile.y1 / block_size; by * block_size < tile.y2; by++) {
+        int y1 = std::max(tile.y1, by * block_size);
+        int y2 = std::min(tile.y2, (by + 1) * block_size);
+
+        for (int bx = tile.x1 / block_size; bx * block_size < tile.x2; bx++) {
+            int x1 = std::max(tile.x1, bx * block_size);
+            int x2 = std::min(tile.x2, (bx + 1) * block_size);
+            block_costs[by * blocks_x + bx] += cost_per_pixel * float((x2 - x1) * (y2 - y1));
+        }
+    }
+    measured = true;
+}
+
+float Cost_Map::get_tile_cost(const Tile& tile) const {
+    if (!measured)
+        return float(tile.width() * tile.height());
+
+    float cost = 0.f;
+    for (int by = tile.y1 / block_size; by * block_size < tile.y2; by++) {
+        int block_y1 = by * block_size;
+        int block_y2 = std::min(image_height, block_y1 + block_size);
+        int y1 = std::max(tile.y1, block_y1);
+        int y2 = std::min(tile.y2, block_y2);
+
+        for (int bx = tile.x1 / block_size; bx * block_size < tile.x2; bx++) {
+            int block_x1 = bx * block_size;
+            int block_x2 = std::min(image_width, block_x1 + block_size);
+            int x1 = std::max(tile.x1, block_x1);
+            int x2 = std::min(tile.x2, block_x2);
+
+            float overlap = float((x2 - x1) * (y2 - y1)) / float((block_x2 - block_x1) * (block_y2 - block_y1));
+            cost += overlap * block_costs[by * blocks_x + bx];
+        }
+    }
+    return cost;
+}
+
+float Cost_Map::get_total_cost() const {
+    if (!measured)
+        return float(image_width * image_height);
+
+    float total = 0.f;
+    for (float cost : block_costs)
+        total += cost;
+    return total;
+}
+
+static void split_tile(const Cost_Map& cost_map, const Scheduled_Tile& tile, float target_cost, std::vector<Scheduled_Tile>& result) {
+    bool can_split = tile.tile.width() >= 2 * Min_Tile_Size || tile.tile.height() >= 2 * Min_Tile_Size;
+    if (tile.cost <= target_cost || !can_split) {
+        result.push_back(tile);
+        return;
+    }
+
+    Tile a = tile.tile;
+    Tile b = tile.tile;
+    if (tile.tile.width() >= tile.tile.height()) {
+        a.x2 = b.x1 = tile.tile.x1 + tile.tile.width() / 2;
+    } else {
+        a.y2 = b.y1 = tile.tile.y1 + tile.tile.height() / 2;
+    }
+    split_tile(cost_map, Scheduled_Tile{a, cost_map.get_tile_cost(a)}, target_cost, result);
+    split_tile(cost_map, Scheduled_Tile{b, cost_map.get_tile_cost(b)}, target_cost, result);
+}
+
+static void sort_by_decreasing_cost(std::vector<Scheduled_Tile>& tiles) {
+    std::stable_sort(tiles.begin(), tiles.end(), [](const Scheduled_Tile& a, const Scheduled_Tile& b) {
+        return a.cost > b.cost;
+    });
+}
+
+std::vector<Tile> schedule_tiles(const Cost_Map& cost_map, int image_width, int image_height, int tile_size, int thread_count) {
+    std::vector<Scheduled_Tile> grid;
+    for (int y = 0; y < image_height; y += tile_size) {
+        for (int x = 0; x < image_width; x += tile_size) {
+            Tile tile{x, y, std::min(x + tile_size, image_width), std::min(y + tile_size, image_height)};
+            grid.push_back(Scheduled_Tile{tile, cost_map.get_tile_cost(tile)});
+        }
+    }
+
+    if (!cost_map.has_measurements()) {
+        std::vector<Tile> tiles;
+        for (const auto& tile : grid)
+            tiles.push_back(tile.tile);
+        return tiles;
+    }
+
+    float total_cost = cost_map.get_total_cost();
+    float target_cost = total_cost / float(std::max(thread_count, 1) * Tiles_Per_Thread);
+
+    std::vector<Scheduled_Tile> split;
+    for (const auto& tile : grid)
+        split_tile(cost_map, tile, target_cost, split);
+    sort_by_decreasing_cost(split);
+
+    // The last tiles are the ones that leave cores idle when they run long.
+    float tail_cost = target_cost * float(std::max(thread_count, 1));
+    float scheduled_cost = 0.f;
+    std::vector<Scheduled_Tile> scheduled;
+    for (const auto& tile : split) {
+        if (total_cost - scheduled_cost <= tail_cost)
+            split_tile(cost_map, tile, target_cost / Tail_Split_Factor, scheduled);
+        else
+            scheduled.push_back(tile);
+        scheduled_cost += tile.cost;
+    }
+
+    std::vector<Tile> tiles;
+    tiles.reserve(scheduled.size());
+    for (const auto& tile : scheduled)
+        tiles.push_back(tile.tile);
+    return tiles;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+struct Tile {
+    int x1, y1;
+    int x2, y2;
+
+    int width() const { return x2 - x1; }
+    int height() const { return y2 - y1; }
+};
+
+// Measured render cost of the image on a coarse grid of pixel blocks.
+// Filled either by a cheap low-spp pre-pass or by the tile timings of the previous frame.
+class Cost_Map {
+public:
+    Cost_Map(int image_width, int image_height, int block_size = 16);
+
+    int get_block_size() const { return block_size; }
+    bool has_measurements() const { return measured; }
+
+    void clear();
+    // Distributes the cost of the tile over the blocks it covers (proportionally to the overlap area).
+    void add_tile_cost(const Tile& tile, float cost);
+    float get_tile_cost(const Tile& tile) const;
+    float get_total_cost() const;
+
+private:
+    int image_width, image_height;
+    int block_size;
+    int blocks_x, blocks_y;
+    std::vector<float> block_costs;
+    bool measured;
+};
+
+// Returns the tiles covering the image sorted from the most to the least expensive.
+// Tiles that are estimated to take a large share of the frame are split, and tiles scheduled
+// near the end of the frame are split further so that idle threads can pick up small pieces of work.
+std::vector<Tile> schedule_tiles(const Cost_Map& cost_map, int image_width, int image_height, int tile_size, int thread_count);
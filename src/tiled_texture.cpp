@@ -0,0 +1,299 @@
+#include "tiled_texture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include "../third_party//stb_image.h"
+
+namespace {
+const char Tiled_Texture_Magic[4] = {'R', 'T', 'T', 'X'};
+const uint32_t Tiled_Texture_Version = 1;
+const uint32_t Default_Tile_Size = 32;
+// Limits of files that open accepts, far above what convert_to_tiled_texture writes.
+const uint32_t Max_Tile_Size = 4096;
+const uint32_t Max_Level_Count = 32;
+const size_t Default_Texture_Cache_Budget = size_t(256) << 20;
+}
+
+bool convert_to_tiled_texture(const std::string& image_file, const std::string& tiled_file) {
+    int w, h, c;
+    unsigned char* pixels = stbi_load(image_file.c_str(), &w, &h, &c, STBI_rgb);
+    if (!pixels)
+        return false;
+
+    std::vector<std::vector<unsigned char>> level_pixels;
+    std::vector<Tiled_Texture_Level> levels;
+    level_pixels.emplace_back(pixels, pixels + 3 * w * h);
+    stbi_image_free(pixels);
+    levels.push_back(Tiled_Texture_Level{uint32_t(w), uint32_t(h), 0, 0, 0});
+
+    while (w > 1 || h > 1) {
+        int level_w = std::max(1, w / 2);
+        int level_h = std::max(1, h / 2);
+        level_pixels.emplace_back(3 * level_w * level_h);
+        downsample_rgb8(level_pixels[level_pixels.size() - 2].data(), w, h, level_pixels.back().data(), level_w, level_h);
+        levels.push_back(Tiled_Texture_Level{uint32_t(level_w), uint32_t(level_h), 0, 0, 0});
+        w = level_w;
+        h = level_h;
+    }
+
+    const uint32_t tile_size = Default_Tile_Size;
+    const size_t tile_bytes = 3 * tile_size * tile_size;
+
+    uint64_t offset = sizeof(Tiled_Texture_Header) + levels.size() * sizeof(Tiled_Texture_Level);
+    for (auto& level : levels) {
+        level.tiles_x = (level.width + tile_size - 1) / tile_size;
+        level.tiles_y = (level.height + tile_size - 1) / tile_size;
+        level.offset = offset;
+        offset += uint64_t(level.tiles_x) * level.tiles_y * tile_bytes;
+    }
+
+    std::ofstream out(tiled_file, std::ios::binary);
+    if (!out)
+        return false;
+
+    Tiled_Texture_Header header;
+    memcpy(header.magic, Tiled_Texture_Magic, sizeof(header.magic));
+    header.version = Tiled_Texture_Version;
+    header.tile_size = tile_size;
+    header.level_count = static_cast<uint32_t>(levels.size());
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(Tiled_Texture_Level));
+
+    std::vector<unsigned char> tile(tile_bytes);
+    for (size_t l = 0; l < levels.size(); l++) {
+        const auto& level = levels[l];
+        const auto& src = level_pixels[l];
+
+        for (uint32_t ty = 0; ty < level.tiles_y; ty++) {
+            for (uint32_t tx = 0; tx < level.tiles_x; tx++) {
+                std::fill(tile.begin(), tile.end(), 0);
+                for (uint32_t y = 0; y < tile_size && ty * tile_size + y < level.height; y++) {
+                    uint32_t x_count = std::min(tile_size, level.width - tx * tile_size);
+                    const unsigned char* row = &src[3 * ((ty * tile_size + y) * level.width + tx * tile_size)];
+                    memcpy(&tile[3 * y * tile_size], row, 3 * x_count);
+                }
+                out.write(reinterpret_cast<const char*>(tile.data()), tile.size());
+            }
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+bool Tiled_Texture_File::open(const std::string& file_name) {
+    static std::atomic<uint32_t> next_id{1};
+
+    if (!file.open(file_name))
+        return false;
+
+    if (file.get_size() < sizeof(Tiled_Texture_Header))
+        return false;
+
+    header = reinterpret_cast<const Tiled_Texture_Header*>(file.get_data());
+    levels = reinterpret_cast<const Tiled_Texture_Level*>(file.get_data() + sizeof(Tiled_Texture_Header));
+    if (memcmp(header->magic, Tiled_Texture_Magic, sizeof(header->magic)) != 0 ||
+        header->version != Tiled_Texture_Version ||
+        header->tile_size == 0 || header->tile_size > Max_Tile_Size ||
+        header->level_count == 0 || header->level_count > Max_Level_Count ||
+        file.get_size() < sizeof(Tiled_Texture_Header) + header->level_count * sizeof(Tiled_Texture_Level) ||
+        !has_valid_levels())
+    {
+        file.close();
+        return false;
+    }
+
+    id = next_id++;
+    return true;
+}
+
+// Every texel of every level has to be in a tile that lies within the file, get_tile_data reads
+// the mapping without checks.
+bool Tiled_Texture_File::has_valid_levels() const {
+    uint64_t tile_size = header->tile_size;
+    uint64_t tile_bytes = 3 * tile_size * tile_size;
+    uint64_t levels_end = sizeof(Tiled_Texture_Header) + header->level_count * sizeof(Tiled_Texture_Level);
+    uint64_t file_size = file.get_size();
+
+    for (uint32_t i = 0; i < header->level_count; i++) {
+        const Tiled_Texture_Level& level = levels[i];
+        if (level.width == 0 || level.height == 0 ||
+            level.tiles_x != (uint64_t(level.width) + tile_size - 1) / tile_size ||
+            level.tiles_y != (uint64_t(level.height) + tile_size - 1) / tile_size ||
+            level.offset < levels_end || level.offset > file_size)
+        {
+            return false;
+        }
+        // Divided instead of multiplied out, which could overflow for corrupt sizes.
+        uint64_t max_tile_count = (file_size - level.offset) / tile_bytes;
+        if (level.tiles_y > max_tile_count || level.tiles_x > max_tile_count / level.tiles_y)
+            return false;
+    }
+    return true;
+}
+
+const unsigned char* Tiled_Texture_File::get_tile_data(int level, int tile_x, int tile_y) const {
+    const Tiled_Texture_Level& l = levels[level];
+    size_t tile_bytes = 3 * header->tile_size * header->tile_size;
+    return file.get_data() + l.offset + (size_t(tile_y) * l.tiles_x + tile_x) * tile_bytes;
+}
+
+Texture_Cache::Texture_Cache(size_t memory_budget)
+    : shard_budget(memory_budget / Shard_Count)
+{}
+
+void Texture_Cache::set_memory_budget(size_t memory_budget) {
+    shard_budget = memory_budget / Shard_Count;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        evict(shard);
+    }
+}
+
+size_t Texture_Cache::get_memory_usage() const {
+    size_t usage = 0;
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        usage += shard.memory_usage;
+    }
+    return usage;
+}
+
+int64_t Texture_Cache::get_hit_count() const {
+    int64_t count = 0;
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        count += shard.hits;
+    }
+    return count;
+}
+
+int64_t Texture_Cache::get_miss_count() const {
+    int64_t count = 0;
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        count += shard.misses;
+    }
+    return count;
+}
+
+uint64_t Texture_Cache::get_tile_key(const Tiled_Texture_File& file, int level, int tile_x, int tile_y) {
+    return (uint64_t(file.get_id()) << 48) | (uint64_t(level) << 40) | (uint64_t(tile_y) << 20) | uint64_t(tile_x);
+}
+
+void Texture_Cache::evict(Shard& shard) {
+    // Keep at least one tile so that a budget smaller than a tile still works.
+    while (shard.memory_usage > shard_budget && shard.lru.size() > 1) {
+        uint64_t key = shard.lru.back();
+        shard.lru.pop_back();
+
+        auto it = shard.entries.find(key);
+        shard.memory_usage -= it->second.tile->pixels.size();
+        shard.entries.erase(it);
+    }
+}
+
+std::shared_ptr<const Texture_Tile> Texture_Cache::get_tile(const Tiled_Texture_File& file, int level, int tile_x, int tile_y) {
+    uint64_t key = get_tile_key(file, level, tile_x, tile_y);
+    Shard& shard = shards[(key ^ (key >> 20) ^ (key >> 40)) % Shard_Count];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        shard.hits++;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru_position);
+        return it->second.tile;
+    }
+
+    shard.misses++;
+    size_t tile_bytes = 3 * file.get_tile_size() * file.get_tile_size();
+    const unsigned char* data = file.get_tile_data(level, tile_x, tile_y);
+
+    auto tile = std::make_shared<Texture_Tile>();
+    tile->pixels.assign(data, data + tile_bytes);
+
+    shard.lru.push_front(key);
+    shard.entries[key] = Entry{tile, shard.lru.begin()};
+    shard.memory_usage += tile_bytes;
+    evict(shard);
+    return tile;
+}
+
+Texture_Cache& get_texture_cache() {
+    static Texture_Cache cache(Default_Texture_Cache_Budget);
+    return cache;
+}
+
+Vector Tiled_Image_Texture::texel(int level, int x, int y) const {
+    // Small per-thread memo of recently used tiles so that neighboring texels
+    // of a lookup do not go through the shared cache.
+    struct Tile_Memo {
+        uint64_t key = ~0ull;
+        std::shared_ptr<const Texture_Tile> tile;
+    };
+    static const int Memo_Size = 8;
+    static thread_local Tile_Memo memo[Memo_Size];
+
+    int tile_size = file->get_tile_size();
+    int tile_x = x / tile_size;
+    int tile_y = y / tile_size;
+
+    uint64_t key = Texture_Cache::get_tile_key(*file, level, tile_x, tile_y);
+    Tile_Memo& entry = memo[(tile_x + 3 * tile_y + 5 * level) % Memo_Size];
+    if (entry.key != key) {
+        entry.tile = cache->get_tile(*file, level, tile_x, tile_y);
+        entry.key = key;
+    }
+
+    const unsigned char* pixel = &entry.tile->pixels[3 * ((y - tile_y * tile_size) * tile_size + (x - tile_x * tile_size))];
+    return Vector(pixel[0], pixel[1], pixel[2]);
+}
+
+Vector Tiled_Image_Texture::bilinear(int level, float u, float v) const {
+    const Tiled_Texture_Level& l = file->get_level(level);
+    int w = static_cast<int>(l.width);
+    int h = static_cast<int>(l.height);
+
+    float x = u * w - 0.5f;
+    float y = (1.f - v) * h - 0.5f;
+
+    int x0 = static_cast<int>(std::floor(x));
+    int y0 = static_cast<int>(std::floor(y));
+    float fx = x - x0;
+    float fy = y - y0;
+
+    int x1 = std::min(std::max(x0 + 1, 0), w - 1);
+    int y1 = std::min(std::max(y0 + 1, 0), h - 1);
+    x0 = std::min(std::max(x0, 0), w - 1);
+    y0 = std::min(std::max(y0, 0), h - 1);
+
+    Vector top = (1.f - fx) * texel(level, x0, y0) + fx * texel(level, x1, y0);
+    Vector bottom = (1.f - fx) * texel(level, x0, y1) + fx * texel(level, x1, y1);
+    return (1.f - fy) * top + fy * bottom;
+}
+
+Vector Tiled_Image_Texture::value(float u, float v, const Vector& p, float footprint) const {
+    assert(u >= 0.f && u <= 1.f);
+    assert(v >= 0.f && v <= 1.f);
+
+    static constexpr float norm_coeff = 1 / 255.f;
+
+    const Tiled_Texture_Level& level0 = file->get_level(0);
+    int level_count = file->get_level_count();
+
+    float texels = footprint * std::max(level0.width, level0.height);
+    float level = texels > 1.f ? std::log2(texels) : 0.f;
+    level = std::min(level, float(level_count - 1));
+
+    int l0 = static_cast<int>(level);
+    int l1 = std::min(l0 + 1, level_count - 1);
+    float t = level - l0;
+
+    Vector color = bilinear(l0, u, v);
+    if (t > 0.f)
+        color = (1.f - t) * color + t * bilinear(l1, u, v);
+    return color * norm_coeff;
+}
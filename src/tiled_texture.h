@@ -0,0 +1,114 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "texture.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// On-disk layout of a pre-tiled, MIP-mapped 8-bit RGB texture:
+//   Tiled_Texture_Header
+//   Tiled_Texture_Level[level_count]
+//   tiles of level 0, level 1, ... (row-major, tile_size * tile_size * 3 bytes each,
+//   edge tiles are padded to the full tile size)
+struct Tiled_Texture_Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t tile_size;
+    uint32_t level_count;
+};
+
+struct Tiled_Texture_Level {
+    uint32_t width, height;
+    uint32_t tiles_x, tiles_y;
+    uint64_t offset;
+};
+
+// Offline conversion of an image file (any format supported by stb_image) to the tiled format.
+bool convert_to_tiled_texture(const std::string& image_file, const std::string& tiled_file);
+
+class Tiled_Texture_File {
+public:
+    bool open(const std::string& file_name);
+
+    uint32_t get_id() const { return id; }
+    int get_tile_size() const { return header->tile_size; }
+    int get_level_count() const { return header->level_count; }
+    const Tiled_Texture_Level& get_level(int level) const { return levels[level]; }
+    const unsigned char* get_tile_data(int level, int tile_x, int tile_y) const;
+
+private:
+    bool has_valid_levels() const;
+
+    Mapped_File file;
+    const Tiled_Texture_Header* header = nullptr;
+    const Tiled_Texture_Level* levels = nullptr;
+    uint32_t id = 0;
+};
+
+struct Texture_Tile {
+    std::vector<unsigned char> pixels;
+};
+
+// Thread-safe cache of texture tiles with a memory budget. Tiles are copied from the mapped
+// texture files on demand and the least recently used ones are evicted when the budget is exceeded.
+// The cache is split into shards with separate locks to keep contention low.
+class Texture_Cache {
+public:
+    explicit Texture_Cache(size_t memory_budget);
+
+    void set_memory_budget(size_t memory_budget);
+    size_t get_memory_usage() const;
+
+    std::shared_ptr<const Texture_Tile> get_tile(const Tiled_Texture_File& file, int level, int tile_x, int tile_y);
+
+    int64_t get_hit_count() const;
+    int64_t get_miss_count() const;
+
+    static uint64_t get_tile_key(const Tiled_Texture_File& file, int level, int tile_x, int tile_y);
+
+private:
+    static const int Shard_Count = 16;
+
+    struct Entry {
+        std::shared_ptr<const Texture_Tile> tile;
+        std::list<uint64_t>::iterator lru_position;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<uint64_t> lru; // most recently used at the front
+        std::unordered_map<uint64_t, Entry> entries;
+        size_t memory_usage = 0;
+        int64_t hits = 0;
+        int64_t misses = 0;
+    };
+
+    void evict(Shard& shard);
+
+    Shard shards[Shard_Count];
+    size_t shard_budget;
+};
+
+Texture_Cache& get_texture_cache();
+
+class Tiled_Image_Texture : public Texture {
+public:
+    Tiled_Image_Texture(const Tiled_Texture_File* file, Texture_Cache* cache)
+        : file(file), cache(cache) {}
+
+    Vector value(float u, float v, const Vector& p, float footprint) const override;
+    bool uses_footprint() const override { return true; }
+
+private:
+    Vector texel(int level, int x, int y) const;
+    Vector bilinear(int level, float u, float v) const;
+
+    const Tiled_Texture_File* file;
+    Texture_Cache* cache;
+};
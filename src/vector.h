@@ -54,14 +54,12 @@ public:
     }
 
     Vector& operator/=(float t) {
-        x /= t;
-        y /= t;
-        z /= t;
-        return *this;
+        return *this *= 1.f / t;
     }
 
     Vector operator/(float t) const {
-        return Vector(x/t, y/t, z/t);
+        float inv_t = 1.f / t;
+        return Vector(x*inv_t, y*inv_t, z*inv_t);
     }
 
     float length() const {